@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <embree3/rtcore.h>
+#include <Eigen/Core>
+
+#include "bvh/bvh.hpp"
+#include "bvh/intersector.hpp"
+#include "camera/film.hpp"
+#include "config/options.hpp"
+#include "embree/embreesingleton.hpp"
+#include "loaders/objloader.hpp"
+#include "loaders/scene.hpp"
+#include "renderers/shading.hpp"
+#include "utils/random.hpp"
+
+using namespace CT;
+
+constexpr size_t kLanes = 16;
+
+struct alignas(64) ValidMask
+{
+    std::array<int, kLanes> lanes;
+};
+
+/// @brief Write a ray to one lane of a packet
+template<typename Ray16>
+static void SetLane(Ray16& ray, size_t lane, const Eigen::Vector3f& org, const Eigen::Vector3f& dir, float tfar)
+{
+    ray.org_x[lane] = org.x();
+    ray.org_y[lane] = org.y();
+    ray.org_z[lane] = org.z();
+    ray.dir_x[lane] = dir.x();
+    ray.dir_y[lane] = dir.y();
+    ray.dir_z[lane] = dir.z();
+    ray.tnear[lane] = 0.0001F;
+    ray.tfar[lane]  = tfar;
+    ray.time[lane]  = 0.0F;
+    ray.mask[lane]  = 0xFFFFFFFF;
+    ray.id[lane]    = static_cast<unsigned int>(lane);
+    ray.flags[lane] = 0;
+}
+
+/// @brief Rays of one kind, traced 16 at a time as the renderers trace them
+struct RaySet
+{
+    std::string name;
+    bool shadow   = false; // Tested for occlusion rather than intersected
+    bool coherent = false;
+    std::vector<RTCRayHit16> hits {};
+    std::vector<RTCRay16> rays {};
+    std::vector<ValidMask> valid {};
+    size_t count = 0;
+
+    void Add(const Eigen::Vector3f& org, const Eigen::Vector3f& dir, float tfar)
+    {
+        const size_t lane = count++ % kLanes;
+        if (lane == 0)
+        {
+            valid.emplace_back().lanes.fill(0);
+            if (shadow)
+                rays.emplace_back();
+            else
+                hits.emplace_back();
+        }
+
+        valid.back().lanes[lane] = -1;
+        if (shadow)
+            SetLane(rays.back(), lane, org, dir, tfar);
+        else
+        {
+            SetLane(hits.back().ray, lane, org, dir, tfar);
+            hits.back().hit.geomID[lane] = RTC_INVALID_GEOMETRY_ID;
+        }
+    }
+};
+
+static void Trace(RaySet& set)
+{
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    if (set.coherent)
+        context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+    for (size_t p = 0; p < set.valid.size(); p++)
+    {
+        if (set.shadow)
+            Occluded16(set.valid[p].lanes.data(), context, set.rays[p]);
+        else
+            Intersect16(set.valid[p].lanes.data(), context, set.hits[p]);
+    }
+}
+
+/// @brief Trace a copy of a ray set with the current intersector, keeping the best time
+/// @param set
+/// @param repetitions
+/// @param result The traced rays
+/// @return Microseconds
+static int64_t TimeTrace(const RaySet& set, size_t repetitions, RaySet& result)
+{
+    int64_t best = std::numeric_limits<int64_t>::max();
+    for (size_t r = 0; r < repetitions; r++)
+    {
+        RaySet traced = set;
+        const auto start = std::chrono::high_resolution_clock::now();
+        Trace(traced);
+        best = std::min<int64_t>(best, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count());
+        result = std::move(traced);
+    }
+    return std::max<int64_t>(best, 1);
+}
+
+/// @brief Count the rays the two intersectors disagree on: a different triangle hit, or a different occlusion
+static size_t CountMismatches(const RaySet& a, const RaySet& b)
+{
+    size_t mismatches = 0;
+    for (size_t p = 0; p < a.valid.size(); p++)
+    {
+        for (size_t lane = 0; lane < kLanes; lane++)
+        {
+            if (a.valid[p].lanes[lane] == 0)
+                continue;
+
+            if (a.shadow)
+                mismatches += (a.rays[p].tfar[lane] < 0.0F) != (b.rays[p].tfar[lane] < 0.0F);
+            else
+                mismatches += a.hits[p].hit.geomID[lane] != b.hits[p].hit.geomID[lane] || a.hits[p].hit.primID[lane] != b.hits[p].hit.primID[lane] ||
+                              a.hits[p].hit.instID[0][lane] != b.hits[p].hit.instID[0][lane];
+        }
+    }
+    return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+    // Usage: bvh-bench [repetitions] [width] [height]
+    const size_t repetitions = argc > 1 ? std::stoul(argv[1]) : 5;
+    const size_t width       = argc > 2 ? std::stoul(argv[2]) : 640;
+    const size_t height      = argc > 3 ? std::stoul(argv[3]) : 360;
+
+    // The loader only gathers the triangles of the custom BVH when it is enabled
+    std::array<char*, 2> options = { argv[0], const_cast<char*>("--bvh") };
+    ConfigSingleton::ParseOptions(static_cast<int>(options.size()), options.data());
+
+    EmbreeSingleton& es = EmbreeSingleton::GetInstance();
+
+    const std::vector<std::pair<std::string, const Scene*>> scenes =
+    {
+        { "double_dragon", &double_dragon },
+        { "triple_statue", &triple_statue },
+        { "cornell_box",   &cornell_box },
+        { "split_room",    &split_room },
+        { "teapot",        &teapot },
+    };
+
+    std::cout << "BVH benchmark, " << width << "x" << height << " primary rays, single thread, best of " << repetitions << std::endl;
+
+    for (const auto& [scene_name, scene] : scenes)
+    {
+        std::vector<Object> objects = scene->objects;
+        ObjectLoader loader;
+        loader.LoadObjects(objects);
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        const BVH4 bvh = BuildBVH(RTC_BUILD_QUALITY_LOW, loader.GetTriangles());
+        const auto build_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+        // Primary rays in the 4x4 pixel packets the renderers trace
+        RaySet primary { .name = "primary", .coherent = true };
+        Film film(width, height, Eigen::Vector2i(40, 40));
+        for (const Canvas& canvas : film.canvases)
+        {
+            for (size_t by = 0; by < canvas.rect.GetHeight(); by += Camera::kPacket16Height)
+            {
+                for (size_t bx = 0; bx < canvas.rect.GetWidth(); bx += Camera::kPacketWidth)
+                {
+                    primary.valid.emplace_back();
+                    primary.count += scene->camera.GetRayPacket16(canvas, bx, by, primary.hits.emplace_back(), primary.valid.back().lanes.data());
+                }
+            }
+        }
+
+        // Shadow and hemisphere rays leave the surfaces Embree finds for the primary rays
+        RaySet reference;
+        SetIntersectorBVH(nullptr);
+        TimeTrace(primary, 1, reference);
+
+        RaySet shadow { .name = "shadow", .shadow = true };
+        RaySet hemisphere { .name = "hemisphere" };
+
+        std::optional<Eigen::Vector3f> light;
+        if (!scene->lights.point.empty())
+            light = scene->lights.point.front().position;
+        else if (!scene->lights.area_cuboid.empty())
+            light = scene->lights.area_cuboid.front().position;
+
+        RNG rng(0);
+        for (size_t p = 0; p < reference.hits.size(); p++)
+        {
+            const RTCRayHit16& packet = reference.hits[p];
+            for (size_t lane = 0; lane < kLanes; lane++)
+            {
+                if (reference.valid[p].lanes[lane] == 0 || packet.hit.geomID[lane] == RTC_INVALID_GEOMETRY_ID)
+                    continue;
+
+                const RTCRayHit rayhit = ExtractRayHit(packet, lane);
+                const Eigen::Vector3f dir(rayhit.ray.dir_x, rayhit.ray.dir_y, rayhit.ray.dir_z);
+                const Eigen::Vector3f position = Eigen::Vector3f(rayhit.ray.org_x, rayhit.ray.org_y, rayhit.ray.org_z) + rayhit.ray.tfar * dir;
+
+                Eigen::Vector3f normal = InterpolateNormals(ResolveHit(rayhit.hit), rayhit.hit);
+                if (normal.dot(dir) > 0.0F)
+                    normal = -normal;
+
+                const Eigen::Vector2f u(rng.Uniform(), rng.Uniform());
+                hemisphere.Add(position, SampleCosineWeightedHemisphere(normal, u).dir, std::numeric_limits<float>::infinity());
+
+                if (light)
+                {
+                    const Eigen::Vector3f to_light = *light - position;
+                    const float distance = to_light.norm();
+                    shadow.Add(position, to_light / distance, distance);
+                }
+            }
+        }
+
+        std::cout << std::endl << scene_name << ": " << loader.GetTriangles().size() << " triangles, " << bvh.GetNodeCount() << " nodes, "
+                  << bvh.GetLeafCount() << " leaves, built in " << build_ms << " ms" << std::endl;
+        std::cout << std::setw(12) << "rays" << std::setw(12) << "count" << std::setw(16) << "embree Mray/s"
+                  << std::setw(16) << "bvh4 Mray/s" << std::setw(10) << "speedup" << std::setw(12) << "mismatches" << std::endl;
+
+        for (const RaySet* set : { &primary, &shadow, &hemisphere })
+        {
+            if (set->count == 0)
+                continue;
+
+            RaySet embree_result, bvh_result;
+            SetIntersectorBVH(nullptr);
+            const int64_t embree_us = TimeTrace(*set, repetitions, embree_result);
+            SetIntersectorBVH(&bvh);
+            const int64_t bvh_us = TimeTrace(*set, repetitions, bvh_result);
+            SetIntersectorBVH(nullptr);
+
+            const auto mrays = [&](int64_t us) { return static_cast<double>(set->count) / static_cast<double>(us); };
+            std::cout << std::setw(12) << set->name << std::setw(12) << set->count << std::fixed << std::setprecision(2)
+                      << std::setw(16) << mrays(embree_us) << std::setw(16) << mrays(bvh_us)
+                      << std::setw(10) << static_cast<double>(embree_us) / static_cast<double>(bvh_us)
+                      << std::setw(12) << CountMismatches(embree_result, bvh_result) << std::endl;
+        }
+
+        // The scene reads the mesh files of the loader, so it is replaced before the loader goes
+        rtcReleaseScene(es.scene);
+        es.scene = rtcNewScene(es.device);
+    }
+
+    return EXIT_SUCCESS;
+}
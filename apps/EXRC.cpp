@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tinyexr.h>
+
+#include "utils/exr.hpp"
+
+using namespace CT;
+
+// Neither size is a multiple of the tile size or of the 16 scanlines of a ZIP block, so every file has partial blocks
+constexpr size_t kWidth    = 37;
+constexpr size_t kHeight   = 23;
+constexpr size_t kTileSize = 16;
+
+/// @brief Smooth gradients with a few sharp steps, values in [0, 4)
+static std::vector<float> MakePlane(size_t seed)
+{
+    std::vector<float> rgb(kWidth * kHeight * 3);
+    for (size_t y = 0; y < kHeight; y++)
+        for (size_t x = 0; x < kWidth; x++)
+            for (size_t c = 0; c < 3; c++)
+                rgb[3 * (y * kWidth + x) + c] = static_cast<float>((x * (c + 1) + y * 3 + seed * 7) % 64) / 16.0F + (x % 5 == 0 ? 0.5F : 0.0F);
+    return rgb;
+}
+
+/// @brief Compression tinyexr should report for a file written with the given settings
+static int ExpectedCompression(EXRCompression compression)
+{
+    switch (compression)
+    {
+        case EXRCompression::None: return TINYEXR_COMPRESSIONTYPE_NONE;
+        case EXRCompression::ZIPS: return TINYEXR_COMPRESSIONTYPE_ZIPS;
+        case EXRCompression::PIZ:  return TINYEXR_COMPRESSIONTYPE_PIZ;
+        default:                   return TINYEXR_COMPRESSIONTYPE_ZIP; // DWAA is written as ZIP
+    }
+}
+
+/// @brief Read one layer back and compare it with the plane it was written from
+/// @return Number of values that differ by more than the precision of the file
+static size_t CompareLayer(const std::filesystem::path& filename, const char* layer, const std::vector<float>& expected, bool half)
+{
+    float* rgba = nullptr;
+    int width = 0, height = 0;
+    const char* err = nullptr;
+    if (LoadEXRWithLayer(&rgba, &width, &height, filename.c_str(), layer, &err) != TINYEXR_SUCCESS)
+    {
+        std::cerr << filename << ": could not load layer '" << (layer ? layer : "") << "': " << (err ? err : "unknown error") << std::endl;
+        FreeEXRErrorMessage(err);
+        return expected.size();
+    }
+
+    size_t mismatches = 0;
+    if (static_cast<size_t>(width) != kWidth || static_cast<size_t>(height) != kHeight)
+    {
+        std::cerr << filename << ": read " << width << "x" << height << std::endl;
+        mismatches = expected.size();
+    }
+    else
+    {
+        const float tolerance = half ? 1.0F / 512.0F : 0.0F; // Relative, half floats keep 11 significant bits
+        for (size_t i = 0; i < kWidth * kHeight; i++)
+            for (size_t c = 0; c < 3; c++)
+                mismatches += std::abs(rgba[4 * i + c] - expected[3 * i + c]) > tolerance * std::max(1.0F, expected[3 * i + c]);
+    }
+
+    free(rgba);
+    return mismatches;
+}
+
+/// @brief Write a beauty and an albedo layer with the given settings and check that tinyexr reads back the same
+/// header and values
+/// @return True if the file round trips
+static bool RoundTrip(const std::filesystem::path& directory, const std::string& name, const EXRSettings& settings)
+{
+    const std::vector<float> beauty = MakePlane(0);
+    const std::vector<float> albedo = MakePlane(1);
+    const std::filesystem::path filename = directory / (name + ".exr");
+    try
+    {
+        WriteEXR({ { "", beauty.data() }, { "albedo", albedo.data() } }, kWidth, kHeight, filename, settings);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    EXRVersion version;
+    EXRHeader header;
+    InitEXRHeader(&header);
+    const char* err = nullptr;
+    if (ParseEXRVersionFromFile(&version, filename.c_str()) != TINYEXR_SUCCESS || ParseEXRHeaderFromFile(&header, &version, filename.c_str(), &err) != TINYEXR_SUCCESS)
+    {
+        std::cerr << filename << ": could not parse the header: " << (err ? err : "unknown error") << std::endl;
+        FreeEXRErrorMessage(err);
+        return false;
+    }
+
+    if (header.compression_type != ExpectedCompression(settings.compression) || (header.tiled != 0) != settings.tiled || header.num_channels != 6)
+    {
+        std::cerr << filename << ": header has compression " << header.compression_type << ", tiled " << header.tiled << ", " << header.num_channels << " channels" << std::endl;
+        ok = false;
+    }
+    if (settings.tiled && (static_cast<size_t>(header.tile_size_x) != settings.tile_size || static_cast<size_t>(header.tile_size_y) != settings.tile_size))
+    {
+        std::cerr << filename << ": header has " << header.tile_size_x << "x" << header.tile_size_y << " tiles" << std::endl;
+        ok = false;
+    }
+    FreeEXRHeader(&header);
+
+    const size_t mismatches = CompareLayer(filename, nullptr, beauty, settings.half) + CompareLayer(filename, "albedo", albedo, settings.half);
+    std::cout << name << ": " << mismatches << " mismatches" << std::endl;
+    return ok && mismatches == 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Usage: exr-check [directory]
+    const std::filesystem::path directory = argc > 1 ? argv[1] : "exr-check";
+    std::filesystem::create_directories(directory);
+
+    const std::vector<std::pair<std::string, EXRCompression>> compressions =
+    {
+        { "none", EXRCompression::None },
+        { "zips", EXRCompression::ZIPS },
+        { "zip",  EXRCompression::ZIP },
+        { "piz",  EXRCompression::PIZ },
+        { "dwaa", EXRCompression::DWAA },
+    };
+
+    bool ok = true;
+    for (const auto& [name, compression] : compressions)
+    {
+        for (const bool tiled : { false, true })
+        {
+            for (const bool half : { true, false })
+            {
+                EXRSettings settings;
+                settings.compression = compression;
+                settings.tiled       = tiled;
+                settings.tile_size   = kTileSize;
+                settings.half        = half;
+                ok &= RoundTrip(directory, name + (tiled ? "-tiled" : "-scanline") + (half ? "-half" : "-float"), settings);
+            }
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
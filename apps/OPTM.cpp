@@ -1,29 +1,139 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <vector>
-#include <cstdlib>
 
-int main()
-{
+#include <getopt.h>
 
-    // I have some weightings for different parameters at different values
+#include "config/options.hpp"
+#include "session/session.hpp"
+#include "session/tuner.hpp"
+#include "utils/timer.hpp"
 
+using namespace CT;
+
+static void PrintUsage()
+{
+    std::cout << "Usage: ray-tester [tuner options] -- [ray-tracer options]\n"
+              << "  -m, --mode sweep|optimise  Render a grid of parameters or search with Nelder-Mead (default optimise)\n"
+              << "  -s, --steps <n>            Values per parameter of a sweep (default 3)\n"
+              << "  -a, --attempts <n>         Nelder-Mead restarts (default 5)\n"
+              << "  -n, --evaluations <n>      Objective evaluations per attempt (default 40)\n"
+              << "  -w, --time_weight <w>      Weight of the render time in ms in the objective (default 0)\n"
+              << "  -b, --budget <s>           Skip parameters predicted to render for longer, by a calibrated cost model\n"
+              << "  -r, --seed <n>             Seed of the restart perturbations (default 0)\n"
+              << "  -o, --output <file>        Tuning data, in the schema of testdata/*.json\n"
+              << "  -f, --front <file>         Pareto front of L1 difference against render time" << std::endl;
+}
 
+static std::string Timestamp()
+{
+    const std::time_t now = std::time(nullptr);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y%m%d%H%M%S", std::localtime(&now));
+    return buffer;
+}
 
+int main(int argc, char** argv)
+{
     std::cout << "OPTM Tester" << std::endl;
 
-    std::string ray_tracer = "./build/release/apps/ray-tracer";
+    // Options before "--" belong to the tuner, the rest configure the renders
+    int split = 1;
+    while (split < argc && std::string(argv[split]) != "--")
+        split++;
 
-    std::string cmd = ray_tracer + " -o output/oingo.exr -r 1920x1080 -d 1 -h 8 -i 3 -k -e 1 | tee log.txt";
+    bool sweep         = false;
+    size_t steps       = 3;
+    size_t attempts    = 5;
+    size_t evaluations = 40;
+    double time_weight = 0.0;
+    double budget      = 0.0;
+    uint32_t seed      = 0;
+    const std::string timestamp = Timestamp();
+    std::string output = "output_data_" + timestamp + ".json";
+    std::string front  = "pareto_front_" + timestamp + ".json";
 
-    int result = std::system(cmd.c_str());
+    const option long_opts[] = {
+        {"mode",        required_argument, nullptr, 'm'},
+        {"steps",       required_argument, nullptr, 's'},
+        {"attempts",    required_argument, nullptr, 'a'},
+        {"evaluations", required_argument, nullptr, 'n'},
+        {"time_weight", required_argument, nullptr, 'w'},
+        {"budget",      required_argument, nullptr, 'b'},
+        {"seed",        required_argument, nullptr, 'r'},
+        {"output",      required_argument, nullptr, 'o'},
+        {"front",       required_argument, nullptr, 'f'},
+        {nullptr,       no_argument,       nullptr,  0 }
+    };
 
-    if (result != 0)
+    int opt;
+    while ((opt = getopt_long(split, argv, "m:s:a:n:w:b:r:o:f:", long_opts, nullptr)) != -1)
     {
-        std::cerr << "Oopsie woopsie, we did a widdwl fucky wucky! Ewwow executing the command. Pwease twy again >w<. ";
-        return EXIT_FAILURE;
+        switch (opt)
+        {
+            case 'm': sweep       = std::string(optarg) == "sweep"; break;
+            case 's': steps       = std::max<size_t>(std::stoul(optarg), 2); break;
+            case 'a': attempts    = std::stoul(optarg); break;
+            case 'n': evaluations = std::stoul(optarg); break;
+            case 'w': time_weight = std::stod(optarg); break;
+            case 'b': budget      = std::stod(optarg); break;
+            case 'r': seed        = static_cast<uint32_t>(std::stoul(optarg)); break;
+            case 'o': output      = optarg; break;
+            case 'f': front       = optarg; break;
+            default:
+            {
+                PrintUsage();
+                return EXIT_FAILURE;
+            }
+        }
     }
 
+    // Hand the remaining arguments to the ray-tracer's parser, behind the program name
+    std::vector<char*> render_args = { argv[0] };
+    for (int i = split + 1; i < argc; i++)
+        render_args.push_back(argv[i]);
+    optind = 0; // Make getopt start over on the new argument list
+
+    try
+    {
+        Timer t = Timer("OPTM");
+
+        ConfigSingleton::ParseOptions(static_cast<int>(render_args.size()), render_args.data());
+
+        RenderSession session;
+        Tuner tuner(session, time_weight, seed);
+        tuner.SetBudget(budget);
+
+        if (sweep)
+            tuner.Sweep(steps);
+        else
+            tuner.Optimise(attempts, evaluations);
+
+        if (tuner.GetSamples().empty())
+            throw std::runtime_error("Every candidate was predicted to exceed the budget");
+
+        const TunerSample& best = tuner.Best();
+        const auto parameters   = ToParameters(best.point);
+        std::cout << "Best objective " << best.objective << " with L1 " << best.l1 << " in " << best.render_ms << " ms:";
+        for (size_t p = 0; p < kTunerParameters.size(); p++)
+            std::cout << " " << kTunerParameters[p].name << "=" << parameters[p];
+        std::cout << std::endl;
+
+        WriteTuningJSON(tuner.GetSamples(), output);
+        WriteTuningJSON(ParetoFront(tuner.GetSamples()), front, false);
+        std::cout << "JSON data has been written to " << output << ", Pareto front to " << front << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Tuning failed: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera/film.hpp"
+#include "renderers/threadpool.hpp"
+#include "renderers/workstealing.hpp"
+#include "utils/random.hpp"
+
+using namespace CT;
+
+// Stand in for shading a pixel. Pixels near the centre of the film cost more, like the dragons
+// against the black background, so tiles are unevenly loaded.
+static void ShadeCanvas(Canvas& canvas, size_t work)
+{
+    const Rect& film = canvas.GetFilm().rect;
+    const float cx = static_cast<float>(film.GetWidth()) * 0.5F;
+    const float cy = static_cast<float>(film.GetHeight()) * 0.5F;
+
+    for (size_t y = 0; y < canvas.rect.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < canvas.rect.GetWidth(); x++)
+        {
+            const float dx = (static_cast<float>(x + canvas.rect.ulx) - cx) / cx;
+            const float dy = (static_cast<float>(y + canvas.rect.uly) - cy) / cy;
+            const auto iterations = static_cast<size_t>(static_cast<float>(work) * std::exp(-4.0F * (dx * dx + dy * dy))) + 1;
+
+            uint64_t h = x + canvas.rect.ulx;
+            for (size_t i = 0; i < iterations; i++)
+                h = MixBits(h + y);
+
+            auto pixel = canvas(x, y);
+            pixel.r = static_cast<float>(h & 0xFFU) / 255.0F;
+        }
+    }
+}
+
+static int64_t RunThreadPool(Film& film, size_t threads, size_t work)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    {
+        ThreadPool pool(threads);
+        std::vector<std::future<void>> futures;
+        futures.reserve(film.canvases.size());
+
+        for (auto& canvas : film.canvases)
+            futures.emplace_back(pool.enqueue(ShadeCanvas, std::ref(canvas), work));
+
+        for (auto& future : futures)
+            future.get();
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static int64_t RunWorkStealing(Film& film, size_t threads, size_t work, size_t columns, size_t rows)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    {
+        const std::vector<size_t> order = HilbertTileOrder(columns, rows);
+        WorkStealingScheduler scheduler(threads);
+        scheduler.ParallelFor(order.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                ShadeCanvas(film.canvases[order[i]], work);
+        });
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    // Usage: scheduler-bench [repetitions] [work per pixel]
+    const size_t repetitions = argc > 1 ? std::stoul(argv[1]) : 5;
+    const size_t work        = argc > 2 ? std::stoul(argv[2]) : 64;
+    const size_t threads     = std::thread::hardware_concurrency();
+
+    constexpr size_t kWidth  = 3840;
+    constexpr size_t kHeight = 2160;
+    const std::vector<size_t> canvas_sizes = { 4, 16, 40, 128, 540 };
+
+    std::cout << "Scheduler benchmark, " << kWidth << "x" << kHeight << " film, " << threads << " threads, "
+              << work << " work per pixel, best of " << repetitions << std::endl;
+    std::cout << std::setw(10) << "canvas" << std::setw(10) << "tiles" << std::setw(16) << "pool (us)"
+              << std::setw(16) << "stealing (us)" << std::setw(10) << "speedup" << std::endl;
+
+    for (const size_t size : canvas_sizes)
+    {
+        Film film(kWidth, kHeight, Eigen::Vector2i(size, size));
+        const size_t columns = (kWidth + size - 1) / size;
+        const size_t rows    = (kHeight + size - 1) / size;
+
+        int64_t pool     = std::numeric_limits<int64_t>::max();
+        int64_t stealing = std::numeric_limits<int64_t>::max();
+        for (size_t r = 0; r < repetitions; r++)
+        {
+            pool     = std::min(pool, RunThreadPool(film, threads, work));
+            stealing = std::min(stealing, RunWorkStealing(film, threads, work, columns, rows));
+        }
+
+        std::cout << std::setw(10) << (std::to_string(size) + "x" + std::to_string(size)) << std::setw(10) << film.canvases.size()
+                  << std::setw(16) << pool << std::setw(16) << stealing << std::setw(10) << std::fixed << std::setprecision(2)
+                  << static_cast<double>(pool) / static_cast<double>(stealing) << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,24 +1,34 @@
 #include "bvh.hpp"
+#include "simd.hpp"
 #include "embree/embreesingleton.hpp"
 #include "utils/timer.hpp"
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 
 
 namespace CT
 {
 
 /// @brief Computes the surface area of a bounding box
-/// @param b 
-/// @return 
+/// @param b
+/// @return
 float Area(const RTCBounds& b)
 {
-    return 2.0F * (b.upper_x - b.lower_x) * (b.upper_y - b.lower_y) * (b.upper_z - b.lower_z);
+    const float x = b.upper_x - b.lower_x;
+    const float y = b.upper_y - b.lower_y;
+    const float z = b.upper_z - b.lower_z;
+    return 2.0F * (x * y + y * z + z * x);
 }
 
 /// @brief Merges two bounding boxes
-/// @param a 
-/// @param b 
-/// @return 
+/// @param a
+/// @param b
+/// @return
 RTCBounds Merge(const RTCBounds& a, const RTCBounds& b)
 {
     RTCBounds ret;
@@ -41,68 +51,80 @@ struct Node
 
 struct InnerNode : public Node
 {
-    // AABB 
-    std::array<RTCBounds, 2> bounds;
+    // AABB
+    std::array<RTCBounds, kBVHWidth> bounds;
 
     // Node children
-    std::array<Node*, 2> children;
+    std::array<Node*, kBVHWidth> children;
+    unsigned int count;
 
-    InnerNode()
+    InnerNode(unsigned int count) : count(count)
     {
-        bounds[0]   = RTCBounds();
-        bounds[1]   = RTCBounds();
-        children[0] = nullptr;
-        children[1] = nullptr;
+        bounds.fill(RTCBounds());
+        children.fill(nullptr);
     }
 
     float sah() override
     {
-        return 1.0F+ (Area(bounds[0]) * children[0]->sah() + Area(bounds[1])*children[1]->sah()) / Area(Merge(bounds[0], bounds[1]));
+        RTCBounds merged = bounds[0];
+        float cost = 0.0F;
+        for (size_t i = 0; i < count; i++)
+        {
+            merged = Merge(merged, bounds[i]);
+            cost  += Area(bounds[i]) * children[i]->sah();
+        }
+
+        // A flat node, e.g. around coplanar triangles, is entered by no ray at all
+        const float area = Area(merged);
+        return area > 0.0F ? 1.0F + cost / area : 1.0F;
     }
 
     static void* Create(RTCThreadLocalAllocator alloc, unsigned int num_children, void* usrptr)
     {
-        assert(num_children == 2);
+        assert(num_children <= kBVHWidth);
         void* ptr = rtcThreadLocalAlloc(alloc, sizeof(InnerNode), 16);
-        return static_cast<void*> (new (ptr) InnerNode());
+        return static_cast<void*> (new (ptr) InnerNode(num_children));
     }
 
     static void SetChildren(void* nodeptr, void** childptr, unsigned int num_children, void* usrptr)
     {
-        assert(num_children == 2);
-        for(size_t i = 0; i < 2; i++)
+        assert(num_children <= kBVHWidth);
+        for(size_t i = 0; i < num_children; i++)
         {
             static_cast<InnerNode*>(nodeptr)->children[i] = static_cast<Node*>(childptr[i]);
-        }            
+        }
     }
 
     static void SetBounds(void* nodeptr, const RTCBounds** bounds, unsigned int num_children, void* usrptr)
     {
-        assert(num_children == 2);
-        for(size_t i = 0; i < 2; i++)
+        assert(num_children <= kBVHWidth);
+        for(size_t i = 0; i < num_children; i++)
         {
             static_cast<InnerNode*>(nodeptr)->bounds[i] = *(const RTCBounds*) bounds[i];
-        }   
+        }
     }
 };
 
 struct LeafNode : public Node
 {
-    unsigned id;
-    RTCBounds bounds;
-
-    LeafNode(unsigned id, const RTCBounds& bounds) : id(id), bounds(bounds) {}
+    // Indices of the triangles
+    std::array<unsigned, kBVHWidth> ids;
+    unsigned count;
 
     float sah() override
     {
-        return 1.0F;
+        return static_cast<float>(count);
     }
 
     static void* Create(RTCThreadLocalAllocator alloc, const RTCBuildPrimitive* prims, size_t num_prims, void* user_ptr)
     {
-        assert(num_prims == 1);
+        assert(num_prims > 0 && num_prims <= kBVHWidth);
         void* ptr = rtcThreadLocalAlloc(alloc, sizeof(LeafNode), 16);
-        return static_cast<void*> (new (ptr) LeafNode(prims->primID, reinterpret_cast<const RTCBounds&>(*prims)));
+        auto* leaf = new (ptr) LeafNode();
+        leaf->count = static_cast<unsigned>(num_prims);
+        for (size_t i = 0; i < num_prims; i++)
+            leaf->ids[i] = prims[i].primID;
+        return static_cast<void*>(leaf);
     }
 };
 
@@ -122,29 +144,255 @@ void ErrCallback(void* user_ptr, RTCError code, const char* str)
     std::cout << "EMBREE ERROR CODE " << code << ": " << str << std::endl;
 }
 
-void BuildBVH(RTCBuildQuality quality, std::vector<RTCBuildPrimitive>& prims_i, char* cfg, size_t extra_space)
+std::optional<RTCBuildQuality> ParseBuildQuality(const std::string& name)
+{
+    if (name == "low")
+        return RTC_BUILD_QUALITY_LOW;
+    if (name == "medium")
+        return RTC_BUILD_QUALITY_MEDIUM;
+    if (name == "high")
+        return RTC_BUILD_QUALITY_HIGH;
+    return std::nullopt;
+}
+
+const char* BuildQualityName(RTCBuildQuality quality)
+{
+    switch (quality)
+    {
+        case RTC_BUILD_QUALITY_LOW:    return "low";
+        case RTC_BUILD_QUALITY_MEDIUM: return "medium";
+        case RTC_BUILD_QUALITY_HIGH:   return "high";
+        default:                       return "refit";
+    }
+}
+
+std::string BVHStatistics::ToString() const
+{
+    const size_t leaf_count = std::max<size_t>(leaves, 1);
+    size_t depth_sum = 0;
+    for (size_t depth = 0; depth < leaf_depths.size(); depth++)
+        depth_sum += depth * leaf_depths[depth];
+
+    std::ostringstream ss;
+    ss << "build_ms=" << build_ms << " sah=" << sah << " nodes=" << nodes << " leaves=" << leaves << " references=" << references
+       << " memory_kib=" << memory / 1024 << " max_depth=" << (leaf_depths.empty() ? 0 : leaf_depths.size() - 1)
+       << " mean_depth=" << static_cast<double>(depth_sum) / static_cast<double>(leaf_count)
+       << " mean_occupancy=" << static_cast<double>(references) / static_cast<double>(leaf_count);
+
+    // Histograms as count per bucket, separated by slashes
+    ss << " leaf_sizes=";
+    for (size_t size = 1; size < leaf_sizes.size(); size++)
+        ss << (size > 1 ? "/" : "") << leaf_sizes[size];
+    ss << " leaf_depths=";
+    for (size_t depth = 0; depth < leaf_depths.size(); depth++)
+        ss << (depth > 0 ? "/" : "") << leaf_depths[depth];
+    return ss.str();
+}
+
+/// @brief Bounds of a triangle
+static RTCBounds Bounds(const BVHTriangle& triangle)
+{
+    const Eigen::Vector3f lower = triangle.v0.cwiseMin(triangle.v1).cwiseMin(triangle.v2);
+    const Eigen::Vector3f upper = triangle.v0.cwiseMax(triangle.v1).cwiseMax(triangle.v2);
+    RTCBounds ret;
+    ret.lower_x = lower.x();
+    ret.lower_y = lower.y();
+    ret.lower_z = lower.z();
+    ret.upper_x = upper.x();
+    ret.upper_y = upper.y();
+    ret.upper_z = upper.z();
+    return ret;
+}
+
+/// @brief One dequantised bound, through the same instructions as traversal
+static float Dequantise(uint8_t q, float origin, float scale)
+{
+    return _mm_cvtss_f32(Dequantise(std::array<uint8_t, kBVHWidth>{ q, q, q, q }, origin, scale));
+}
+
+/// @brief Quantise the bounds of a child so the dequantised box always encloses it
+/// @param node Node with its origin and scale set
+/// @param child
+/// @param b
+static void QuantiseChild(BVH4Node& node, size_t child, const RTCBounds& b)
+{
+    const std::array<float, 3> lower = { b.lower_x, b.lower_y, b.lower_z };
+    const std::array<float, 3> upper = { b.upper_x, b.upper_y, b.upper_z };
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        const float origin = node.origin[axis];
+        const float scale  = node.scale[axis];
+        const float inv    = scale > 0.0F ? 1.0F / scale : 0.0F;
+
+        auto lo = static_cast<int>(std::clamp(std::floor((lower[axis] - origin) * inv), 0.0F, 255.0F));
+        auto hi = static_cast<int>(std::clamp(std::ceil((upper[axis] - origin) * inv), 0.0F, 255.0F));
+
+        // Rounding in the division can land a step inside the child
+        while (lo > 0 && Dequantise(static_cast<uint8_t>(lo), origin, scale) > lower[axis])
+            lo--;
+        while (hi < 255 && Dequantise(static_cast<uint8_t>(hi), origin, scale) < upper[axis])
+            hi++;
+
+        node.lower[axis][child] = static_cast<uint8_t>(lo);
+        node.upper[axis][child] = static_cast<uint8_t>(hi);
+    }
+}
+
+/// @brief Writes the pointer tree of the builder into the flat arrays of a BVH4
+class Flattener
+{
+public:
+    Flattener(const std::vector<BVHTriangle>& triangles, std::vector<BVH4Node>& nodes, std::vector<Triangle4>& leaves, BVHStatistics& statistics) :
+        _triangles(triangles), _nodes(nodes), _leaves(leaves), _statistics(statistics) { }
+
+    /// @brief Append an inner node and everything below it
+    /// @return Index of the node
+    uint32_t Inner(const InnerNode& inner, size_t depth)
+    {
+        if (depth >= kBVHMaxDepth)
+            throw std::runtime_error("BVH is deeper than the traversal stack allows");
+
+        // Children are appended while the node is filled in, so it is only stored once complete
+        const auto index = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+
+        BVH4Node node;
+        RTCBounds merged = inner.bounds[0];
+        for (size_t c = 1; c < inner.count; c++)
+            merged = Merge(merged, inner.bounds[c]);
+
+        const std::array<float, 3> lower = { merged.lower_x, merged.lower_y, merged.lower_z };
+        const std::array<float, 3> upper = { merged.upper_x, merged.upper_y, merged.upper_z };
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            node.origin[axis] = lower[axis];
+            node.scale[axis]  = (upper[axis] - lower[axis]) / 255.0F;
+
+            // The top step has to reach the upper bound despite rounding, which far from the origin can take more than an ulp
+            float bump = std::numeric_limits<float>::epsilon();
+            while (Dequantise(255, node.origin[axis], node.scale[axis]) < upper[axis])
+            {
+                node.scale[axis] = std::max(node.scale[axis] * (1.0F + bump), std::numeric_limits<float>::min());
+                bump *= 2.0F;
+            }
+        }
+
+        for (size_t c = 0; c < kBVHWidth; c++)
+        {
+            if (c >= inner.count)
+            {
+                for (size_t axis = 0; axis < 3; axis++)
+                {
+                    node.lower[axis][c] = 255;
+                    node.upper[axis][c] = 0;
+                }
+                node.children[c] = BVH4Node::kEmpty;
+                continue;
+            }
+
+            QuantiseChild(node, c, inner.bounds[c]);
+            if (const auto* leaf = dynamic_cast<const LeafNode*>(inner.children[c]))
+                node.children[c] = BVH4Node::kLeaf | Leaf(*leaf, depth + 1);
+            else
+                node.children[c] = Inner(*static_cast<const InnerNode*>(inner.children[c]), depth + 1);
+        }
+
+        _nodes[index] = node;
+        return index;
+    }
+
+private:
+    /// @brief Append a leaf
+    /// @return Index of the leaf
+    uint32_t Leaf(const LeafNode& leaf, size_t depth)
+    {
+        if (_statistics.leaf_depths.size() <= depth)
+            _statistics.leaf_depths.resize(depth + 1, 0);
+        _statistics.leaf_depths[depth]++;
+        _statistics.leaf_sizes[leaf.count]++;
+        _statistics.references += leaf.count;
+
+        Triangle4& block = _leaves.emplace_back();
+        for (size_t lane = 0; lane < kBVHWidth; lane++)
+        {
+            if (lane >= leaf.count)
+            {
+                // Zero edges give a zero determinant, so the lane never hits
+                for (size_t axis = 0; axis < 3; axis++)
+                    block.v0[axis][lane] = block.e1[axis][lane] = block.e2[axis][lane] = 0.0F;
+                block.geomID[lane] = block.primID[lane] = block.instID[lane] = RTC_INVALID_GEOMETRY_ID;
+                continue;
+            }
+
+            const BVHTriangle& triangle = _triangles[leaf.ids[lane]];
+            const Eigen::Vector3f e1 = triangle.v1 - triangle.v0;
+            const Eigen::Vector3f e2 = triangle.v2 - triangle.v0;
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                block.v0[axis][lane] = triangle.v0[axis];
+                block.e1[axis][lane] = e1[axis];
+                block.e2[axis][lane] = e2[axis];
+            }
+            block.geomID[lane] = triangle.geomID;
+            block.primID[lane] = triangle.primID;
+            block.instID[lane] = triangle.instID;
+        }
+        return static_cast<uint32_t>(_leaves.size() - 1);
+    }
+
+    const std::vector<BVHTriangle>& _triangles;
+    std::vector<BVH4Node>& _nodes;
+    std::vector<Triangle4>& _leaves;
+    BVHStatistics& _statistics;
+};
+
+BVH4 BuildBVH(RTCBuildQuality quality, const std::vector<BVHTriangle>& triangles, bool spatial_splits)
 {
     Timer t = Timer("BVH build");
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    BVH4 ret;
+    if (triangles.empty())
+        return ret;
 
     rtcSetDeviceMemoryMonitorFunction(EmbreeSingleton::GetInstance().device, nullptr, nullptr);
 
+    // Check for error in build arguments
+    RTCErrorFunction error_function = ErrCallback;
+    rtcSetDeviceErrorFunction(EmbreeSingleton::GetInstance().device, error_function, nullptr);
+
     RTCBVH bvh = rtcNewBVH(EmbreeSingleton::GetInstance().device);
     assert(bvh != nullptr);
 
+    // Prims name their triangle by primID, spatial splits may add up to one more prim per triangle
     std::vector<RTCBuildPrimitive> prims;
-    prims.reserve(prims_i.size() + extra_space);
-    prims.resize(prims_i.size());
+    prims.reserve(spatial_splits ? triangles.size() * 2 : triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        const RTCBounds b = Bounds(triangles[i]);
+        prims.push_back(RTCBuildPrimitive
+        {
+            .lower_x = b.lower_x,
+            .lower_y = b.lower_y,
+            .lower_z = b.lower_z,
+            .geomID  = 0,
+            .upper_x = b.upper_x,
+            .upper_y = b.upper_y,
+            .upper_z = b.upper_z,
+            .primID  = static_cast<unsigned int>(i)
+        });
+    }
 
     // Settings for bvh build
     RTCBuildArguments arguments = rtcDefaultBuildArguments();
     arguments.byteSize               = sizeof(arguments);
     arguments.buildFlags             = RTC_BUILD_FLAG_NONE;
-    arguments.buildQuality           = quality;                 
-    arguments.maxBranchingFactor     = 2;       
-    arguments.maxDepth               = 1024;
+    arguments.buildQuality           = quality;
+    arguments.maxBranchingFactor     = kBVHWidth;
+    arguments.maxDepth               = kBVHMaxDepth;
     arguments.sahBlockSize           = 1;
     arguments.minLeafSize            = 1;
-    arguments.maxLeafSize            = 1;
+    arguments.maxLeafSize            = kBVHWidth;
     arguments.traversalCost          = 1.0F;
     arguments.intersectionCost       = 1.0F;
     arguments.bvh                    = bvh;
@@ -155,19 +403,44 @@ void BuildBVH(RTCBuildQuality quality, std::vector<RTCBuildPrimitive>& prims_i,
     arguments.setNodeChildren        = InnerNode::SetChildren;
     arguments.setNodeBounds          = InnerNode::SetBounds;
     arguments.createLeaf             = LeafNode::Create;
-    arguments.splitPrimitive         = SplitPrimitive;
-    arguments.buildProgress          = nullptr;        
+    arguments.splitPrimitive         = spatial_splits ? SplitPrimitive : nullptr;
+    arguments.buildProgress          = nullptr;
     arguments.userPtr                = nullptr;
 
-    for (size_t j = 0; j < prims.size(); j++) prims[j] = prims_i[j];
-    rtcBuildBVH(&arguments);
+    auto* root = static_cast<Node*>(rtcBuildBVH(&arguments));
+    if (root == nullptr)
+    {
+        rtcReleaseBVH(bvh);
+        throw std::runtime_error("BVH build failed");
+    }
 
-    std::cout << "Built for " << prims.size() << " primitives" << std::endl;
+    // The tree lives in the allocator of the builder, so it is flattened before the builder is released
+    ret._statistics.sah = root->sah();
 
-    // Check for error in build arguments
-    RTCErrorFunction error_function = ErrCallback;
-    rtcSetDeviceErrorFunction(EmbreeSingleton::GetInstance().device, error_function, nullptr);
+    Flattener flattener(triangles, ret._nodes, ret._leaves, ret._statistics);
+    if (const auto* leaf = dynamic_cast<const LeafNode*>(root))
+    {
+        // Traversal starts at an inner node, so a lone leaf gets a parent
+        InnerNode parent(1);
+        parent.children[0] = root;
+        parent.bounds[0]   = Bounds(triangles[leaf->ids[0]]);
+        for (size_t i = 1; i < leaf->count; i++)
+            parent.bounds[0] = Merge(parent.bounds[0], Bounds(triangles[leaf->ids[i]]));
+        flattener.Inner(parent, 0);
+    }
+    else
+        flattener.Inner(*static_cast<const InnerNode*>(root), 0);
 
     rtcReleaseBVH(bvh);
+
+    ret._statistics.build_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    ret._statistics.nodes    = ret.GetNodeCount();
+    ret._statistics.leaves   = ret.GetLeafCount();
+    ret._statistics.memory   = ret.GetMemory();
+
+    std::cout << "Built for " << triangles.size() << " primitives, " << ret.GetNodeCount() << " nodes and " << ret.GetLeafCount() << " leaves in "
+              << static_cast<double>(ret.GetMemory()) / (1024.0 * 1024.0) << " MiB, SAH cost " << ret._statistics.sah << std::endl;
+
+    return ret;
 }
 }
\ No newline at end of file
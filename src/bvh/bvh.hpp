@@ -1,6 +1,12 @@
 #pragma once
 
 #include <embree3/rtcore.h>
+#include <Eigen/Core>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
 #include <vector>
 #include <iostream>
 #include <cassert>
@@ -11,5 +17,125 @@ float Area(const RTCBounds& b);
 //RTCBounds merge(const RTCBounds& a, const RTCBounds& b);
 
 void ErrCallback(void* user_ptr, RTCError code, const char* str);
-void BuildBVH(RTCBuildQuality quality, std::vector<RTCBuildPrimitive>& prims_i, char* cfg, size_t extra_space = 0);
+
+/// @brief Parse a build quality name, "low", "medium" or "high"
+/// @param name
+/// @return Nothing if the name is not recognised
+std::optional<RTCBuildQuality> ParseBuildQuality(const std::string& name);
+
+/// @brief Name of a build quality, as ParseBuildQuality accepts it
+/// @param quality
+/// @return
+const char* BuildQualityName(RTCBuildQuality quality);
+
+/// @brief Triangle the BVH is built over, in world space, with the IDs Embree reports for it
+struct BVHTriangle
+{
+    Eigen::Vector3f v0, v1, v2;
+    unsigned int geomID; // Geometry in the scene, or in the prototype scene for instanced triangles
+    unsigned int primID;
+    unsigned int instID; // Instance geometry in the scene, RTC_INVALID_GEOMETRY_ID if not instanced
+};
+
+// Children per node and triangles per leaf, one lane of an SSE register each
+constexpr size_t kBVHWidth = 4;
+
+// Deepest node the builder may create, bounds the traversal stack
+constexpr size_t kBVHMaxDepth = 64;
+
+/// @brief Inner node of a BVH4 in one cache line. The bounds of the children are quantised to 8 bits within the bounds
+/// of the node, stored axis by axis so one load fetches a bound of all four children.
+struct alignas(64) BVH4Node
+{
+    static constexpr uint32_t kLeaf  = 0x80000000U; // Set on children that index a leaf
+    static constexpr uint32_t kEmpty = 0xFFFFFFFFU;
+
+    std::array<float, 3> origin; // Lower corner of the node
+    std::array<float, 3> scale;  // Extent of the node per quantisation step
+    std::array<std::array<uint8_t, kBVHWidth>, 3> lower;
+    std::array<std::array<uint8_t, kBVHWidth>, 3> upper;
+    std::array<uint32_t, kBVHWidth> children; // Inner node index, kLeaf | leaf index, or kEmpty
+};
+static_assert(sizeof(BVH4Node) == 64);
+
+/// @brief Leaf of up to four triangles, stored lane by lane for the SIMD intersection test. Unused lanes hold
+/// degenerate triangles, which are never hit.
+struct alignas(64) Triangle4
+{
+    std::array<std::array<float, kBVHWidth>, 3> v0; // [axis][lane]
+    std::array<std::array<float, kBVHWidth>, 3> e1; // v1 - v0
+    std::array<std::array<float, kBVHWidth>, 3> e2; // v2 - v0
+    std::array<uint32_t, kBVHWidth> geomID;
+    std::array<uint32_t, kBVHWidth> primID;
+    std::array<uint32_t, kBVHWidth> instID;
+};
+
+/// @brief Shape and cost of a built BVH, to compare build settings
+struct BVHStatistics
+{
+    double build_ms   = 0.0;
+    float  sah        = 0.0F; // Expected cost of a ray through the tree, one per node visited and per triangle tested
+    size_t nodes      = 0;
+    size_t leaves     = 0;
+    size_t references = 0; // Triangles in leaves, spatial splits may put a triangle in several
+    size_t memory     = 0; // Bytes of nodes and leaves
+    std::vector<size_t> leaf_depths; // Leaves per depth, the root is at depth 0
+    std::array<size_t, kBVHWidth + 1> leaf_sizes {}; // Leaves per number of triangles
+
+    /// @brief Format the statistics as key=value pairs on one line
+    /// @return
+    std::string ToString() const;
+};
+
+/// @brief Closest hit of a ray, in the terms of an Embree hit
+struct BVHHit
+{
+    float t;
+    float u, v; // Barycentrics of v1 and v2
+    Eigen::Vector3f Ng; // Unnormalised geometry normal, e1 x e2
+    unsigned int geomID;
+    unsigned int primID;
+    unsigned int instID;
+};
+
+/// @brief Flattened 4-wide BVH over world space triangles with SSE traversal, an alternative to tracing with Embree
+class BVH4
+{
+public:
+    /// @brief Find the closest hit along a ray
+    /// @param org
+    /// @param dir
+    /// @param tnear
+    /// @param tfar
+    /// @param hit Written only if there is a hit
+    /// @return Whether a triangle was hit within (tnear, tfar)
+    bool Intersect(const Eigen::Vector3f& org, const Eigen::Vector3f& dir, float tnear, float tfar, BVHHit& hit) const;
+
+    /// @brief Find whether anything is hit along a ray, stopping at the first hit
+    /// @param org
+    /// @param dir
+    /// @param tnear
+    /// @param tfar
+    /// @return
+    bool Occluded(const Eigen::Vector3f& org, const Eigen::Vector3f& dir, float tnear, float tfar) const;
+
+    size_t GetNodeCount() const { return _nodes.size(); }
+    size_t GetLeafCount() const { return _leaves.size(); }
+    size_t GetMemory() const { return _nodes.size() * sizeof(BVH4Node) + _leaves.size() * sizeof(Triangle4); }
+    const BVHStatistics& GetStatistics() const { return _statistics; }
+
+private:
+    friend BVH4 BuildBVH(RTCBuildQuality quality, const std::vector<BVHTriangle>& triangles, bool spatial_splits);
+
+    std::vector<BVH4Node> _nodes; // The root is the first node
+    std::vector<Triangle4> _leaves;
+    BVHStatistics _statistics;
+};
+
+/// @brief Build a BVH4 with the Embree BVH builder
+/// @param quality
+/// @param triangles
+/// @param spatial_splits Let the builder split triangles across nodes, Embree only does so at high quality
+/// @return
+BVH4 BuildBVH(RTCBuildQuality quality, const std::vector<BVHTriangle>& triangles, bool spatial_splits = false);
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "intersector.hpp"
+#include "bvh.hpp"
+#include "embree/embreesingleton.hpp"
+
+#include <limits>
+
+namespace CT
+{
+// Traced through instead of the Embree scene when set
+static const BVH4* active_bvh = nullptr;
+
+std::optional<Intersector> ParseIntersector(const std::string& name)
+{
+    if (name == "embree")
+        return Intersector::Embree;
+    if (name == "bvh4")
+        return Intersector::BVH4;
+    return std::nullopt;
+}
+
+void SetIntersectorBVH(const BVH4* bvh)
+{
+    active_bvh = bvh;
+}
+
+void Intersect1(RTCIntersectContext& context, RTCRayHit& rayhit)
+{
+    if (active_bvh == nullptr)
+    {
+        rtcIntersect1(EmbreeSingleton::GetInstance().scene, &context, &rayhit);
+        return;
+    }
+
+    const RTCRay& ray = rayhit.ray;
+    BVHHit hit;
+    if (!active_bvh->Intersect({ ray.org_x, ray.org_y, ray.org_z }, { ray.dir_x, ray.dir_y, ray.dir_z }, ray.tnear, ray.tfar, hit))
+        return;
+
+    rayhit.ray.tfar      = hit.t;
+    rayhit.hit.Ng_x      = hit.Ng.x();
+    rayhit.hit.Ng_y      = hit.Ng.y();
+    rayhit.hit.Ng_z      = hit.Ng.z();
+    rayhit.hit.u         = hit.u;
+    rayhit.hit.v         = hit.v;
+    rayhit.hit.primID    = hit.primID;
+    rayhit.hit.geomID    = hit.geomID;
+    rayhit.hit.instID[0] = hit.instID;
+}
+
+void Intersect16(const int* valid, RTCIntersectContext& context, RTCRayHit16& packet)
+{
+    if (active_bvh == nullptr)
+    {
+        rtcIntersect16(valid, EmbreeSingleton::GetInstance().scene, &context, &packet);
+        return;
+    }
+
+    // The BVH traces one ray at a time, its SIMD lanes run over the children of a node instead
+    for (size_t lane = 0; lane < 16; lane++)
+    {
+        if (valid[lane] == 0)
+            continue;
+
+        const RTCRay16& ray = packet.ray;
+        BVHHit hit;
+        if (!active_bvh->Intersect({ ray.org_x[lane], ray.org_y[lane], ray.org_z[lane] }, { ray.dir_x[lane], ray.dir_y[lane], ray.dir_z[lane] },
+                                   ray.tnear[lane], ray.tfar[lane], hit))
+            continue;
+
+        packet.ray.tfar[lane]      = hit.t;
+        packet.hit.Ng_x[lane]      = hit.Ng.x();
+        packet.hit.Ng_y[lane]      = hit.Ng.y();
+        packet.hit.Ng_z[lane]      = hit.Ng.z();
+        packet.hit.u[lane]         = hit.u;
+        packet.hit.v[lane]         = hit.v;
+        packet.hit.primID[lane]    = hit.primID;
+        packet.hit.geomID[lane]    = hit.geomID;
+        packet.hit.instID[0][lane] = hit.instID;
+    }
+}
+
+void Occluded16(const int* valid, RTCIntersectContext& context, RTCRay16& packet)
+{
+    if (active_bvh == nullptr)
+    {
+        rtcOccluded16(valid, EmbreeSingleton::GetInstance().scene, &context, &packet);
+        return;
+    }
+
+    for (size_t lane = 0; lane < 16; lane++)
+        if (valid[lane] != 0 && active_bvh->Occluded({ packet.org_x[lane], packet.org_y[lane], packet.org_z[lane] },
+                                                     { packet.dir_x[lane], packet.dir_y[lane], packet.dir_z[lane] }, packet.tnear[lane], packet.tfar[lane]))
+            packet.tfar[lane] = -std::numeric_limits<float>::infinity();
+}
+}
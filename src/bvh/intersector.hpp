@@ -0,0 +1,44 @@
+#pragma once
+
+#include <embree3/rtcore.h>
+
+#include <optional>
+#include <string>
+
+namespace CT
+{
+class BVH4;
+
+/// @brief Engine the primary, shadow and hemisphere rays are traced with
+enum class Intersector
+{
+    Embree,
+    BVH4, // The BVH built from the loaded triangles by BuildBVH
+};
+
+/// @brief Parse an intersector name, "embree" or "bvh4"
+/// @param name
+/// @return Nothing if the name is not recognised
+std::optional<Intersector> ParseIntersector(const std::string& name);
+
+/// @brief Trace rays through a BVH4 instead of the Embree scene. Set it before rendering, not while rays are traced.
+/// @param bvh nullptr to trace with Embree again
+void SetIntersectorBVH(const BVH4* bvh);
+
+/// @brief Find the closest hit of a ray, as rtcIntersect1 does on the scene
+/// @param context
+/// @param rayhit
+void Intersect1(RTCIntersectContext& context, RTCRayHit& rayhit);
+
+/// @brief Find the closest hits of a packet, as rtcIntersect16 does on the scene
+/// @param valid
+/// @param context
+/// @param packet
+void Intersect16(const int* valid, RTCIntersectContext& context, RTCRayHit16& packet);
+
+/// @brief Test a packet for occlusion, as rtcOccluded16 does on the scene. tfar is set to -inf for occluded rays.
+/// @param valid
+/// @param context
+/// @param packet
+void Occluded16(const int* valid, RTCIntersectContext& context, RTCRay16& packet);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+// SSE2 is part of x86-64, so the kernels need no extra compile flags
+#include <emmintrin.h>
+
+#include "bvh.hpp"
+
+namespace CT
+{
+/// @brief Bounds of the four children of a node along one axis. The builder quantises through this too, so the bounds
+/// it checks are bit for bit the bounds traversal tests.
+/// @param q Quantised bounds of the children
+/// @param origin
+/// @param scale
+/// @return
+inline __m128 Dequantise(const std::array<uint8_t, kBVHWidth>& q, float origin, float scale)
+{
+    int32_t packed = 0;
+    std::memcpy(&packed, q.data(), sizeof(packed));
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i bytes = _mm_cvtsi32_si128(packed);
+    const __m128i ints  = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+    return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(ints), _mm_set1_ps(scale)));
+}
+}
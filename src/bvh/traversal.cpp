@@ -0,0 +1,236 @@
+#include "bvh.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Geometry>
+
+namespace CT
+{
+// Entries the traversal stack can hold, at most three siblings are left behind per level
+constexpr size_t kStackSize = 3 * kBVHMaxDepth + 1;
+
+/// @brief Ray broadcast to the four lanes of a node or leaf test
+struct TraversalRay
+{
+    __m128 org[3];
+    __m128 dir[3];
+    __m128 inv_dir[3];
+
+    TraversalRay(const Eigen::Vector3f& o, const Eigen::Vector3f& d)
+    {
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            // Axis parallel rays get a huge rather than infinite inverse, so the slab test never multiplies 0 by infinity
+            constexpr float kMinDir = 1e-20F;
+            const float safe_dir = std::abs(d[axis]) < kMinDir ? std::copysign(kMinDir, d[axis]) : d[axis];
+
+            org[axis]     = _mm_set1_ps(o[axis]);
+            dir[axis]     = _mm_set1_ps(d[axis]);
+            inv_dir[axis] = _mm_set1_ps(1.0F / safe_dir);
+        }
+    }
+};
+
+/// @brief Slab test of a ray against the four children of a node
+/// @param node
+/// @param ray
+/// @param tnear
+/// @param tfar
+/// @param entry Distance at which the ray enters each child
+/// @return Bit mask of the children the ray enters within [tnear, tfar]
+static int IntersectNode(const BVH4Node& node, const TraversalRay& ray, float tnear, float tfar, __m128& entry)
+{
+    __m128 tmin = _mm_set1_ps(tnear);
+    __m128 tmax = _mm_set1_ps(tfar);
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        const __m128 lower = Dequantise(node.lower[axis], node.origin[axis], node.scale[axis]);
+        const __m128 upper = Dequantise(node.upper[axis], node.origin[axis], node.scale[axis]);
+        const __m128 t0 = _mm_mul_ps(_mm_sub_ps(lower, ray.org[axis]), ray.inv_dir[axis]);
+        const __m128 t1 = _mm_mul_ps(_mm_sub_ps(upper, ray.org[axis]), ray.inv_dir[axis]);
+        tmin = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+        tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+    }
+    entry = tmin;
+
+    const __m128i children = _mm_load_si128(reinterpret_cast<const __m128i*>(node.children.data()));
+    const int empty = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(children, _mm_set1_epi32(static_cast<int>(BVH4Node::kEmpty)))));
+    return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) & ~empty;
+}
+
+/// @brief Moller-Trumbore test of a ray against the four triangles of a leaf
+/// @param leaf
+/// @param ray
+/// @param tnear
+/// @param tfar
+/// @param t Distance to each triangle
+/// @param u Barycentric of v1 for each triangle
+/// @param v Barycentric of v2 for each triangle
+/// @return Bit mask of the triangles hit within (tnear, tfar)
+static int IntersectLeaf(const Triangle4& leaf, const TraversalRay& ray, float tnear, float tfar, __m128& t, __m128& u, __m128& v)
+{
+    const __m128 e1x = _mm_load_ps(leaf.e1[0].data());
+    const __m128 e1y = _mm_load_ps(leaf.e1[1].data());
+    const __m128 e1z = _mm_load_ps(leaf.e1[2].data());
+    const __m128 e2x = _mm_load_ps(leaf.e2[0].data());
+    const __m128 e2y = _mm_load_ps(leaf.e2[1].data());
+    const __m128 e2z = _mm_load_ps(leaf.e2[2].data());
+    const __m128 dx  = ray.dir[0];
+    const __m128 dy  = ray.dir[1];
+    const __m128 dz  = ray.dir[2];
+
+    // p = dir x e2
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    const __m128 det     = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0F), det);
+
+    // s = org - v0
+    const __m128 sx = _mm_sub_ps(ray.org[0], _mm_load_ps(leaf.v0[0].data()));
+    const __m128 sy = _mm_sub_ps(ray.org[1], _mm_load_ps(leaf.v0[1].data()));
+    const __m128 sz = _mm_sub_ps(ray.org[2], _mm_load_ps(leaf.v0[2].data()));
+    u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+    // q = s x e1
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    // Parallel and padding triangles have a zero determinant and are masked out before their NaNs matter
+    const __m128 zero = _mm_setzero_ps();
+    __m128 valid = _mm_cmpneq_ps(det, zero);
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0F)));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(tnear)));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(tfar)));
+    return _mm_movemask_ps(valid);
+}
+
+bool BVH4::Intersect(const Eigen::Vector3f& org, const Eigen::Vector3f& dir, float tnear, float tfar, BVHHit& hit) const
+{
+    if (_nodes.empty())
+        return false;
+
+    const TraversalRay ray(org, dir);
+
+    // Children are visited nearest first, and skipped once something closer than their entry was hit
+    struct Entry
+    {
+        uint32_t child;
+        float    tmin;
+    };
+    std::array<Entry, kStackSize> stack;
+    size_t top = 0;
+    stack[top++] = { 0, tnear };
+
+    bool found = false;
+    while (top > 0)
+    {
+        const Entry entry = stack[--top];
+        if (entry.tmin > tfar)
+            continue;
+
+        if ((entry.child & BVH4Node::kLeaf) != 0)
+        {
+            const Triangle4& leaf = _leaves[entry.child & ~BVH4Node::kLeaf];
+            __m128 t, u, v;
+            const int mask = IntersectLeaf(leaf, ray, tnear, tfar, t, u, v);
+            if (mask == 0)
+                continue;
+
+            alignas(16) std::array<float, kBVHWidth> ts, us, vs;
+            _mm_store_ps(ts.data(), t);
+            _mm_store_ps(us.data(), u);
+            _mm_store_ps(vs.data(), v);
+
+            size_t closest = kBVHWidth;
+            for (size_t lane = 0; lane < kBVHWidth; lane++)
+                if ((mask & (1 << lane)) != 0 && (closest == kBVHWidth || ts[lane] < ts[closest]))
+                    closest = lane;
+
+            tfar  = ts[closest];
+            found = true;
+
+            const Eigen::Vector3f e1(leaf.e1[0][closest], leaf.e1[1][closest], leaf.e1[2][closest]);
+            const Eigen::Vector3f e2(leaf.e2[0][closest], leaf.e2[1][closest], leaf.e2[2][closest]);
+            hit.t      = tfar;
+            hit.u      = us[closest];
+            hit.v      = vs[closest];
+            hit.Ng     = e1.cross(e2);
+            hit.geomID = leaf.geomID[closest];
+            hit.primID = leaf.primID[closest];
+            hit.instID = leaf.instID[closest];
+            continue;
+        }
+
+        const BVH4Node& node = _nodes[entry.child];
+        __m128 entry_distance;
+        const int mask = IntersectNode(node, ray, tnear, tfar, entry_distance);
+        if (mask == 0)
+            continue;
+
+        alignas(16) std::array<float, kBVHWidth> distance;
+        _mm_store_ps(distance.data(), entry_distance);
+
+        // Push the farthest child first, so the nearest is popped next
+        std::array<Entry, kBVHWidth> hits;
+        size_t count = 0;
+        for (size_t c = 0; c < kBVHWidth; c++)
+        {
+            if ((mask & (1 << c)) == 0)
+                continue;
+            size_t i = count++;
+            for (; i > 0 && hits[i - 1].tmin < distance[c]; i--)
+                hits[i] = hits[i - 1];
+            hits[i] = { node.children[c], distance[c] };
+        }
+        for (size_t i = 0; i < count; i++)
+            stack[top++] = hits[i];
+    }
+
+    return found;
+}
+
+bool BVH4::Occluded(const Eigen::Vector3f& org, const Eigen::Vector3f& dir, float tnear, float tfar) const
+{
+    if (_nodes.empty())
+        return false;
+
+    const TraversalRay ray(org, dir);
+
+    // Any hit will do, so children are pushed in whatever order the node stores them
+    std::array<uint32_t, kStackSize> stack;
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const uint32_t child = stack[--top];
+        if ((child & BVH4Node::kLeaf) != 0)
+        {
+            __m128 t, u, v;
+            if (IntersectLeaf(_leaves[child & ~BVH4Node::kLeaf], ray, tnear, tfar, t, u, v) != 0)
+                return true;
+            continue;
+        }
+
+        const BVH4Node& node = _nodes[child];
+        __m128 entry_distance;
+        const int mask = IntersectNode(node, ray, tnear, tfar, entry_distance);
+        for (size_t c = 0; c < kBVHWidth; c++)
+            if ((mask & (1 << c)) != 0)
+                stack[top++] = node.children[c];
+    }
+
+    return false;
+}
+}
@@ -1,7 +1,9 @@
 #include "camera.hpp"
 #include "film.hpp"
 
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <numbers>
 
 
@@ -52,4 +54,68 @@ RTCRayHit Camera::GetRayForPixel(const Canvas& canvas, Eigen::Vector2i pixel_ind
 
     return ret;
 }
+
+template<size_t N, typename Packet>
+size_t Camera::FillRayPacket(const Canvas& canvas, size_t x0, size_t y0, Packet& packet, int* valid) const
+{
+    static_assert(N % kPacketWidth == 0);
+
+    // Film constants shared by every lane
+    const auto& film         = canvas.GetFilm();
+    const float inv_width    = 1.0F / static_cast<float>(film.rect.GetWidth());
+    const float inv_height   = 1.0F / static_cast<float>(film.rect.GetHeight());
+    const float aspect_ratio = static_cast<float>(film.rect.GetWidth()) * inv_height;
+    const Eigen::Vector3f forward = _lookdir * _fl;
+
+    std::array<float, N> sx;
+    std::array<float, N> sy;
+    size_t count = 0;
+    for (size_t lane = 0; lane < N; lane++)
+    {
+        const size_t x = x0 + lane % kPacketWidth;
+        const size_t y = y0 + lane / kPacketWidth;
+        const bool inside = x < canvas.rect.GetWidth() && y < canvas.rect.GetHeight();
+        valid[lane] = inside ? -1 : 0;
+        count += static_cast<size_t>(inside);
+
+        // Screen space offsets of the pixel
+        sx[lane] = (0.5F - static_cast<float>(x + canvas.rect.ulx) * inv_width) * aspect_ratio;
+        sy[lane] =  0.5F - static_cast<float>(y + canvas.rect.uly) * inv_height;
+    }
+
+    // Ray directions, one lane per pixel
+    for (size_t lane = 0; lane < N; lane++)
+    {
+        const float dx = forward.x() + _rightdir.x() * sx[lane] + _updir.x() * sy[lane];
+        const float dy = forward.y() + _rightdir.y() * sx[lane] + _updir.y() * sy[lane];
+        const float dz = forward.z() + _rightdir.z() * sx[lane] + _updir.z() * sy[lane];
+        const float inv_len = 1.0F / std::sqrt(dx * dx + dy * dy + dz * dz);
+
+        packet.ray.org_x[lane]  = _pos.x();
+        packet.ray.org_y[lane]  = _pos.y();
+        packet.ray.org_z[lane]  = _pos.z();
+        packet.ray.dir_x[lane]  = dx * inv_len;
+        packet.ray.dir_y[lane]  = dy * inv_len;
+        packet.ray.dir_z[lane]  = dz * inv_len;
+        packet.ray.tnear[lane]  = _t_near;
+        packet.ray.tfar[lane]   = _t_far;
+        packet.ray.time[lane]   = 0.0F;
+        packet.ray.mask[lane]   = std::numeric_limits<unsigned int>::max();
+        packet.ray.id[lane]     = static_cast<unsigned int>(lane);
+        packet.ray.flags[lane]  = 0;
+        packet.hit.geomID[lane] = RTC_INVALID_GEOMETRY_ID;
+    }
+
+    return count;
+}
+
+size_t Camera::GetRayPacket8(const Canvas& canvas, size_t x0, size_t y0, RTCRayHit8& packet, int* valid) const
+{
+    return FillRayPacket<8>(canvas, x0, y0, packet, valid);
+}
+
+size_t Camera::GetRayPacket16(const Canvas& canvas, size_t x0, size_t y0, RTCRayHit16& packet, int* valid) const
+{
+    return FillRayPacket<16>(canvas, x0, y0, packet, valid);
+}
 }
\ No newline at end of file
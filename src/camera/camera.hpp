@@ -24,7 +24,33 @@ public:
     /// @return RTCRayHit (embree3/rtcore_ray.h)
     RTCRayHit GetRayForPixel(const Canvas& canvas, Eigen::Vector2i pixel_index) const;
 
+    // Pixel blocks covered by a packet, GetRayPacket8 covers 4x2 pixels and GetRayPacket16 covers 4x4
+    static constexpr size_t kPacketWidth    = 4;
+    static constexpr size_t kPacket8Height  = 2;
+    static constexpr size_t kPacket16Height = 4;
+
+    /// @brief Fill a packet with the rays of a 4x2 block of canvas pixels
+    /// @param canvas 
+    /// @param x0 Canvas x of the upper left pixel of the block
+    /// @param y0 Canvas y of the upper left pixel of the block
+    /// @param packet 
+    /// @param valid Embree valid mask, -1 for lanes inside the canvas and 0 otherwise
+    /// @return Number of valid lanes
+    size_t GetRayPacket8(const Canvas& canvas, size_t x0, size_t y0, RTCRayHit8& packet, int* valid) const;
+
+    /// @brief Fill a packet with the rays of a 4x4 block of canvas pixels
+    /// @param canvas 
+    /// @param x0 Canvas x of the upper left pixel of the block
+    /// @param y0 Canvas y of the upper left pixel of the block
+    /// @param packet 
+    /// @param valid Embree valid mask, -1 for lanes inside the canvas and 0 otherwise
+    /// @return Number of valid lanes
+    size_t GetRayPacket16(const Canvas& canvas, size_t x0, size_t y0, RTCRayHit16& packet, int* valid) const;
+
 private:
+    template<size_t N, typename Packet>
+    size_t FillRayPacket(const Canvas& canvas, size_t x0, size_t y0, Packet& packet, int* valid) const;
+
     // Camera position
     Eigen::Vector3f _pos;
 
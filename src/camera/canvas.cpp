@@ -14,14 +14,29 @@ Canvas::PixelRef Canvas::operator[](size_t index)
 }
 
 Canvas::PixelRef Canvas::operator()(size_t x, size_t y)
+{
+    return PlanePixel(_film.rgb, x, y);
+}
+
+Canvas::PixelRef Canvas::Albedo(size_t x, size_t y)
+{
+    return PlanePixel(_film.albedo, x, y);
+}
+
+Canvas::PixelRef Canvas::Normal(size_t x, size_t y)
+{
+    return PlanePixel(_film.normal, x, y);
+}
+
+Canvas::PixelRef Canvas::PlanePixel(std::vector<float>& plane, size_t x, size_t y)
 {
     const size_t film_width = _film.rect.GetWidth();
     const size_t film_x     = x + rect.ulx;
     const size_t film_y     = y + rect.uly;
     const size_t film_index = film_y * film_width + film_x;
 
-    return { _film.rgb[film_index * 3 + 0],
-             _film.rgb[film_index * 3 + 1],
-             _film.rgb[film_index * 3 + 2] };
+    return { plane[film_index * 3 + 0],
+             plane[film_index * 3 + 1],
+             plane[film_index * 3 + 2] };
 }
 }
\ No newline at end of file
@@ -37,9 +37,23 @@ public:
     /// @return 
     PixelRef operator()(size_t x, size_t y);
 
+    /// @brief Returns a reference to the albedo of the film pixel at the given canvas coordinates
+    /// @param x
+    /// @param y
+    /// @return
+    PixelRef Albedo(size_t x, size_t y);
+
+    /// @brief Returns a reference to the shading normal of the film pixel at the given canvas coordinates
+    /// @param x
+    /// @param y
+    /// @return
+    PixelRef Normal(size_t x, size_t y);
+
     const Film& GetFilm() const { return _film; }
 
 private:
+    PixelRef PlanePixel(std::vector<float>& plane, size_t x, size_t y);
+
     Film& _film;
 };
 }
\ No newline at end of file
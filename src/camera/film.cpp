@@ -3,7 +3,7 @@
 
 namespace CT
 {
-Film::Film(const size_t width, const size_t height, const Eigen::Vector2i& canvas_size) : rect(width, height), rgb(width * height * 3)
+Film::Film(const size_t width, const size_t height, const Eigen::Vector2i& canvas_size) : rect(width, height), rgb(width * height * 3), albedo(width * height * 3), normal(width * height * 3)
 {
     const size_t xc = rect.GetWidth()   / canvas_size.x() + static_cast<size_t>(rect.GetWidth()  % canvas_size.x() != 0);
     const size_t yc = rect.GetHeight()  / canvas_size.y() + static_cast<size_t>(rect.GetHeight() % canvas_size.y() != 0);
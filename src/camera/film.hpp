@@ -18,5 +18,9 @@ public:
     std::vector<Canvas> canvases;
 
     std::vector<float> rgb;
+
+    // Auxiliary features for the denoiser, written at the primary hit of each pixel and zero where nothing was hit
+    std::vector<float> albedo; // Diffuse colour of the material
+    std::vector<float> normal; // World space shading normal
 };
 }
\ No newline at end of file
@@ -24,7 +24,7 @@ void ConfigSingleton::ParseOptions(int argc, char** argv)
 
     instance = new ConfigSingleton();
 
-    const char* const short_opts = "r:e:o:s:p:d:h:i:kmbcn"; 
+    const char* const short_opts = "r:e:o:s:p:d:h:i:g:z:t:x:u:a:q:f:y:Q:M:C:K:X:I:G:L:kmbBPcnwlvjRSTA"; 
     const option long_opts[] = {
         {"resolution",       required_argument, nullptr, 'r'},
         {"environment",      required_argument, nullptr, 'e'},
@@ -34,11 +34,38 @@ void ConfigSingleton::ParseOptions(int argc, char** argv)
         {"direct_samples",   required_argument, nullptr, 'd'},
         {"indirect_samples", required_argument, nullptr, 'h'},
         {"recursion_depth",  required_argument, nullptr, 'i'},
+        {"seed",             required_argument, nullptr, 'g'},
+        {"sampler",          required_argument, nullptr, 'z'},
+        {"target_error",     required_argument, nullptr, 't'},
+        {"max_spp",          required_argument, nullptr, 'x'},
+        {"roulette",         required_argument, nullptr, 'u'},
+        {"light_sampler",    required_argument, nullptr, 'a'},
+        {"time_budget",      required_argument, nullptr, 'q'},
+        {"reference",        required_argument, nullptr, 'f'},
+        {"socket",           required_argument, nullptr, 'y'},
+        {"denoiser_quality", required_argument, nullptr, 'Q'},
+        {"denoiser_memory",  required_argument, nullptr, 'M'},
+        {"reference_cache",  required_argument, nullptr, 'C'},
+        {"mesh_cache",       required_argument, nullptr, 'K'},
+        {"exr_compression",  required_argument, nullptr, 'X'},
+        {"intersector",      required_argument, nullptr, 'I'},
+        {"geometry_quality", required_argument, nullptr, 'G'},
+        {"scene_quality",    required_argument, nullptr, 'L'},
         {"denoiser",         no_argument,       nullptr, 'k'},
         {"save_image",       no_argument,       nullptr, 'm'},
+        {"save_raw",         no_argument,       nullptr, 'R'},
+        {"stream_denoise",   no_argument,       nullptr, 'S'},
+        {"exr_tiled",        no_argument,       nullptr, 'T'},
+        {"save_aovs",        no_argument,       nullptr, 'A'},
         {"bvh",              no_argument,       nullptr, 'b'},
+        {"bvh_report",       no_argument,       nullptr, 'B'},
+        {"spatial_splits",   no_argument,       nullptr, 'P'},
         {"canvases",         no_argument,       nullptr, 'c'},
         {"normals",          no_argument,       nullptr, 'n'},
+        {"wavefront",        no_argument,       nullptr, 'w'},
+        {"legacy_pool",      no_argument,       nullptr, 'l'},
+        {"server",           no_argument,       nullptr, 'v'},
+        {"predict",          no_argument,       nullptr, 'j'},
         {nullptr,            no_argument,       nullptr,  0 }
     };
 
@@ -139,6 +166,159 @@ void ConfigSingleton::ParseOptions(int argc, char** argv)
                 instance->recursion_depth = std::stol(optarg);
                 break;
             }
+            case 'g': // --seed
+            {
+                instance->seed = std::stoul(optarg);
+                break;
+            }
+            case 'z': // --sampler
+            {
+                const std::string sampler = optarg;
+                if (sampler == "sobol")
+                    instance->sampler = SamplerType::Sobol;
+                else if (sampler == "zsobol")
+                    instance->sampler = SamplerType::ZSobol;
+                else if (sampler == "independent")
+                    instance->sampler = SamplerType::Independent;
+                else
+                {
+                    std::cerr << "Unknown sampler " << sampler << ", using independent" << std::endl;
+                    instance->sampler = SamplerType::Independent;
+                    break;
+                }
+                std::cout << "Using " << sampler << " sampler" << std::endl;
+                break;
+            }
+            case 't': // --target_error
+            {
+                instance->adaptive_error = std::stof(optarg);
+                std::cout << "Adaptive sampling to a relative error of " << instance->adaptive_error << std::endl;
+                break;
+            }
+            case 'x': // --max_spp
+            {
+                instance->max_samples_per_pixel = std::stol(optarg);
+                break;
+            }
+            case 'u': // --roulette min depth
+            {
+                instance->russian_roulette = true;
+                instance->roulette_depth   = std::stol(optarg);
+                std::cout << "Using russian roulette from depth " << instance->roulette_depth << std::endl;
+                break;
+            }
+            case 'a': // --light_sampler
+            {
+                const std::string light_sampler = optarg;
+                if (light_sampler == "power")
+                    instance->light_sampler = LightSamplerType::Power;
+                else if (light_sampler == "bvh")
+                    instance->light_sampler = LightSamplerType::BVH;
+                else if (light_sampler == "all")
+                    instance->light_sampler = LightSamplerType::All;
+                else
+                {
+                    std::cerr << "Unknown light sampler " << light_sampler << ", using all" << std::endl;
+                    instance->light_sampler = LightSamplerType::All;
+                    break;
+                }
+                std::cout << "Using " << light_sampler << " light sampler" << std::endl;
+                break;
+            }
+            case 'q': // --time_budget
+            {
+                instance->time_budget = std::stof(optarg);
+                std::cout << "Rendering progressively for " << instance->time_budget << " s" << std::endl;
+                break;
+            }
+            case 'Q': // --denoiser_quality default|balanced|high
+            {
+                const std::string quality = optarg;
+                if (quality == "balanced")
+                    instance->denoiser_settings.quality = oidn::Quality::Balanced;
+                else if (quality == "high")
+                    instance->denoiser_settings.quality = oidn::Quality::High;
+                else if (quality == "default")
+                    instance->denoiser_settings.quality = oidn::Quality::Default;
+                else
+                {
+                    std::cerr << "Unknown denoiser quality " << quality << ", using default" << std::endl;
+                    instance->denoiser_settings.quality = oidn::Quality::Default;
+                    break;
+                }
+                std::cout << "Using " << quality << " denoiser quality" << std::endl;
+                break;
+            }
+            case 'M': // --denoiser_memory MB
+            {
+                instance->denoiser_settings.max_memory_mb = std::stoi(optarg);
+                std::cout << "Limiting the denoiser to " << instance->denoiser_settings.max_memory_mb << " MB" << std::endl;
+                break;
+            }
+            case 'f': // --reference filename
+            {
+                instance->reference_filename = optarg;
+                break;
+            }
+            case 'C': // --reference_cache directory
+            {
+                instance->reference_cache = optarg;
+                break;
+            }
+            case 'K': // --mesh_cache directory
+            {
+                instance->mesh_cache = optarg;
+                break;
+            }
+            case 'X': // --exr_compression none|zips|zip|piz|dwaa
+            {
+                const auto compression = ParseEXRCompression(optarg);
+                if (compression)
+                    instance->exr_settings.compression = *compression;
+                else
+                    std::cerr << "Unknown EXR compression " << optarg << ", using zip" << std::endl;
+                break;
+            }
+            case 'I': // --intersector embree|bvh4
+            {
+                const auto intersector = ParseIntersector(optarg);
+                if (intersector)
+                    instance->intersector = *intersector;
+                else
+                    std::cerr << "Unknown intersector " << optarg << ", using embree" << std::endl;
+
+                // The BVH4 is built from the triangles gathered for the custom BVH
+                if (instance->intersector == Intersector::BVH4)
+                {
+                    instance->use_bvh = true;
+                    std::cout << "Tracing with the BVH4" << std::endl;
+                }
+                break;
+            }
+            case 'G': // --geometry_quality low|medium|high
+            {
+                const auto quality = ParseBuildQuality(optarg);
+                if (quality)
+                    instance->geometry_quality = *quality;
+                else
+                    std::cerr << "Unknown build quality " << optarg << ", using low" << std::endl;
+                break;
+            }
+            case 'L': // --scene_quality low|medium|high
+            {
+                const auto quality = ParseBuildQuality(optarg);
+                if (quality)
+                    instance->scene_quality = *quality;
+                else
+                    std::cerr << "Unknown build quality " << optarg << ", using medium" << std::endl;
+                break;
+            }
+            case 'y': // --socket path
+            {
+                instance->server      = true;
+                instance->socket_path = optarg;
+                break;
+            }
             case 'k': // --denoiser
             {
                 instance->denoiser = true;
@@ -150,12 +330,45 @@ void ConfigSingleton::ParseOptions(int argc, char** argv)
                 instance->save_image = true;
                 break;
             }
+            case 'R': // --save_raw
+            {
+                instance->save_raw = true;
+                break;
+            }
+            case 'T': // --exr_tiled
+            {
+                instance->exr_settings.tiled = true;
+                break;
+            }
+            case 'A': // --save_aovs
+            {
+                instance->save_aovs = true;
+                break;
+            }
+            case 'S': // --stream_denoise
+            {
+                instance->stream_denoise = true;
+                std::cout << "Denoising regions of the film as they complete" << std::endl;
+                break;
+            }
             case 'b': // --bvh
             {
                 instance->use_bvh = true;                
                 std::cout << "Using BVH" << std::endl;
                 break;
             }
+            case 'B': // --bvh_report
+            {
+                // The report is on the custom BVH, so its triangles have to be gathered
+                instance->bvh_report = true;
+                instance->use_bvh    = true;
+                break;
+            }
+            case 'P': // --spatial_splits
+            {
+                instance->spatial_splits = true;
+                break;
+            }
             case 'c': // --canvases
             {
                 instance->visualise_canvases = true;
@@ -168,6 +381,29 @@ void ConfigSingleton::ParseOptions(int argc, char** argv)
                 std::cout << "Visualising normals" << std::endl;
                 break;
             }
+            case 'w': // --wavefront
+            {
+                instance->use_wavefront = true;
+                std::cout << "Using wavefront renderer" << std::endl;
+                break;
+            }
+            case 'l': // --legacy_pool
+            {
+                instance->legacy_pool = true;
+                std::cout << "Using legacy thread pool" << std::endl;
+                break;
+            }
+            case 'v': // --server
+            {
+                instance->server = true;
+                std::cout << "Running as render server" << std::endl;
+                break;
+            }
+            case 'j': // --predict
+            {
+                instance->predict = true;
+                break;
+            }
             default:
             {
                 break;
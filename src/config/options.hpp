@@ -1,6 +1,12 @@
 #pragma once
 
+#include "bvh/bvh.hpp"
+#include "bvh/intersector.hpp"
+#include "denoiser/denoiser.hpp"
+#include "lights/lightsampler.hpp"
 #include "loaders/scene.hpp"
+#include "samplers/sampler.hpp"
+#include "utils/exr.hpp"
 
 #include <cstddef>
 #include <filesystem>
@@ -14,6 +20,9 @@ public:
     // Defined parameters
     Scene environment = double_dragon;
     std::filesystem::path image_filename;
+    std::filesystem::path reference_filename = "/home/Charlie/CGD-CTD/ref/ref-split-room-l.exr";
+    std::filesystem::path reference_cache    = std::filesystem::temp_directory_path() / "ct-reference-cache"; // Decoded references, shared between processes. Empty to decode every run.
+    std::filesystem::path mesh_cache         = std::filesystem::temp_directory_path() / "ct-mesh-cache"; // Imported meshes, shared between processes. Empty to import every run.
     size_t image_width       = 1280;
     size_t image_height      = 720;
     size_t canvas_width      = 40;
@@ -22,13 +31,36 @@ public:
     size_t direct_samples    = 1;
     size_t indirect_samples  = 1;
     size_t recursion_depth   = 1;
+    float  adaptive_error    = 0.0F; // Target relative error per pixel, 0 disables adaptive sampling
+    size_t max_samples_per_pixel = 64;
+    float  time_budget       = 0.0F; // Wall clock seconds for a progressive render, 0 renders a single pass
+    bool   russian_roulette  = false;
+    size_t roulette_depth    = 1; // First depth at which paths may be terminated by russian roulette
+    size_t seed              = 0;
+    SamplerType sampler      = SamplerType::Independent;
+    LightSamplerType light_sampler = LightSamplerType::All;
+    DenoiserSettings denoiser_settings;
     bool   denoiser          = false;
     bool   save_image        = false;
+    bool   save_raw          = false; // Also write the image before denoising, next to the denoised one
+    bool   save_aovs         = false; // Also write the albedo and normal planes as layers of the image
+    EXRSettings exr_settings;
+    bool   stream_denoise    = false; // Denoise regions of the film while the rest renders, single pass renders only
+    bool   use_wavefront     = false;
+    bool   server            = false; // Read render jobs from stdin, or from socket_path if set
+    bool   predict           = false; // Print the render time predicted by the cost model instead of rendering
+    std::filesystem::path socket_path;
+    bool   legacy_pool       = false; // Schedule canvases on the mutex based thread pool instead of work stealing
+    Intersector intersector  = Intersector::Embree;
+    RTCBuildQuality geometry_quality = RTC_BUILD_QUALITY_LOW;    // BVH of each mesh
+    RTCBuildQuality scene_quality    = RTC_BUILD_QUALITY_MEDIUM; // BVH over the meshes, and the custom BVH over every triangle
+    bool   spatial_splits    = false; // Let the custom BVH split triangles across nodes, at high scene quality only
     // Texture resolution
     // Adaptive material
 
     // Debug parameters
     bool use_bvh = false;
+    bool bvh_report = false; // Print the statistics of the custom BVH for every build setting instead of rendering
     bool visualise_canvases = false;
     bool visualise_normals = false;
 
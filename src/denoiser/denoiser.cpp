@@ -0,0 +1,300 @@
+#include "denoiser.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <tuple>
+#include <utility>
+
+#include "camera/film.hpp"
+
+namespace CT
+{
+// Interior size of the streamed regions. Small regions start denoising sooner, large ones waste less on overlap borders.
+constexpr size_t kStreamTileSize = 512;
+
+/// @brief Place the window of a streamed region along one axis of the film
+/// @param interior Start of the interior
+/// @param overlap Border the filter needs around the interior, a multiple of the alignment
+/// @param window_size Size of the windows that fit inside the film
+/// @param extent Size of the film
+/// @param alignment Tile alignment of the filter
+/// @return Start and size of the window. The start is aligned, so a window pushed back from the far edge of the film
+/// grows by the rounding to still reach it.
+static std::pair<size_t, size_t> PlaceWindow(size_t interior, size_t overlap, size_t window_size, size_t extent, size_t alignment)
+{
+    size_t start = interior - std::min(interior, overlap);
+    const size_t end = std::min(start + window_size, extent);
+    start = std::min(start, extent - window_size);
+    start -= start % alignment;
+    return { start, end - start };
+}
+
+Denoiser::Denoiser(const DenoiserSettings& settings) :
+    _settings(settings),
+    _device(oidn::newDevice())
+{
+    _device.commit();
+    _shared = _device.get<bool>("systemMemorySupported");
+
+    // Creating the filter is expensive, it is created once and reinitialised by OIDN only when its parameters change
+    _filter = _device.newFilter("RT");
+    _filter.set("hdr", true); // Signal that the images are HDR
+}
+
+void Denoiser::SetSettings(const DenoiserSettings& settings)
+{
+    if (settings == _settings)
+        return;
+
+    _settings         = settings;
+    _settings_changed = true;
+}
+
+void Denoiser::Bind(Film& film)
+{
+    const size_t width  = film.rect.GetWidth();
+    const size_t height = film.rect.GetHeight();
+    const size_t bytes  = width * height * 3 * sizeof(float);
+
+    float* colour = film.rgb.data();
+    float* albedo = film.albedo.data();
+    float* normal = film.normal.data();
+
+    if (!_shared)
+    {
+        if (width != _width || height != _height || !_colour)
+        {
+            _colour = _device.newBuffer(bytes);
+            _albedo = _device.newBuffer(bytes);
+            _normal = _device.newBuffer(bytes);
+        }
+
+        _colour.write(0, bytes, colour);
+        if (_settings.auxiliary)
+        {
+            _albedo.write(0, bytes, albedo);
+            _normal.write(0, bytes, normal);
+        }
+
+        // Buffers only need binding when they are created or the settings change
+        if (_bound == nullptr || width != _width || height != _height || _settings_changed)
+        {
+            _filter.setImage("color",  _colour, oidn::Format::Float3, width, height);
+            _filter.setImage("output", _colour, oidn::Format::Float3, width, height);
+            if (_settings.auxiliary)
+            {
+                _filter.setImage("albedo", _albedo, oidn::Format::Float3, width, height);
+                _filter.setImage("normal", _normal, oidn::Format::Float3, width, height);
+            }
+            else
+            {
+                _filter.unsetImage("albedo");
+                _filter.unsetImage("normal");
+            }
+        }
+    }
+    else if (colour != _bound || width != _width || height != _height || _settings_changed)
+    {
+        // Denoised in place, OIDN does not reinitialise the filter if only the pointers change
+        _filter.setImage("color",  colour, oidn::Format::Float3, width, height); // Beauty
+        _filter.setImage("output", colour, oidn::Format::Float3, width, height); // Denoised beauty
+        if (_settings.auxiliary)
+        {
+            _filter.setImage("albedo", albedo, oidn::Format::Float3, width, height); // First hit albedo, in [0, 1]
+            _filter.setImage("normal", normal, oidn::Format::Float3, width, height); // First hit world space normal, in [-1, 1]
+        }
+        else
+        {
+            _filter.unsetImage("albedo");
+            _filter.unsetImage("normal");
+        }
+    }
+    else
+        return;
+
+    if (_settings_changed)
+    {
+        _filter.set("quality", _settings.quality);
+        _filter.set("maxMemoryMB", _settings.max_memory_mb);
+    }
+
+    _filter.commit();
+
+    _bound  = colour;
+    _width  = width;
+    _height = height;
+    _settings_changed = false;
+}
+
+bool Denoiser::Denoise(Film& film)
+{
+    Bind(film);
+    _filter.execute();
+
+    // Check for errors
+    const char* err_msg;
+    if (_device.getError(err_msg) != oidn::Error::None)
+    {
+        std::cout << "OIDN Error: " << err_msg << std::endl;
+        return false;
+    }
+
+    if (!_shared)
+        _colour.read(0, film.rgb.size() * sizeof(float), film.rgb.data());
+
+    return true;
+}
+
+bool Denoiser::BeginStream(Film& film)
+{
+    if (!_shared)
+        return false;
+
+    const size_t width  = film.rect.GetWidth();
+    const size_t height = film.rect.GetHeight();
+
+    if (!_tile_filter)
+    {
+        _tile_filter = _device.newFilter("RT");
+        _tile_filter.set("hdr", true);
+
+        // Autoexposure would measure each window separately and leave seams between the regions, so the beauty is
+        // passed unscaled as it is for the whole film
+        _tile_filter.set("inputScale", 1.0F);
+        _stream_thread.emplace(1);
+    }
+
+    _tile_filter.set("quality", _settings.quality);
+    _tile_filter.set("maxMemoryMB", _settings.max_memory_mb);
+
+    // Every window reaches the overlap border the filter needs past its interior, or the edge of the film.
+    // The filter only gives the same result as on the whole film for windows that start on its tile alignment.
+    const auto alignment = std::max<size_t>(static_cast<size_t>(_tile_filter.get<int>("tileAlignment")), 1);
+    auto overlap = static_cast<size_t>(_tile_filter.get<int>("tileOverlap"));
+    overlap = (overlap + alignment - 1) / alignment * alignment;
+    const size_t window_width  = std::min(kStreamTileSize + 2 * overlap, width);
+    const size_t window_height = std::min(kStreamTileSize + 2 * overlap, height);
+
+    _tiles.clear();
+    size_t scratch = 0;
+    for (size_t y = 0; y < height; y += kStreamTileSize)
+    {
+        for (size_t x = 0; x < width; x += kStreamTileSize)
+        {
+            StreamTile tile;
+            tile.x        = x;
+            tile.y        = y;
+            tile.width    = std::min(kStreamTileSize, width - x);
+            tile.height   = std::min(kStreamTileSize, height - y);
+            std::tie(tile.window_x, tile.window_width)  = PlaceWindow(x, overlap, window_width,  width,  alignment);
+            std::tie(tile.window_y, tile.window_height) = PlaceWindow(y, overlap, window_height, height, alignment);
+            scratch = std::max(scratch, tile.window_width * tile.window_height);
+            _tiles.push_back(tile);
+        }
+    }
+
+    _canvas_tiles.assign(film.canvases.size(), {});
+    _pending_canvases = std::make_unique<std::atomic<size_t>[]>(_tiles.size());
+    for (size_t t = 0; t < _tiles.size(); t++)
+    {
+        const StreamTile& tile = _tiles[t];
+        size_t pending = 0;
+        for (size_t c = 0; c < film.canvases.size(); c++)
+        {
+            const Rect& rect = film.canvases[c].rect;
+            if (rect.lrx >= tile.window_x && rect.ulx < tile.window_x + tile.window_width &&
+                rect.lry >= tile.window_y && rect.uly < tile.window_y + tile.window_height)
+            {
+                _canvas_tiles[c].push_back(t);
+                pending++;
+            }
+        }
+        _pending_canvases[t] = pending;
+    }
+
+    _output.resize(film.rgb.size());
+    _scratch.resize(scratch * 3);
+    _queued.clear();
+    _stream_failed = false;
+    _stream_film   = &film;
+    return true;
+}
+
+void Denoiser::CanvasComplete(size_t canvas)
+{
+    for (const size_t t : _canvas_tiles[canvas])
+    {
+        // The last canvas a window waits for queues its tile
+        if (_pending_canvases[t].fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(_stream_mutex);
+            _queued.emplace_back(_stream_thread->enqueue([this, t] { DenoiseTile(t); }));
+        }
+    }
+}
+
+void Denoiser::DenoiseTile(size_t t)
+{
+    const StreamTile& tile = _tiles[t];
+    Film& film = *_stream_film;
+
+    // The window is read in place from the film planes
+    const size_t pixel_bytes = 3 * sizeof(float);
+    const size_t row_bytes   = film.rect.GetWidth() * pixel_bytes;
+    const size_t offset      = tile.window_y * row_bytes + tile.window_x * pixel_bytes;
+
+    _tile_filter.setImage("color", film.rgb.data(), oidn::Format::Float3, tile.window_width, tile.window_height, offset, pixel_bytes, row_bytes);
+    if (_settings.auxiliary)
+    {
+        _tile_filter.setImage("albedo", film.albedo.data(), oidn::Format::Float3, tile.window_width, tile.window_height, offset, pixel_bytes, row_bytes);
+        _tile_filter.setImage("normal", film.normal.data(), oidn::Format::Float3, tile.window_width, tile.window_height, offset, pixel_bytes, row_bytes);
+    }
+    else
+    {
+        _tile_filter.unsetImage("albedo");
+        _tile_filter.unsetImage("normal");
+    }
+    _tile_filter.setImage("output", _scratch.data(), oidn::Format::Float3, tile.window_width, tile.window_height);
+    _tile_filter.commit();
+    _tile_filter.execute();
+
+    const char* err_msg;
+    if (_device.getError(err_msg) != oidn::Error::None)
+    {
+        std::cout << "OIDN Error: " << err_msg << std::endl;
+        _stream_failed = true;
+        return;
+    }
+
+    // Copy the interior, the border only guided the filter
+    const size_t width = film.rect.GetWidth();
+    for (size_t y = tile.y; y < tile.y + tile.height; y++)
+    {
+        const float* src = _scratch.data() + ((y - tile.window_y) * tile.window_width + tile.x - tile.window_x) * 3;
+        std::memcpy(_output.data() + (y * width + tile.x) * 3, src, tile.width * pixel_bytes);
+    }
+}
+
+bool Denoiser::EndStream(std::vector<float>* raw)
+{
+    // Tiles of canvases that never completed are denoised with whatever the film holds
+    for (size_t t = 0; t < _tiles.size(); t++)
+        if (_pending_canvases[t].exchange(0) != 0)
+            _queued.emplace_back(_stream_thread->enqueue([this, t] { DenoiseTile(t); }));
+
+    for (std::future<void>& queued : _queued)
+        queued.get();
+    _queued.clear();
+
+    Film& film = *_stream_film;
+    _stream_film = nullptr;
+    if (_stream_failed)
+        return false;
+
+    film.rgb.swap(_output);
+    if (raw)
+        raw->swap(_output);
+    return true;
+}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "OpenImageDenoise/oidn.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "renderers/threadpool.hpp"
+
+namespace CT
+{
+class Film;
+
+/// @brief Parameters of the denoising filter
+struct DenoiserSettings
+{
+    oidn::Quality quality = oidn::Quality::Default;
+    int max_memory_mb     = -1;   // Scratch memory limit of the filter, larger images are denoised in tiles. No limit if negative.
+    bool auxiliary        = true; // Guide the filter with the albedo and normal planes of the film
+
+    bool operator==(const DenoiserSettings&) const = default;
+};
+
+/// @brief Denoises the beauty of films in place with the OIDN "RT" filter. The device and filter live as long as the
+/// denoiser and read the film planes directly, so a denoise copies nothing. The filter is only rebuilt when the
+/// resolution or the settings change; denoising a new film of the same resolution just rebinds its planes.
+class Denoiser
+{
+public:
+    explicit Denoiser(const DenoiserSettings& settings = {});
+
+    Denoiser(const Denoiser&) = delete;
+    Denoiser& operator=(const Denoiser&) = delete;
+
+    /// @brief Change the settings, they apply from the next denoise
+    /// @param settings
+    void SetSettings(const DenoiserSettings& settings);
+
+    const DenoiserSettings& GetSettings() const { return _settings; }
+
+    /// @brief Replace the beauty of a film with its denoised version
+    /// @param film
+    /// @return False if OIDN reported an error, which is printed
+    bool Denoise(Film& film);
+
+    /// @brief Start denoising a film while it renders. Regions of the film are denoised as soon as every canvas
+    /// covering them and the overlap border the filter needs has completed, so most of the denoise runs during the render.
+    /// Needs a device that reads host memory, the windows are read straight from the film.
+    /// @param film Film about to be rendered, must outlive EndStream
+    /// @return False if the device cannot stream, the film should then be denoised with Denoise once rendered
+    bool BeginStream(Film& film);
+
+    /// @brief Signal that a canvas of the streamed film is final. Thread safe, called from the render threads.
+    /// @param canvas Index of the canvas in the film
+    void CanvasComplete(size_t canvas);
+
+    /// @brief Wait for the last regions and replace the beauty of the streamed film with its denoised version
+    /// @param raw If set, receives the beauty before denoising
+    /// @return False if OIDN reported an error, which is printed
+    bool EndStream(std::vector<float>* raw = nullptr);
+
+private:
+    /// @brief Point the filter at the planes of a film, or at staging buffers if the device cannot read host memory
+    /// @param film
+    void Bind(Film& film);
+
+    DenoiserSettings _settings;
+    bool _settings_changed = true;
+
+    oidn::DeviceRef _device;
+    oidn::FilterRef _filter;
+    bool _shared; // The device reads host memory, so film planes are passed without copying
+
+    // Staging buffers for devices that cannot read host memory
+    oidn::BufferRef _colour;
+    oidn::BufferRef _albedo;
+    oidn::BufferRef _normal;
+
+    // What the filter is currently bound to
+    const float* _bound = nullptr;
+    size_t _width  = 0;
+    size_t _height = 0;
+
+    /// @brief Region of a streamed film. The interior is written to the output, the window around it is what the filter
+    /// reads. Windows start on the tile alignment of the filter so they are denoised as the whole film would be. They all
+    /// have the same size except along the right and bottom edges, where they widen to reach the edge of the film.
+    struct StreamTile
+    {
+        size_t x, y, width, height;                       // Interior
+        size_t window_x, window_y, window_width, window_height;
+    };
+
+    /// @brief Denoise the window of a tile and copy its interior to the output, runs on the stream thread
+    /// @param tile Index of the tile
+    void DenoiseTile(size_t tile);
+
+    oidn::FilterRef _tile_filter;
+    std::optional<ThreadPool> _stream_thread; // Denoises tiles one after the other, the filter itself is multithreaded
+
+    Film* _stream_film = nullptr;
+    std::vector<StreamTile> _tiles;
+    std::vector<std::vector<size_t>> _canvas_tiles;          // Tiles whose window intersects each canvas
+    std::unique_ptr<std::atomic<size_t>[]> _pending_canvases; // Canvases each tile still waits for
+    std::vector<float> _output;  // Denoised beauty, the film keeps the raw beauty until every window has been read
+    std::vector<float> _scratch; // Denoised window
+
+    std::mutex _stream_mutex; // Guards the queued tiles
+    std::vector<std::future<void>> _queued;
+    std::atomic<bool> _stream_failed = false;
+};
+}
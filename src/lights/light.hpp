@@ -1,14 +1,22 @@
 #pragma once
 
+#include "bvh/intersector.hpp"
 #include "loaders/object.hpp"
 #include "embree/embreesingleton.hpp"
+#include "lights/lightsampler.hpp"
+#include "samplers/sampler.hpp"
+#include "utils/raystats.hpp"
 #include "utils/rgb.hpp"
 #include "utils/utils.hpp"
 
 #include <Eigen/Dense>
 
+#include <algorithm>
 #include <array>
+#include <limits>
 #include <numbers>
+#include <optional>
+#include <utility>
 
 namespace CT
 {
@@ -57,104 +65,216 @@ public:
     std::vector<AreaLightSphere> area_sphere;
 };
 
-static bool CastShadowRay(const Eigen::Vector3f& ray_hit_ws, const Eigen::Vector3f& light_dir_ws, float distance_to_light, RTCIntersectContext& context)
+/// @brief A candidate light contribution, valid if nothing occludes the shadow ray towards it
+struct LightSample
 {
-    RTCRay ray {
-        .org_x = ray_hit_ws.x(),
-        .org_y = ray_hit_ws.y(),
-        .org_z = ray_hit_ws.z(),
-        .tnear = 0.0001F,
-        .dir_x = light_dir_ws.x(),
-        .dir_y = light_dir_ws.y(),
-        .dir_z = light_dir_ws.z(),
-        .tfar  = distance_to_light,
-        .mask  = 0xFFFFFFFF };
-    
-    rtcOccluded1(EmbreeSingleton::GetInstance().scene, &context, &ray);
-    return ray.tfar < distance_to_light; // if tfar is less than distance to light, then there is an occluder
-}
+    Eigen::Vector3f direction;
+    float distance;
+    RGB contribution;
+};
 
-static RGB EvaluateLighting(const Eigen::Vector3f& incident_hit_worldspace, const Eigen::Vector3f& incident_shading_normal, 
-                            const Eigen::Vector3f& incident_reflection, const Object* obj, const Lights& lights, RTCIntersectContext& context, size_t depth)
+static LightSample EvaluateDirectionalLight(const DirectionalLight& dir_light, const Eigen::Vector3f& incident_shading_normal, const Eigen::Vector3f& incident_reflection, const Object* obj)
 {
-    RGB sample_light = BLACK;
-
-    for (const auto& dir_light : lights.directional)
+    // Calculate the diffuse component
+    float costheta = std::max(0.0F, incident_shading_normal.dot(dir_light.direction)) / std::numbers::pi_v<float>;
+    RGB contribution = (obj->material->kd * dir_light.colour * costheta);
+    if (obj->material->mirror)
     {
-        if (CastShadowRay(incident_hit_worldspace, dir_light.direction, std::numeric_limits<float>::infinity(), context))
-            continue;
-        // Calculate the diffuse component
-        float costheta = std::max(0.0F, incident_shading_normal.dot(dir_light.direction)) / std::numbers::pi_v<float>;
-        sample_light += (obj->material->kd * dir_light.colour * costheta);
-        if (!obj->material->mirror) { continue; }
         // Calculate the specular component
         float cosphi = std::max(0.0F, incident_reflection.dot(dir_light.direction));
-        sample_light += (obj->material->ks * dir_light.colour * std::pow(cosphi, obj->material->shininess));
+        contribution += (obj->material->ks * dir_light.colour * std::pow(cosphi, obj->material->shininess));
     }
+    return { dir_light.direction, std::numeric_limits<float>::infinity(), contribution };
+}
 
-    for (const auto& point : lights.point)
+static LightSample EvaluatePointLight(const PointLight& point, const Eigen::Vector3f& incident_hit_worldspace, const Eigen::Vector3f& incident_shading_normal,
+                                      const Eigen::Vector3f& incident_reflection, const Object* obj)
+{
+    Eigen::Vector3f direction_to_point = point.position - incident_hit_worldspace;
+    float distance_to_light = direction_to_point.norm();
+    direction_to_point /= distance_to_light;
+    float r2 = 1.0F / (distance_to_light * distance_to_light);
+    // Calculate the diffuse component
+    float costheta = std::max(0.0F, incident_shading_normal.dot(direction_to_point)) / std::numbers::pi_v<float>;
+    RGB contribution = (obj->material->kd * point.colour * costheta * r2);
+    if (obj->material->mirror)
     {
-        Eigen::Vector3f direction_to_point = point.position - incident_hit_worldspace;
-        float distance_to_light = direction_to_point.norm();
-        direction_to_point /= distance_to_light;
-        if (CastShadowRay(incident_hit_worldspace, direction_to_point, distance_to_light, context))
-            continue;
-        float r2 = 1.0F / (distance_to_light * distance_to_light);
-        // Calculate the diffuse component
-        float costheta = std::max(0.0F, incident_shading_normal.dot(direction_to_point)) / std::numbers::pi_v<float>;
-        sample_light += (obj->material->kd * point.colour * costheta * r2);
-        if (!obj->material->mirror) { continue; }
         // Calculate the specular component
         float cosphi = std::max(0.0F, incident_reflection.dot(direction_to_point));
-        sample_light += (obj->material->ks * point.colour * std::pow(cosphi, obj->material->shininess) * r2);
+        contribution += (obj->material->ks * point.colour * std::pow(cosphi, obj->material->shininess) * r2);
     }
+    return { direction_to_point, distance_to_light, contribution };
+}
+
+/// @param samples One 2D value is drawn for the point on the light at depth 0
+static LightSample EvaluateAreaLight(const AreaLightCuboid& area_c, const Eigen::Vector3f& incident_hit_worldspace, const Eigen::Vector3f& incident_shading_normal,
+                                     const Eigen::Vector3f& incident_reflection, const Object* obj, size_t depth, SampleStream& samples)
+{
+    RGB bsdf = BLACK;
+    Eigen::Vector3f area_light_sample_point;
+    if (depth == 0)
+    {
+        const Eigen::Vector2f u = samples.Next2D();
+        float x = u.x() - 0.5F;
+        float z = u.y() - 0.5F;
+
+        Eigen::Vector3f rand_point_offset(x * area_c.width, 0.0F, z * area_c.height);
+        area_light_sample_point = area_c.position + rand_point_offset;
+    }
+    else // Treat area light as a point light after the first bounce
+    {
+        area_light_sample_point = area_c.position;
+    }
+
+    // Calculate the direction to the random point on the area light
+    Eigen::Vector3f direction_to_area_light = area_light_sample_point - incident_hit_worldspace;
+
+    // Calculate the distance between the random point on the area light and the incident hit point
+    float distance_to_area_light = direction_to_area_light.norm();
+
+    // Normalise the direction to the area light
+    direction_to_area_light /= distance_to_area_light;
+
+    // Calculate PDF
+    float pdf = 1.0F / (area_c.width * area_c.height);
+
+    // Calculate attenuation
+    float r2 = 1.0F / (distance_to_area_light * distance_to_area_light);
+
+    float costheta = std::max(0.0F, incident_shading_normal.dot(direction_to_area_light));
+    // TODO : Dot produce between the negative direction to the area light and the normal of the area light, add to multipliers
+    float costhetaprime = std::max(0.0F, -area_c.normal.dot(direction_to_area_light));
+    float geomterm = costheta * costhetaprime * r2;
+    float cosphi = std::max(0.0F, incident_reflection.dot(direction_to_area_light));
+    bsdf = (obj->material->kd / std::numbers::pi_v<float>) + (obj->material->ks * ((obj->material->shininess + 2.0F) / (2.0F * std::numbers::pi_v<float>)) * std::pow(cosphi, obj->material->shininess)) * r2;
+    return { direction_to_area_light, distance_to_area_light, (bsdf * area_c.colour * geomterm) / pdf };
+}
+
+/// @brief Generate one unoccluded light sample per light and pass each to a callback
+/// @param samples Sample dimensions of the light slot, one 2D value is drawn per sampled area light
+/// @param fn Callable taking a const LightSample&
+template<typename F>
+static void ForEachLightSample(const Eigen::Vector3f& incident_hit_worldspace, const Eigen::Vector3f& incident_shading_normal,
+                               const Eigen::Vector3f& incident_reflection, const Object* obj, const Lights& lights, size_t depth, SampleStream& samples, F&& fn)
+{
+    for (const auto& dir_light : lights.directional)
+        fn(EvaluateDirectionalLight(dir_light, incident_shading_normal, incident_reflection, obj));
+
+    for (const auto& point : lights.point)
+        fn(EvaluatePointLight(point, incident_hit_worldspace, incident_shading_normal, incident_reflection, obj));
 
     for (const auto& area_c : lights.area_cuboid)
-    {  
-        RGB bsdf = BLACK;
-        Eigen::Vector3f area_light_sample_point;
-        if (depth == 0)
-        {
-            float x = RandomRange(-0.5F, 0.5F);
-            float z = RandomRange(-0.5F, 0.5F);
-
-            Eigen::Vector3f rand_point_offset(x * area_c.width, 0.0F, z * area_c.height);
-            area_light_sample_point = area_c.position + rand_point_offset;
-        }
-        else // Treat area light as a point light after the first bounce
-        {
-            area_light_sample_point = area_c.position;
-        }
-
-        // Calculate the direction to the random point on the area light
-        Eigen::Vector3f direction_to_area_light = area_light_sample_point - incident_hit_worldspace;
-
-        // Calculate the distance between the random point on the area light and the incident hit point
-        float distance_to_area_light = direction_to_area_light.norm();
-
-        // Normalise the direction to the area light
-        direction_to_area_light /= distance_to_area_light;
-
-        // If light is occluded, continue
-        if (CastShadowRay(incident_hit_worldspace, direction_to_area_light, distance_to_area_light, context))
-            continue;
-
-        // Calculate PDF
-        float pdf = 1.0F / (area_c.width * area_c.height);
-
-        // Calculate attenuation
-        float r2 = 1.0F / (distance_to_area_light * distance_to_area_light);
-
-        float costheta = std::max(0.0F, incident_shading_normal.dot(direction_to_area_light));
-        // TODO : Dot produce between the negative direction to the area light and the normal of the area light, add to multipliers
-        float costhetaprime = std::max(0.0F, -area_c.normal.dot(direction_to_area_light));
-        float geomterm = costheta * costhetaprime * r2;
-        float cosphi = std::max(0.0F, incident_reflection.dot(direction_to_area_light));
-        bsdf = (obj->material->kd / std::numbers::pi_v<float>) + (obj->material->ks * ((obj->material->shininess + 2.0F) / (2.0F * std::numbers::pi_v<float>)) * std::pow(cosphi, obj->material->shininess)) * r2;
-        sample_light += (bsdf * area_c.colour * geomterm) / pdf;
+        fn(EvaluateAreaLight(area_c, incident_hit_worldspace, incident_shading_normal, incident_reflection, obj, depth, samples));
+}
+
+/// @brief Generate the unoccluded light samples of one direct sample. Every light is evaluated if there is no
+/// light sampler, otherwise a single light is chosen and its contribution divided by the probability of choosing it.
+/// @param light_sampler Nullptr to evaluate every light
+/// @param fn Callable taking a const LightSample&
+template<typename F>
+static void SampleLights(const Eigen::Vector3f& incident_hit_worldspace, const Eigen::Vector3f& incident_shading_normal, const Eigen::Vector3f& incident_reflection,
+                         const Object* obj, const Lights& lights, const LightSampler* light_sampler, size_t depth, SampleStream& samples, F&& fn)
+{
+    if (light_sampler == nullptr)
+    {
+        ForEachLightSample(incident_hit_worldspace, incident_shading_normal, incident_reflection, obj, lights, depth, samples, std::forward<F>(fn));
+        return;
+    }
+
+    const std::optional<SampledLight> sampled = light_sampler->Sample(incident_hit_worldspace, incident_shading_normal, samples.Next1D());
+    if (!sampled)
+        return;
+
+    LightSample ls;
+    switch (sampled->light.kind)
+    {
+        case LightKind::Directional:
+            ls = EvaluateDirectionalLight(lights.directional[sampled->light.index], incident_shading_normal, incident_reflection, obj);
+            break;
+        case LightKind::Point:
+            ls = EvaluatePointLight(lights.point[sampled->light.index], incident_hit_worldspace, incident_shading_normal, incident_reflection, obj);
+            break;
+        case LightKind::AreaCuboid:
+            ls = EvaluateAreaLight(lights.area_cuboid[sampled->light.index], incident_hit_worldspace, incident_shading_normal, incident_reflection, obj, depth, samples);
+            break;
     }
 
-    return sample_light;
+    ls.contribution = ls.contribution / sampled->pmf;
+    fn(ls);
 }
 
+/// @brief Shadow rays leaving one shading point, tested 16 at a time with Occluded16.
+/// Every light and direct sample of the point is queued before any ray is traced, so direct lighting
+/// costs one packet per 16 shadow rays instead of one rtcOccluded1 call per ray.
+class ShadowRayBatch
+{
+public:
+    ShadowRayBatch(const Eigen::Vector3f& origin, RTCIntersectContext& context) : _origin(origin), _context(context) { }
+
+    /// @brief Queue the shadow ray of a light sample, tracing the batch once it holds 16 rays
+    /// @param ls
+    void Add(const LightSample& ls)
+    {
+        if (ls.contribution == BLACK) // Nothing to gain from testing visibility
+            return;
+
+        _rays.org_x[_count] = _origin.x();
+        _rays.org_y[_count] = _origin.y();
+        _rays.org_z[_count] = _origin.z();
+        _rays.tnear[_count] = 0.0001F;
+        _rays.dir_x[_count] = ls.direction.x();
+        _rays.dir_y[_count] = ls.direction.y();
+        _rays.dir_z[_count] = ls.direction.z();
+        _rays.time[_count]  = 0.0F;
+        _rays.tfar[_count]  = ls.distance;
+        _rays.mask[_count]  = 0xFFFFFFFF;
+        _rays.id[_count]    = static_cast<unsigned int>(_count);
+        _rays.flags[_count] = 0;
+        _contribution[_count] = ls.contribution;
+
+        if (++_count == kLanes)
+            Flush();
+    }
+
+    /// @brief Trace any queued rays and return the summed contribution of the unoccluded ones
+    /// @return
+    RGB Resolve()
+    {
+        Flush();
+        return _unoccluded;
+    }
+
+private:
+    static constexpr size_t kLanes = 16;
+
+    void Flush()
+    {
+        if (_count == 0)
+            return;
+
+        alignas(64) std::array<int, kLanes> valid;
+        for (size_t i = 0; i < kLanes; i++)
+            valid[i] = i < _count ? -1 : 0;
+
+        std::array<float, kLanes> distance;
+        std::copy_n(_rays.tfar, _count, distance.begin());
+
+        Occluded16(valid.data(), _context, _rays);
+        CountRays(RayType::Shadow, _count);
+
+        for (size_t i = 0; i < _count; i++)
+            if (!(_rays.tfar[i] < distance[i])) // tfar is set to -inf if there is an occluder
+                _unoccluded += _contribution[i];
+
+        _count = 0;
+    }
+
+    RTCRay16 _rays;
+    std::array<RGB, kLanes> _contribution;
+    size_t _count = 0;
+    RGB _unoccluded = BLACK;
+    const Eigen::Vector3f& _origin;
+    RTCIntersectContext& _context;
+};
+
 }
\ No newline at end of file
@@ -0,0 +1,367 @@
+#include "lightsampler.hpp"
+#include "light.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "embree/embreesingleton.hpp"
+
+using namespace Eigen;
+
+namespace CT
+{
+// Largest float below one, keeps remapped sample values in [0, 1)
+constexpr float kOneMinusEpsilon = 0x1.fffffep-1F;
+
+static float SafeSqrt(float x)
+{
+    return std::sqrt(std::max(0.0F, x));
+}
+
+static float SafeACos(float x)
+{
+    return std::acos(std::clamp(x, -1.0F, 1.0F));
+}
+
+AliasTable::AliasTable(const std::vector<float>& weights) : _bins(weights.size())
+{
+    const size_t n = weights.size();
+    if (n == 0)
+        return;
+
+    double sum = 0.0;
+    for (const float w : weights)
+        sum += std::max(0.0F, w);
+
+    // Vose's method: pair each under-full bin with an over-full one
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> under, over;
+    for (size_t i = 0; i < n; i++)
+    {
+        const double p = sum > 0.0 ? std::max(0.0F, weights[i]) / sum : 1.0 / static_cast<double>(n);
+        _bins[i].pmf = static_cast<float>(p);
+        scaled[i] = p * static_cast<double>(n);
+        (scaled[i] < 1.0 ? under : over).push_back(static_cast<uint32_t>(i));
+    }
+
+    while (!under.empty() && !over.empty())
+    {
+        const uint32_t u = under.back();
+        const uint32_t o = over.back();
+        under.pop_back();
+        over.pop_back();
+
+        _bins[u].q     = static_cast<float>(scaled[u]);
+        _bins[u].alias = o;
+
+        scaled[o] -= 1.0 - scaled[u];
+        (scaled[o] < 1.0 ? under : over).push_back(o);
+    }
+
+    // Whatever is left is full up to rounding error
+    for (const uint32_t i : under) { _bins[i].q = 1.0F; _bins[i].alias = i; }
+    for (const uint32_t i : over)  { _bins[i].q = 1.0F; _bins[i].alias = i; }
+}
+
+std::optional<uint32_t> AliasTable::Sample(float u, float& pmf) const
+{
+    if (_bins.empty())
+        return std::nullopt;
+
+    const float scaled = u * static_cast<float>(_bins.size());
+    const auto offset  = std::min(static_cast<size_t>(scaled), _bins.size() - 1);
+    const float up     = std::min(scaled - static_cast<float>(offset), kOneMinusEpsilon);
+
+    const uint32_t index = up < _bins[offset].q ? static_cast<uint32_t>(offset) : _bins[offset].alias;
+    pmf = _bins[index].pmf;
+    if (pmf <= 0.0F)
+        return std::nullopt;
+    return index;
+}
+
+static float DirectionalPower(const DirectionalLight& light, float scene_radius)
+{
+    return Luminance(light.colour) * std::numbers::pi_v<float> * scene_radius * scene_radius;
+}
+
+static float PointPower(const PointLight& light)
+{
+    return Luminance(light.colour) * 4.0F * std::numbers::pi_v<float>;
+}
+
+static float AreaCuboidPower(const AreaLightCuboid& light)
+{
+    return Luminance(light.colour) * std::numbers::pi_v<float> * light.width * light.height;
+}
+
+PowerLightSampler::PowerLightSampler(const Lights& lights, float scene_radius)
+{
+    std::vector<float> power;
+    for (uint32_t i = 0; i < lights.directional.size(); i++)
+    {
+        _lights.push_back({ LightKind::Directional, i });
+        power.push_back(DirectionalPower(lights.directional[i], scene_radius));
+    }
+    for (uint32_t i = 0; i < lights.point.size(); i++)
+    {
+        _lights.push_back({ LightKind::Point, i });
+        power.push_back(PointPower(lights.point[i]));
+    }
+    for (uint32_t i = 0; i < lights.area_cuboid.size(); i++)
+    {
+        _lights.push_back({ LightKind::AreaCuboid, i });
+        power.push_back(AreaCuboidPower(lights.area_cuboid[i]));
+    }
+    _table = AliasTable(power);
+}
+
+std::optional<SampledLight> PowerLightSampler::Sample(const Vector3f& /*p*/, const Vector3f& /*n*/, float u) const
+{
+    float pmf = 0.0F;
+    const std::optional<uint32_t> index = _table.Sample(u, pmf);
+    if (!index)
+        return std::nullopt;
+    return SampledLight{ _lights[*index], pmf };
+}
+
+// Cosine of the difference of two angles, one if the difference would be negative
+static float CosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    return cos_a > cos_b ? 1.0F : cos_a * cos_b + sin_a * sin_b;
+}
+
+// Sine of the difference of two angles, zero if the difference would be negative
+static float SinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    return cos_a > cos_b ? 0.0F : sin_a * cos_b - cos_a * sin_b;
+}
+
+float LightBounds::Importance(const Vector3f& p, const Vector3f& n) const
+{
+    if (phi <= 0.0F)
+        return 0.0F;
+
+    // Distance to the bounds, clamped so points inside them do not blow up
+    const Vector3f pc = bounds.center();
+    const float d2    = std::max((p - pc).squaredNorm(), bounds.diagonal().norm() / 2.0F);
+
+    const Vector3f to_p = p - pc;
+    const Vector3f wi   = to_p.squaredNorm() > 0.0F ? to_p.normalized() : Vector3f::Zero();
+
+    float cos_theta_w = w.dot(wi);
+    if (two_sided)
+        cos_theta_w = std::abs(cos_theta_w);
+    const float sin_theta_w = SafeSqrt(1.0F - cos_theta_w * cos_theta_w);
+
+    // Angle subtended by the bounding sphere of the bounds
+    const float radius2 = bounds.diagonal().squaredNorm() / 4.0F;
+    const float cos_theta_b = to_p.squaredNorm() < radius2 ? -1.0F : SafeSqrt(1.0F - radius2 / to_p.squaredNorm());
+    const float sin_theta_b = SafeSqrt(1.0F - cos_theta_b * cos_theta_b);
+
+    // Smallest angle between the emitter normals and the direction to the point
+    const float sin_theta_o = SafeSqrt(1.0F - cos_theta_o * cos_theta_o);
+    const float cos_theta_x = CosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    const float sin_theta_x = SinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    const float cos_theta_p = CosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= cos_theta_e)
+        return 0.0F;
+
+    float importance = phi * cos_theta_p / d2;
+
+    // Cosine at the receiver
+    if (n.squaredNorm() > 0.0F)
+    {
+        const float cos_theta_i  = std::abs(wi.dot(n));
+        const float sin_theta_i  = SafeSqrt(1.0F - cos_theta_i * cos_theta_i);
+        importance *= CosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+
+    return std::max(importance, 0.0F);
+}
+
+LightBounds LightBounds::Union(const LightBounds& a, const LightBounds& b)
+{
+    if (a.phi <= 0.0F) return b;
+    if (b.phi <= 0.0F) return a;
+
+    LightBounds ret;
+    ret.bounds      = a.bounds.merged(b.bounds);
+    ret.phi         = a.phi + b.phi;
+    ret.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    ret.two_sided   = a.two_sided || b.two_sided;
+
+    // Smallest cone of normals containing both cones
+    const float theta_a = SafeACos(a.cos_theta_o);
+    const float theta_b = SafeACos(b.cos_theta_o);
+    const float theta_d = SafeACos(a.w.dot(b.w));
+    const float pi      = std::numbers::pi_v<float>;
+
+    if (std::min(theta_d + theta_b, pi) <= theta_a)
+    {
+        ret.w = a.w;
+        ret.cos_theta_o = a.cos_theta_o;
+        return ret;
+    }
+    if (std::min(theta_d + theta_a, pi) <= theta_b)
+    {
+        ret.w = b.w;
+        ret.cos_theta_o = b.cos_theta_o;
+        return ret;
+    }
+
+    const float theta_o = (theta_a + theta_d + theta_b) / 2.0F;
+    const Vector3f wr   = a.w.cross(b.w);
+    if (theta_o >= pi || wr.squaredNorm() == 0.0F)
+    {
+        ret.w = Vector3f::UnitZ();
+        ret.cos_theta_o = -1.0F;
+        return ret;
+    }
+
+    ret.w = AngleAxisf(theta_o - theta_a, wr.normalized()) * a.w;
+    ret.cos_theta_o = std::cos(theta_o);
+    return ret;
+}
+
+BVHLightSampler::BVHLightSampler(const Lights& lights)
+{
+    std::vector<std::pair<LightRef, LightBounds>> bounded;
+
+    for (uint32_t i = 0; i < lights.directional.size(); i++)
+        _infinite.push_back({ LightKind::Directional, i });
+
+    // Point lights emit in every direction
+    for (uint32_t i = 0; i < lights.point.size(); i++)
+    {
+        const PointLight& light = lights.point[i];
+        LightBounds lb;
+        lb.bounds      = AlignedBox3f(light.position, light.position);
+        lb.w           = Vector3f::UnitZ();
+        lb.phi         = PointPower(light);
+        lb.cos_theta_o = -1.0F;
+        lb.cos_theta_e = 0.0F;
+        if (lb.phi > 0.0F)
+            bounded.emplace_back(LightRef{ LightKind::Point, i }, lb);
+    }
+
+    // Area lights emit into the hemisphere about their normal, and are sampled across x and z
+    for (uint32_t i = 0; i < lights.area_cuboid.size(); i++)
+    {
+        const AreaLightCuboid& light = lights.area_cuboid[i];
+        const Vector3f half_extent(light.width * 0.5F, 0.0F, light.height * 0.5F);
+        LightBounds lb;
+        lb.bounds      = AlignedBox3f(light.position - half_extent, light.position + half_extent);
+        lb.w           = light.normal.normalized();
+        lb.phi         = AreaCuboidPower(light);
+        lb.cos_theta_o = 1.0F;
+        lb.cos_theta_e = 0.0F;
+        if (lb.phi > 0.0F)
+            bounded.emplace_back(LightRef{ LightKind::AreaCuboid, i }, lb);
+    }
+
+    if (!bounded.empty())
+    {
+        _nodes.reserve(2 * bounded.size() - 1);
+        Build(bounded, 0, bounded.size());
+    }
+}
+
+uint32_t BVHLightSampler::Build(std::vector<std::pair<LightRef, LightBounds>>& lights, size_t begin, size_t end)
+{
+    const auto index = static_cast<uint32_t>(_nodes.size());
+    _nodes.push_back({});
+
+    if (end - begin == 1)
+    {
+        _bounded.push_back(lights[begin].first);
+        _nodes[index] = { lights[begin].second, static_cast<uint32_t>(_bounded.size() - 1), true };
+        return index;
+    }
+
+    // Split at the median centroid along the widest axis of the centroids
+    AlignedBox3f centroids;
+    for (size_t i = begin; i < end; i++)
+        centroids.extend(lights[i].second.bounds.center());
+
+    Index axis = 0;
+    centroids.diagonal().maxCoeff(&axis);
+
+    const size_t mid = (begin + end) / 2;
+    std::nth_element(lights.begin() + static_cast<std::ptrdiff_t>(begin), lights.begin() + static_cast<std::ptrdiff_t>(mid), lights.begin() + static_cast<std::ptrdiff_t>(end),
+        [axis](const auto& a, const auto& b) { return a.second.bounds.center()[axis] < b.second.bounds.center()[axis]; });
+
+    const uint32_t first  = Build(lights, begin, mid);
+    const uint32_t second = Build(lights, mid, end);
+    _nodes[index] = { LightBounds::Union(_nodes[first].bounds, _nodes[second].bounds), second, false };
+    return index;
+}
+
+std::optional<SampledLight> BVHLightSampler::Sample(const Vector3f& p, const Vector3f& n, float u) const
+{
+    // Directional lights have no bounds, they share the probability evenly with the whole hierarchy
+    const float infinite = static_cast<float>(_infinite.size());
+    const float p_infinite = infinite / (infinite + (_nodes.empty() ? 0.0F : 1.0F));
+
+    if (u < p_infinite)
+    {
+        const auto index = std::min(static_cast<size_t>(u / p_infinite * infinite), _infinite.size() - 1);
+        return SampledLight{ _infinite[index], p_infinite / infinite };
+    }
+
+    if (_nodes.empty())
+        return std::nullopt;
+
+    u = std::min((u - p_infinite) / (1.0F - p_infinite), kOneMinusEpsilon);
+    float pmf = 1.0F - p_infinite;
+    uint32_t node = 0;
+
+    while (!_nodes[node].leaf)
+    {
+        // Descend towards the child that is expected to contribute most, reusing the remapped sample
+        const uint32_t first  = node + 1;
+        const uint32_t second = _nodes[node].child_or_light;
+        const float importance_first  = _nodes[first].bounds.Importance(p, n);
+        const float importance_second = _nodes[second].bounds.Importance(p, n);
+        if (importance_first <= 0.0F && importance_second <= 0.0F)
+            return std::nullopt;
+
+        const float p_first = importance_first / (importance_first + importance_second);
+        if (u < p_first)
+        {
+            node = first;
+            u    = std::min(u / p_first, kOneMinusEpsilon);
+            pmf *= p_first;
+        }
+        else
+        {
+            node = second;
+            u    = std::min((u - p_first) / (1.0F - p_first), kOneMinusEpsilon);
+            pmf *= 1.0F - p_first;
+        }
+    }
+
+    // A lone light at the root has not been tested yet
+    if (node == 0 && _nodes[node].bounds.Importance(p, n) <= 0.0F)
+        return std::nullopt;
+
+    return SampledLight{ _bounded[_nodes[node].child_or_light], pmf };
+}
+
+std::unique_ptr<LightSampler> MakeLightSampler(LightSamplerType type, const Lights& lights)
+{
+    switch (type)
+    {
+        case LightSamplerType::Power:
+        {
+            // Directional lights deliver their power over the disk covering the scene
+            RTCBounds scene_bounds;
+            rtcGetSceneBounds(EmbreeSingleton::GetInstance().scene, &scene_bounds);
+            const Vector3f extent(scene_bounds.upper_x - scene_bounds.lower_x, scene_bounds.upper_y - scene_bounds.lower_y, scene_bounds.upper_z - scene_bounds.lower_z);
+            return std::make_unique<PowerLightSampler>(lights, extent.norm() / 2.0F);
+        }
+        case LightSamplerType::BVH: return std::make_unique<BVHLightSampler>(lights);
+        default:                    return nullptr;
+    }
+}
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace CT
+{
+struct Lights;
+
+enum class LightKind : uint32_t
+{
+    Directional,
+    Point,
+    AreaCuboid
+};
+
+/// @brief Identifies one light of a Lights struct
+struct LightRef
+{
+    LightKind kind;
+    uint32_t index;
+};
+
+/// @brief A light chosen by a light sampler and the probability of choosing it
+struct SampledLight
+{
+    LightRef light;
+    float pmf;
+};
+
+/// @brief Chooses a single light per direct sample so the cost of a sample does not grow with the number of lights
+class LightSampler
+{
+public:
+    virtual ~LightSampler() = default;
+
+    /// @brief Choose a light for a shading point
+    /// @param p Shading point in world space
+    /// @param n Shading normal
+    /// @param u Uniform value in [0, 1)
+    /// @return Nothing if no light can illuminate the point
+    virtual std::optional<SampledLight> Sample(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float u) const = 0;
+};
+
+/// @brief Walker alias table, samples an index proportional to its weight in constant time
+class AliasTable
+{
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<float>& weights);
+
+    /// @brief Sample an index
+    /// @param u Uniform value in [0, 1)
+    /// @param pmf Probability of the returned index
+    /// @return
+    std::optional<uint32_t> Sample(float u, float& pmf) const;
+
+    size_t Size() const { return _bins.size(); }
+
+private:
+    struct Bin
+    {
+        float q;       // Probability of keeping the bin's own index
+        float pmf;     // Probability of sampling the bin's index
+        uint32_t alias;
+    };
+
+    std::vector<Bin> _bins;
+};
+
+/// @brief Chooses lights in proportion to their emitted power, independent of the shading point
+class PowerLightSampler : public LightSampler
+{
+public:
+    PowerLightSampler(const Lights& lights, float scene_radius);
+
+    std::optional<SampledLight> Sample(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float u) const override;
+
+private:
+    std::vector<LightRef> _lights;
+    AliasTable _table;
+};
+
+/// @brief Spatial and directional bounds of the emission of a set of lights
+struct LightBounds
+{
+    Eigen::AlignedBox3f bounds;
+    Eigen::Vector3f w;        // Axis of the cone of emitter normals
+    float phi         = 0.0F; // Emitted power
+    float cos_theta_o = 1.0F; // Spread of the normals about w
+    float cos_theta_e = 0.0F; // Spread of emission about each normal
+    bool two_sided    = false;
+
+    /// @brief Conservative estimate of the light arriving at a shading point from these bounds
+    /// @param p
+    /// @param n Shading normal, zero to ignore the cosine at the receiver
+    /// @return
+    float Importance(const Eigen::Vector3f& p, const Eigen::Vector3f& n) const;
+
+    /// @brief Bounds covering two sets of lights
+    static LightBounds Union(const LightBounds& a, const LightBounds& b);
+};
+
+/// @brief Hierarchy over the bounded lights, traversed towards the children that contribute most to a shading point.
+/// Directional lights cannot be bounded, they are chosen separately in proportion to their count.
+class BVHLightSampler : public LightSampler
+{
+public:
+    explicit BVHLightSampler(const Lights& lights);
+
+    std::optional<SampledLight> Sample(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float u) const override;
+
+private:
+    struct Node
+    {
+        LightBounds bounds;
+        uint32_t child_or_light; // Second child of an interior node, the first directly follows it
+        bool leaf;
+    };
+
+    uint32_t Build(std::vector<std::pair<LightRef, LightBounds>>& lights, size_t begin, size_t end);
+
+    std::vector<LightRef> _infinite;
+    std::vector<LightRef> _bounded;
+    std::vector<Node> _nodes;
+};
+
+enum class LightSamplerType
+{
+    All,
+    Power,
+    BVH
+};
+
+/// @brief Create the light sampler of a render
+/// @param type
+/// @param lights
+/// @return Nullptr for LightSamplerType::All, where every light is evaluated for each sample
+std::unique_ptr<LightSampler> MakeLightSampler(LightSamplerType type, const Lights& lights);
+}
@@ -0,0 +1,212 @@
+#include "meshcache.hpp"
+#include "transform.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <string_view>
+#include <system_error>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "utils/timer.hpp"
+
+namespace CT
+{
+constexpr std::array<char, 8> kMeshMagic = { 'C', 'T', 'M', 'E', 'S', 'H', '0', '1' };
+
+// Import options, part of the cache key
+constexpr float kSmoothingAngle     = 80.0F;
+constexpr unsigned int kImportFlags = aiProcess_GenSmoothNormals | aiProcess_FixInfacingNormals;
+
+// Sections start on cache lines, vertex arrays end with the padding Embree reads past the last vertex
+constexpr size_t kSectionAlignment = 64;
+constexpr size_t kVertexPadding    = 16;
+
+/// @brief Start of a mesh file, followed by one MeshEntry per mesh and then the mesh data
+struct alignas(64) MeshFileHeader
+{
+    std::array<char, 8> magic;
+    int64_t  mtime;       // Modification time of the OBJ
+    uint64_t source_size; // Size of the OBJ in bytes
+    uint64_t options;     // Hash of the import options and the transform
+    uint64_t meshes;
+};
+static_assert(sizeof(MeshFileHeader) == 64);
+
+/// @brief Counts and file offsets of the arrays of one mesh
+struct MeshEntry
+{
+    uint64_t vertices;
+    uint64_t faces;
+    uint64_t positions;
+    uint64_t normals;
+    uint64_t indices;
+};
+
+static size_t Align(size_t offset)
+{
+    return (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+}
+
+template<typename T>
+static std::string_view Bytes(const T& value)
+{
+    return { reinterpret_cast<const char*>(&value), sizeof(T) };
+}
+
+bool MeshFile::View(const uint8_t* data, size_t size, int64_t mtime, uint64_t source_size, uint64_t options)
+{
+    if (size < sizeof(MeshFileHeader))
+        return false;
+
+    const auto* header = reinterpret_cast<const MeshFileHeader*>(data);
+    if (header->magic != kMeshMagic || header->mtime != mtime || header->source_size != source_size || header->options != options ||
+        size < sizeof(MeshFileHeader) + header->meshes * sizeof(MeshEntry))
+        return false;
+
+    const auto* entries = reinterpret_cast<const MeshEntry*>(header + 1);
+    std::vector<MeshView> meshes;
+    for (size_t m = 0; m < header->meshes; m++)
+    {
+        const MeshEntry& entry = entries[m];
+        const uint64_t vertex_bytes = entry.vertices * 3 * sizeof(float) + kVertexPadding;
+        if (entry.positions + vertex_bytes > size || entry.normals + vertex_bytes > size || entry.indices + entry.faces * 3 * sizeof(uint32_t) > size)
+            return false;
+
+        meshes.push_back({ reinterpret_cast<const float*>(data + entry.positions), reinterpret_cast<const float*>(data + entry.normals),
+                           reinterpret_cast<const uint32_t*>(data + entry.indices), entry.vertices, entry.faces });
+    }
+
+    _meshes = std::move(meshes);
+    return true;
+}
+
+MeshFile MeshFile::Load(Assimp::Importer& importer, const std::filesystem::path& filename, const Eigen::Matrix3f& transformation, const Eigen::Vector3f& translation,
+                         const std::filesystem::path& cache_directory, CumTimer& read_file, CumTimer& transform_mesh)
+{
+    MeshFile file;
+
+    std::error_code error;
+    const std::filesystem::path source = std::filesystem::canonical(filename, error);
+    const int64_t mtime = error ? 0 : std::filesystem::last_write_time(source).time_since_epoch().count();
+    const uint64_t source_size = error ? 0 : std::filesystem::file_size(source);
+
+    uint64_t options = HashBytes(Bytes(kSmoothingAngle));
+    options = HashBytes(Bytes(kImportFlags), options);
+    options = HashBytes({ reinterpret_cast<const char*>(transformation.data()), 9 * sizeof(float) }, options);
+    options = HashBytes({ reinterpret_cast<const char*>(translation.data()),    3 * sizeof(float) }, options);
+
+    std::filesystem::path cache;
+    if (!cache_directory.empty() && !error)
+    {
+        std::ostringstream name;
+        name << source.stem().string() << "-" << std::hex << std::setw(16) << std::setfill('0') << HashBytes(source.string(), options) << ".ctmesh";
+        cache = cache_directory / name.str();
+
+        auto timer = read_file.IncreaseCum();
+        file._mapping = MappedFile(cache);
+        if (file._mapping && file.View(file._mapping.GetData(), file._mapping.GetSize(), mtime, source_size, options))
+            return file;
+        file._mapping = MappedFile();
+    }
+
+    const aiScene* s = nullptr;
+    {
+        auto timer = read_file.IncreaseCum();
+
+        importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, kSmoothingAngle);
+        s = importer.ReadFile(filename, kImportFlags);
+    }
+
+    assert(s != nullptr);
+    assert(s->mFlags ^ AI_SCENE_FLAGS_INCOMPLETE);
+    assert(s->mRootNode != nullptr);
+    assert(s->mNumMeshes > 0);
+
+    // Lay out the file: header, mesh entries, then the arrays of each mesh
+    std::vector<MeshEntry> entries(s->mNumMeshes);
+    size_t size = Align(sizeof(MeshFileHeader) + entries.size() * sizeof(MeshEntry));
+    for (size_t m = 0; m < s->mNumMeshes; m++)
+    {
+        const aiMesh* aimesh = s->mMeshes[m];
+        assert(aimesh != nullptr);
+
+        MeshEntry& entry = entries[m];
+        entry.vertices  = aimesh->mNumVertices;
+        entry.faces     = aimesh->mNumFaces;
+        entry.positions = size;
+        entry.normals   = size = Align(size + entry.vertices * 3 * sizeof(float) + kVertexPadding);
+        entry.indices   = size = Align(size + entry.vertices * 3 * sizeof(float) + kVertexPadding);
+        size = Align(size + entry.faces * 3 * sizeof(uint32_t));
+    }
+
+    std::vector<uint8_t> image(size, 0);
+
+    MeshFileHeader header {};
+    header.magic       = kMeshMagic;
+    header.mtime       = mtime;
+    header.source_size = source_size;
+    header.options     = options;
+    header.meshes      = entries.size();
+    std::memcpy(image.data(), &header, sizeof(header));
+    std::memcpy(image.data() + sizeof(header), entries.data(), entries.size() * sizeof(MeshEntry));
+
+    for (size_t m = 0; m < s->mNumMeshes; m++)
+    {
+        aiMesh* aimesh = s->mMeshes[m];
+        const MeshEntry& entry = entries[m];
+
+        {
+        auto timer = transform_mesh.IncreaseCum();
+        (*aimesh) *= transformation;
+        (*aimesh) += translation;
+        }
+
+        auto* positions = reinterpret_cast<float*>(image.data() + entry.positions);
+        auto* normals   = reinterpret_cast<float*>(image.data() + entry.normals);
+        for (size_t i = 0; i < aimesh->mNumVertices; i++)
+        {
+            positions[3 * i + 0] = aimesh->mVertices[i].x;
+            positions[3 * i + 1] = aimesh->mVertices[i].y;
+            positions[3 * i + 2] = aimesh->mVertices[i].z;
+            normals[3 * i + 0]   = aimesh->mNormals[i].x;
+            normals[3 * i + 1]   = aimesh->mNormals[i].y;
+            normals[3 * i + 2]   = aimesh->mNormals[i].z;
+        }
+
+        auto* indices = reinterpret_cast<uint32_t*>(image.data() + entry.indices);
+        for (size_t i = 0; i < aimesh->mNumFaces; i++)
+            for (size_t j = 0; j < aimesh->mFaces[i].mNumIndices; j++)
+                indices[3 * i + j] = aimesh->mFaces[i].mIndices[j];
+    }
+    importer.FreeScene();
+
+    const bool written = !cache.empty() && WriteFileAtomically(cache, [&image](std::ostream& out)
+    {
+        out.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+    });
+
+    if (written)
+    {
+        file._mapping = MappedFile(cache);
+        if (file._mapping && file.View(file._mapping.GetData(), file._mapping.GetSize(), mtime, source_size, options))
+            return file;
+        file._mapping = MappedFile();
+    }
+    else if (!cache.empty())
+        std::cerr << "Could not write the mesh cache " << cache << ", keeping " << filename << " in memory" << std::endl;
+
+    file._image = std::move(image);
+    const bool valid = file.View(file._image.data(), file._image.size(), mtime, source_size, options);
+    assert(valid);
+    (void)valid;
+    return file;
+}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "utils/mappedfile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <Eigen/Core>
+
+namespace Assimp { class Importer; }
+
+namespace CT
+{
+class CumTimer;
+
+/// @brief Triangle mesh laid out as Embree reads it. Vertex arrays are padded so Embree may read 16 bytes at the last vertex.
+struct MeshView
+{
+    const float* positions; // xyz per vertex
+    const float* normals;   // xyz per vertex, smoothed
+    const uint32_t* indices; // Three per face
+    size_t vertices;
+    size_t faces;
+};
+
+/// @brief Transformed meshes of an OBJ in a binary cache file, keyed by the OBJ, its modification time and size,
+/// the import options and the transform. The first load imports the OBJ through Assimp and writes the
+/// cache file, later loads map it, so the mesh data is never parsed or copied again.
+class MeshFile
+{
+public:
+    /// @brief Map the cached meshes of an OBJ, importing and caching them first if needed
+    /// @param importer Importer of the calling thread
+    /// @param filename OBJ file
+    /// @param transformation Applied to the vertices, and its inverse transpose to the normals
+    /// @param translation Applied to the vertices after the transformation
+    /// @param cache_directory Where mesh files are kept, importing every time if empty
+    /// @param read_file Time spent importing or mapping
+    /// @param transform_mesh Time spent transforming imported meshes
+    /// @return
+    static MeshFile Load(Assimp::Importer& importer, const std::filesystem::path& filename, const Eigen::Matrix3f& transformation, const Eigen::Vector3f& translation,
+                         const std::filesystem::path& cache_directory, CumTimer& read_file, CumTimer& transform_mesh);
+
+    /// @brief Meshes of the OBJ, valid as long as the file
+    const std::vector<MeshView>& GetMeshes() const { return _meshes; }
+
+private:
+    /// @brief Point the mesh views into a mesh file image
+    /// @return False if the image was not written for this version of the OBJ and these options
+    bool View(const uint8_t* data, size_t size, int64_t mtime, uint64_t source_size, uint64_t options);
+
+    MappedFile _mapping;
+    std::vector<uint8_t> _image; // Held in memory when no cache file could be written
+    std::vector<MeshView> _meshes;
+};
+}
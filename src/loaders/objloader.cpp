@@ -1,25 +1,147 @@
 #include "objloader.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <thread>
 
 #include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
 
 #include <Eigen/Core>
+#include <Eigen/LU>
 
 #include "embree/embreesingleton.hpp"
 #include "config/options.hpp"
 #include "bvh/bvh.hpp"
-#include "transform.hpp"
+#include "meshcache.hpp"
 #include "utils/timer.hpp"
 
 using namespace Eigen;
 
 namespace CT
 {
+/// @brief Objects placing the same OBJ, whose meshes are loaded once. An OBJ placed once is baked into world space
+/// and its geometries are attached to the scene directly. An OBJ placed several times is loaded untransformed into a
+/// prototype scene and every placement becomes an instance of it.
+struct MeshGroup
+{
+    std::vector<Object*> objects;
+    MeshFile file;
+    std::vector<RTCGeometry> geometries; // One per mesh of the file, waiting to be attached when baked
+    RTCScene prototype = nullptr;        // Holds the geometries when instanced
+
+    // Triangles of the custom BVH, one list per geometry when baked or per placement when instanced. The ID of the
+    // geometry or instance in the scene is set when it is attached.
+    std::vector<std::vector<BVHTriangle>> triangles;
+
+    bool Instanced() const { return objects.size() > 1; }
+};
+
+/// @brief Append the triangles of a mesh to a list of BVH triangles
+/// @param view
+/// @param positions World space positions of the vertices of the mesh
+/// @param geomID ID of the geometry, in the prototype scene if instanced
+/// @param triangles
+static void AppendTriangles(const MeshView& view, const float* positions, unsigned int geomID, std::vector<BVHTriangle>& triangles)
+{
+    const auto vertex = [&](size_t i, size_t j) { return Map<const Vector3f>(positions + 3 * view.indices[3 * i + j]); };
+    for (size_t i = 0; i < view.faces; i++)
+        triangles.push_back({ vertex(i, 0), vertex(i, 1), vertex(i, 2), geomID, static_cast<unsigned int>(i), RTC_INVALID_GEOMETRY_ID });
+}
+
+/// @brief Load the meshes of a group and build their Embree geometries, safe to run for several groups at once
+/// @param importer Importer of the calling thread
+/// @param group
+/// @param device
+/// @param cache_directory Where mesh files are kept
+/// @param gather_triangles Whether to gather the triangles of the custom BVH
+static void LoadGroup(Assimp::Importer& importer, MeshGroup& group, RTCDevice device, const std::filesystem::path& cache_directory, bool gather_triangles,
+                      CumTimer& read_file, CumTimer& transform_mesh, CumTimer& gather_bvh_triangles)
+{
+    const ConfigSingleton& config = ConfigSingleton::GetInstance();
+
+    const Object& first = *group.objects.front();
+    group.file = group.Instanced()
+        ? MeshFile::Load(importer, first.p_file, Matrix3f::Identity(), Vector3f::Zero(), cache_directory, read_file, transform_mesh)
+        : MeshFile::Load(importer, first.p_file, first.transformation, first.translation, cache_directory, read_file, transform_mesh);
+
+    if (group.Instanced())
+    {
+        group.prototype = rtcNewScene(device);
+        rtcSetSceneBuildQuality(group.prototype, config.scene_quality);
+    }
+
+    std::vector<unsigned int> prototype_ids;
+
+    for (const MeshView& view : group.file.GetMeshes())
+    {
+        // Embree mesh data, the buffers are shared with the mesh file and never copied
+        RTCGeometry mesh = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+        assert(mesh != nullptr);
+
+        rtcSetSharedGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, view.positions, 0, 3 * sizeof(float), view.vertices);
+        rtcSetSharedGeometryBuffer(mesh, RTC_BUFFER_TYPE_INDEX,  0, RTC_FORMAT_UINT3,  view.indices,   0, 3 * sizeof(unsigned int), view.faces);
+
+        // Vertex normals
+        rtcSetGeometryVertexAttributeCount(mesh, 1);
+        rtcSetSharedGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, view.normals, 0, 3 * sizeof(float), view.vertices);
+
+        rtcSetGeometryBuildQuality(mesh, config.geometry_quality);
+        rtcCommitGeometry(mesh);
+
+        if (group.Instanced())
+        {
+            // Prototype geometries are shared by every placement, so the material is looked up through the instance
+            prototype_ids.push_back(rtcAttachGeometry(group.prototype, mesh));
+            rtcReleaseGeometry(mesh);
+        }
+        else
+        {
+            rtcSetGeometryUserData(mesh, group.objects.front());
+            group.geometries.push_back(mesh);
+
+            if (gather_triangles)
+            {
+                auto timer = gather_bvh_triangles.IncreaseCum();
+                AppendTriangles(view, view.positions, RTC_INVALID_GEOMETRY_ID, group.triangles.emplace_back());
+            }
+        }
+    }
+
+    if (!group.Instanced())
+        return;
+
+    rtcCommitScene(group.prototype);
+
+    if (!gather_triangles)
+        return;
+
+    // The triangles of every placement are gathered in world space, the BVH has no instances
+    std::vector<float> positions;
+    for (const Object* object : group.objects)
+    {
+        std::vector<BVHTriangle>& triangles = group.triangles.emplace_back();
+        for (size_t m = 0; m < group.file.GetMeshes().size(); m++)
+        {
+            const MeshView& view = group.file.GetMeshes()[m];
+            {
+            auto timer = transform_mesh.IncreaseCum();
+            positions.resize(3 * view.vertices);
+            Map<Matrix3Xf>(positions.data(), 3, view.vertices) =
+                (object->transformation * Map<const Matrix3Xf>(view.positions, 3, view.vertices)).colwise() + object->translation;
+            }
+
+            auto timer = gather_bvh_triangles.IncreaseCum();
+            AppendTriangles(view, positions.data(), prototype_ids[m], triangles);
+        }
+    }
+}
+
 void ObjectLoader::LoadObjects(std::vector<Object>& objects)
 {
     Timer t = Timer("Load objects");
@@ -29,108 +151,132 @@ void ObjectLoader::LoadObjects(std::vector<Object>& objects)
     // Retrieve config singleton instance
     const ConfigSingleton& config = ConfigSingleton::GetInstance();
 
-    // OBJ Importer
-    Assimp::Importer importer;
-
     CumTimer read_file("read_file");
     CumTimer transform_mesh("transform_mesh");
-    CumTimer calculate_bvh_bounds("calculate_bvh_bounds");
+    CumTimer gather_bvh_triangles("gather_bvh_triangles");
 
-    for(auto& object : objects)
+    // Objects placing the same OBJ share one group, so every OBJ is read once
+    std::vector<MeshGroup> groups;
+    std::vector<size_t> group_of(objects.size());
     {
-        // Otherwise, load it and cache it
-        auto timer = read_file.IncreaseCum();
+        std::map<std::filesystem::path, size_t> group_of_file;
+        for (size_t o = 0; o < objects.size(); o++)
+        {
+            const auto [it, inserted] = group_of_file.try_emplace(objects[o].p_file.lexically_normal(), groups.size());
+            if (inserted)
+                groups.emplace_back();
+            groups[it->second].objects.push_back(&objects[o]);
+            group_of[o] = it->second;
+        }
+    }
+
+    // Groups are read, transformed and uploaded in parallel, each worker with its own importer
+    {
+        std::atomic<size_t> next = 0;
+        const auto worker = [&]()
+        {
+            Assimp::Importer importer;
+            for (size_t g = next++; g < groups.size(); g = next++)
+                LoadGroup(importer, groups[g], embree.device, config.mesh_cache, config.use_bvh, read_file, transform_mesh, gather_bvh_triangles);
+        };
+
+        const size_t threads = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()), groups.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; i++)
+            workers.emplace_back(worker);
+        worker();
+        for (std::thread& w : workers)
+            w.join();
+    }
 
-        // Load the mesh file and then cache it
-        importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0F);
-        const aiScene* s = importer.ReadFile(object.p_file, aiProcess_GenSmoothNormals | aiProcess_FixInfacingNormals);
+    // Geometries are attached in object order, so geometry IDs do not depend on which worker finished first
+    CumTimer attach_geometry("attach_geometry");
+    auto timer = attach_geometry.IncreaseCum();
 
-        assert(s != nullptr);
-        assert(s->mFlags ^ AI_SCENE_FLAGS_INCOMPLETE);
-        assert(s->mRootNode != nullptr);
+    size_t triangle_count = this->triangles.size();
+    for (const MeshGroup& group : groups)
+        for (const std::vector<BVHTriangle>& list : group.triangles)
+            triangle_count += list.size();
+    this->triangles.reserve(triangle_count);
 
-        for (size_t m = 0; m < s->mNumMeshes; m++)
+    const auto append_triangles = [this](const std::vector<BVHTriangle>& list, unsigned int BVHTriangle::* id, unsigned int value)
+    {
+        for (BVHTriangle triangle : list)
         {
-            // assimp mesh data
-            aiMesh* aimesh = s->mMeshes[m];
-            assert(s->mNumMeshes > 0);       
+            triangle.*id = value;
+            this->triangles.push_back(triangle);
+        }
+    };
 
-            assert(aimesh != nullptr);
+    std::vector<size_t> placed(groups.size(), 0);
+    size_t instanced = 0;
+    for (size_t o = 0; o < objects.size(); o++)
+    {
+        MeshGroup& group = groups[group_of[o]];
+        const size_t placement = placed[group_of[o]]++;
 
+        if (!group.Instanced())
+        {
+            for (size_t m = 0; m < group.geometries.size(); m++)
             {
-            auto timer = transform_mesh.IncreaseCum();        
-            (*aimesh) *= object.transformation;
-            (*aimesh) += object.translation;
-            }
-
-            // Embree mesh data
-            RTCGeometry mesh = rtcNewGeometry(embree.device, RTC_GEOMETRY_TYPE_TRIANGLE);
-            assert(mesh != nullptr);
+                const unsigned int geomID = rtcAttachGeometry(embree.scene, group.geometries[m]);
+                if (!group.triangles.empty())
+                    append_triangles(group.triangles[m], &BVHTriangle::geomID, geomID);
 
-            // Load vertex buffer
-            auto* vertex_buffer = static_cast<Vector3f*>(rtcSetNewGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, 3 * sizeof(float), aimesh->mNumVertices));
-            for (size_t i = 0; i < aimesh->mNumVertices; i++)
-                vertex_buffer[i] = Vector3f(aimesh->mVertices[i].x, aimesh->mVertices[i].y, aimesh->mVertices[i].z);
+                rtcReleaseGeometry(group.geometries[m]);
+            }
+            continue;
+        }
 
-            // Load index buffer
-            auto* index_buffer = static_cast<std::array<unsigned int, 3>*>(rtcSetNewGeometryBuffer(mesh, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(unsigned int), aimesh->mNumFaces));
-            for (size_t i = 0; i < aimesh->mNumFaces; i++)
-                for (size_t j = 0; j < aimesh->mFaces[i].mNumIndices; j++)
-                    index_buffer[i][j] = aimesh->mFaces[i].mIndices[j];
+        const Object& object = objects[o];
+        Instance& instance = *this->instances.emplace_back(std::make_unique<Instance>(Instance
+        {
+            .object                = &object,
+            .prototype             = group.prototype,
+            .normal_transformation = object.transformation.inverse().transpose()
+        }));
 
+        // Embree takes the 3x4 affine transform column by column, the translation last
+        std::array<float, 12> transform;
+        std::copy_n(object.transformation.data(), 9, transform.begin());
+        std::copy_n(object.translation.data(), 3, transform.begin() + 9);
 
-            // Load vertex normals into buffer
-            rtcSetGeometryVertexAttributeCount(mesh, 1);
-            auto* vertex_normal_buffer = static_cast<Vector3f*>(rtcSetNewGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, 3 * sizeof(float), aimesh->mNumVertices));
+        RTCGeometry geometry = rtcNewGeometry(embree.device, RTC_GEOMETRY_TYPE_INSTANCE);
+        assert(geometry != nullptr);
+        rtcSetGeometryInstancedScene(geometry, group.prototype);
+        rtcSetGeometryTransform(geometry, 0, RTC_FORMAT_FLOAT3X4_COLUMN_MAJOR, transform.data());
+        rtcSetGeometryUserData(geometry, &instance);
+        rtcCommitGeometry(geometry);
 
-            for (size_t i = 0; i < aimesh->mNumVertices; i++)
-                vertex_normal_buffer[i] = Vector3f(aimesh->mNormals[i].x, aimesh->mNormals[i].y, aimesh->mNormals[i].z);
+        const unsigned int geomID = rtcAttachGeometry(embree.scene, geometry);
+        if (!group.triangles.empty())
+            append_triangles(group.triangles[placement], &BVHTriangle::instID, geomID);
 
-            rtcSetGeometryBuildQuality(mesh, RTC_BUILD_QUALITY_LOW);
-            rtcCommitGeometry(mesh);
-            const unsigned int geomID = rtcAttachGeometry(embree.scene, mesh);
+        rtcReleaseGeometry(geometry);
+        instanced++;
+    }
 
-            for (size_t i = 0; i < aimesh->mNumFaces; i++)
-            {
-                auto timer = calculate_bvh_bounds.IncreaseCum();
-
-                RTCBuildPrimitive prim
-                {
-                    .lower_x = std::numeric_limits<float>::max(),
-                    .lower_y = std::numeric_limits<float>::max(),
-                    .lower_z = std::numeric_limits<float>::max(),
-                    .geomID  = geomID,
-                    .upper_x = std::numeric_limits<float>::min(),
-                    .upper_y = std::numeric_limits<float>::min(),
-                    .upper_z = std::numeric_limits<float>::min(),
-                    .primID  = static_cast<unsigned int>(i)
-                };
-
-                for (size_t j = 0; j < aimesh->mFaces[i].mNumIndices; j++)
-                {
-                    prim.lower_x = std::min(prim.lower_x, aimesh->mVertices[aimesh->mFaces[i].mIndices[j]].x);
-                    prim.lower_y = std::min(prim.lower_y, aimesh->mVertices[aimesh->mFaces[i].mIndices[j]].y);
-                    prim.lower_z = std::min(prim.lower_z, aimesh->mVertices[aimesh->mFaces[i].mIndices[j]].z);
-                    prim.upper_x = std::max(prim.upper_x, aimesh->mVertices[aimesh->mFaces[i].mIndices[j]].x);
-                    prim.upper_y = std::max(prim.upper_y, aimesh->mVertices[aimesh->mFaces[i].mIndices[j]].y);
-                    prim.upper_z = std::max(prim.upper_z, aimesh->mVertices[aimesh->mFaces[i].mIndices[j]].z);
-                }
-
-                this->prims.push_back(prim);
-            }
+    for (MeshGroup& group : groups)
+    {
+        // The instances keep the prototype scenes alive
+        if (group.prototype != nullptr)
+            rtcReleaseScene(group.prototype);
 
-            rtcSetGeometryUserData(mesh, &object);
-            rtcReleaseGeometry(mesh);
-    }
+        // The geometries read the mesh file for as long as the scene exists
+        mesh_files.push_back(std::move(group.file));
     }
 
+    rtcSetSceneBuildQuality(embree.scene, config.scene_quality);
     rtcCommitScene(embree.scene);
-    importer.FreeScene();
+
+    if (instanced > 0)
+        std::cout << "Placed " << instanced << " instances of " << std::count_if(groups.begin(), groups.end(), [](const MeshGroup& g) { return g.Instanced(); })
+                  << " shared meshes" << std::endl;
 }
 
-std::vector<RTCBuildPrimitive>& ObjectLoader::GetPrims()
+const std::vector<BVHTriangle>& ObjectLoader::GetTriangles() const
 {
-    assert(this->prims.size() > 0);
-    return this->prims;
+    assert(this->triangles.size() > 0);
+    return this->triangles;
 }
 }
\ No newline at end of file
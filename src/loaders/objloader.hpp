@@ -1,8 +1,11 @@
 #pragma once
 
+#include "bvh/bvh.hpp"
+#include "loaders/meshcache.hpp"
 #include "loaders/object.hpp"
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 #include <Eigen/Core>
@@ -10,15 +13,30 @@
 
 namespace CT
 {
+/// @brief Placement of a mesh that several objects share. Instance geometries carry one as user data, while the
+/// geometries of the prototype scene carry none, so the material of a hit always comes from its placement.
+struct Instance
+{
+    const Object* object;
+    RTCScene prototype; // Kept alive by the instance geometry
+    Eigen::Matrix3f normal_transformation; // Inverse transpose of the object transformation
+};
+
 class ObjectLoader
 {
 public:
     void LoadObjects(std::vector<Object>& objects);
-    std::vector<RTCBuildPrimitive>& GetPrims();
+    const std::vector<BVHTriangle>& GetTriangles() const;
 
 private:
-    // BVH prims data
-    std::vector<RTCBuildPrimitive> prims;
+    // Triangles of the custom BVH, in world space with every instance expanded
+    std::vector<BVHTriangle> triangles;
+
+    // Mesh data the Embree geometries read
+    std::vector<MeshFile> mesh_files;
+
+    // Placements of shared meshes, pointed to by the instance geometries
+    std::vector<std::unique_ptr<Instance>> instances;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "metrics.hpp"
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace CT
+{
+// Edge of the SSIM windows and its stabilising constants, for a dynamic range of 1
+constexpr size_t kWindowSize = 8;
+constexpr double kSSIMC1 = 0.01 * 0.01;
+constexpr double kSSIMC2 = 0.03 * 0.03;
+
+// Keeps relMSE finite where the reference is black
+constexpr float kRelativeEpsilon = 0.01F;
+
+// FLIP colour error: exponent applied to the HyAB distance, and the point at which the remapping flattens
+constexpr float kFLIPExponent   = 0.7F;
+constexpr float kFLIPCutoff     = 0.4F;
+constexpr float kFLIPCutoffTail = 0.95F;
+
+using RowRGBA = Eigen::Map<const Eigen::Array<float, 4, Eigen::Dynamic>>;
+using RowRGB  = Eigen::Map<const Eigen::Array<float, 3, Eigen::Dynamic>>;
+
+/// @brief Sums over the pixels of one region, merged into the sums of the image
+struct ErrorSums
+{
+    double reference = 0.0; // Channel averages
+    double image     = 0.0;
+    double absolute  = 0.0;
+    double squared   = 0.0;
+    double relative  = 0.0;
+    double flip      = 0.0;
+    double ssim      = 0.0;
+    size_t pixels    = 0;
+    size_t windows   = 0;
+
+    void Merge(const ErrorSums& other)
+    {
+        reference += other.reference;
+        image     += other.image;
+        absolute  += other.absolute;
+        squared   += other.squared;
+        relative  += other.relative;
+        flip      += other.flip;
+        ssim      += other.ssim;
+        pixels    += other.pixels;
+        windows   += other.windows;
+    }
+
+    ImageErrors Errors() const
+    {
+        const auto n = static_cast<double>(pixels);
+
+        ImageErrors errors;
+        errors.l1      = std::abs(reference - image) / n;
+        errors.mae     = absolute / (3.0 * n);
+        errors.l2      = squared  / (3.0 * n);
+        errors.rel_mse = relative / (3.0 * n);
+        errors.psnr    = errors.l2 > 0.0 ? -10.0 * std::log10(errors.l2) : std::numeric_limits<double>::infinity();
+        errors.ssim    = windows > 0 ? ssim / static_cast<double>(windows) : 1.0;
+        errors.flip    = flip / n;
+        return errors;
+    }
+};
+
+/// @brief Sums of the luminances of one SSIM window
+struct WindowSums
+{
+    double x  = 0.0;
+    double y  = 0.0;
+    double xx = 0.0;
+    double yy = 0.0;
+    double xy = 0.0;
+    size_t pixels = 0;
+
+    double SSIM() const
+    {
+        const auto n = static_cast<double>(pixels);
+        const double mx  = x / n;
+        const double my  = y / n;
+        const double vx  = std::max(0.0, xx / n - mx * mx);
+        const double vy  = std::max(0.0, yy / n - my * my);
+        const double cxy = xy / n - mx * my;
+        return ((2.0 * mx * my + kSSIMC1) * (2.0 * cxy + kSSIMC2)) / ((mx * mx + my * my + kSSIMC1) * (vx + vy + kSSIMC2));
+    }
+};
+
+/// @brief Reinhard tonemap, so the perceptual metrics see HDR values in [0, 1]
+static Eigen::Array3Xf Tonemap(const Eigen::Array3Xf& rgb)
+{
+    const Eigen::Array3Xf positive = rgb.max(0.0F);
+    return positive / (1.0F + positive);
+}
+
+/// @brief CIELAB of linear sRGB colours, one per column
+static Eigen::Array3Xf ToLab(const Eigen::Array3Xf& rgb)
+{
+    static const Eigen::Matrix3f kRGBToXYZ = (Eigen::Matrix3f() <<
+        0.4124564F, 0.3575761F, 0.1804375F,
+        0.2126729F, 0.7151522F, 0.0721750F,
+        0.0193339F, 0.1191920F, 0.9503041F).finished();
+    static const Eigen::Array3f kWhite(0.95047F, 1.0F, 1.08883F); // D65
+
+    constexpr float delta = 6.0F / 29.0F;
+    const Eigen::Array3Xf xyz = (kRGBToXYZ * rgb.matrix()).array().colwise() / kWhite;
+    const Eigen::Array3Xf f   = (xyz > delta * delta * delta).select(xyz.unaryExpr([](float t) { return std::cbrt(t); }), xyz / (3.0F * delta * delta) + 4.0F / 29.0F);
+
+    Eigen::Array3Xf lab(3, rgb.cols());
+    lab.row(0) = 116.0F * f.row(1) - 16.0F;
+    lab.row(1) = 500.0F * (f.row(0) - f.row(1));
+    lab.row(2) = 200.0F * (f.row(1) - f.row(2));
+    return lab;
+}
+
+/// @brief HyAB distance between CIELAB colours, one per column
+static Eigen::ArrayXf HyAB(const Eigen::Array3Xf& a, const Eigen::Array3Xf& b)
+{
+    const Eigen::Array3Xf d = a - b;
+    return (d.row(0).abs() + (d.row(1).square() + d.row(2).square()).sqrt()).transpose();
+}
+
+/// @brief Largest colour error FLIP expects, the distance between green and blue
+static float MaxColourError()
+{
+    Eigen::Array3Xf green(3, 1);
+    Eigen::Array3Xf blue(3, 1);
+    green << 0.0F, 1.0F, 0.0F;
+    blue  << 0.0F, 0.0F, 1.0F;
+    return std::pow(HyAB(ToLab(green), ToLab(blue))(0), kFLIPExponent);
+}
+
+static ErrorSums CompareTile(const float* reference, const float* image, size_t width, size_t x0, size_t y0, size_t x1, size_t y1)
+{
+    static const Eigen::Array3f kLuminance(0.2126F, 0.7152F, 0.0722F);
+    static const float kMaxColourError = MaxColourError();
+
+    const size_t n = x1 - x0;
+    ErrorSums sums;
+    std::vector<WindowSums> windows((n + kWindowSize - 1) / kWindowSize);
+
+    for (size_t y = y0; y < y1; y++)
+    {
+        const RowRGBA reference_row(reference + 4 * (y * width + x0), 4, static_cast<Eigen::Index>(n));
+        const RowRGB image_row(image + 3 * (y * width + x0), 3, static_cast<Eigen::Index>(n));
+        const Eigen::Array3Xf a = reference_row.topRows<3>();
+        const Eigen::Array3Xf b = image_row;
+        const Eigen::Array3Xf difference = a - b;
+
+        // Row sums stay short enough for single precision, they are accumulated in double
+        sums.reference += static_cast<double>(a.sum()) / 3.0;
+        sums.image     += static_cast<double>(b.sum()) / 3.0;
+        sums.absolute  += static_cast<double>(difference.abs().sum());
+        sums.squared   += static_cast<double>(difference.square().sum());
+        sums.relative  += static_cast<double>((difference.square() / (a.square() + kRelativeEpsilon)).sum());
+        sums.pixels    += n;
+
+        const Eigen::Array3Xf ta = Tonemap(a);
+        const Eigen::Array3Xf tb = Tonemap(b);
+
+        // Colour difference remapped as FLIP does, linearly up to the cutoff and compressed above it
+        const Eigen::ArrayXf colour = HyAB(ToLab(ta), ToLab(tb)).pow(kFLIPExponent);
+        const float cutoff = kFLIPCutoff * kMaxColourError;
+        const Eigen::ArrayXf flip = (colour < cutoff).select(colour * (kFLIPCutoffTail / cutoff),
+                                                             kFLIPCutoffTail + (colour - cutoff) / (kMaxColourError - cutoff) * (1.0F - kFLIPCutoffTail));
+        sums.flip += static_cast<double>(flip.min(1.0F).sum());
+
+        const Eigen::ArrayXf lx = (ta.colwise() * kLuminance).colwise().sum().transpose();
+        const Eigen::ArrayXf ly = (tb.colwise() * kLuminance).colwise().sum().transpose();
+        for (size_t w = 0; w < windows.size(); w++)
+        {
+            const auto begin  = static_cast<Eigen::Index>(w * kWindowSize);
+            const auto length = static_cast<Eigen::Index>(std::min(kWindowSize, n - w * kWindowSize));
+            const auto wx = lx.segment(begin, length);
+            const auto wy = ly.segment(begin, length);
+
+            WindowSums& window = windows[w];
+            window.x  += static_cast<double>(wx.sum());
+            window.y  += static_cast<double>(wy.sum());
+            window.xx += static_cast<double>(wx.square().sum());
+            window.yy += static_cast<double>(wy.square().sum());
+            window.xy += static_cast<double>((wx * wy).sum());
+            window.pixels += static_cast<size_t>(length);
+        }
+
+        // Close the row of windows every kWindowSize rows and at the bottom of the region
+        if ((y - y0 + 1) % kWindowSize == 0 || y + 1 == y1)
+        {
+            for (WindowSums& window : windows)
+            {
+                sums.ssim += window.SSIM();
+                sums.windows++;
+                window = {};
+            }
+        }
+    }
+
+    return sums;
+}
+
+ImageComparison CompareImages(const float* reference, const float* image, size_t width, size_t height, size_t threads, size_t tile_size)
+{
+    tile_size = std::max(kWindowSize, (tile_size + kWindowSize - 1) / kWindowSize * kWindowSize);
+
+    ImageComparison comparison;
+    ErrorMap& map = comparison.map;
+    map.tile_size = tile_size;
+    map.tiles_x   = (width  + tile_size - 1) / tile_size;
+    map.tiles_y   = (height + tile_size - 1) / tile_size;
+
+    // Regions are handed out one at a time, their sums land in their own slot so no thread waits on another
+    std::vector<ErrorSums> sums(map.tiles_x * map.tiles_y);
+    std::atomic<size_t> next = 0;
+    const auto worker = [&]()
+    {
+        for (size_t t = next++; t < sums.size(); t = next++)
+        {
+            const size_t x0 = (t % map.tiles_x) * tile_size;
+            const size_t y0 = (t / map.tiles_x) * tile_size;
+            sums[t] = CompareTile(reference, image, width, x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(std::max<size_t>(threads, 1), sums.size()); i++)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread& w : workers)
+        w.join();
+
+    ErrorSums total;
+    map.tiles.reserve(sums.size());
+    for (const ErrorSums& s : sums)
+    {
+        map.tiles.push_back(s.Errors());
+        total.Merge(s);
+    }
+    comparison.image = total.Errors();
+
+    return comparison;
+}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace CT
+{
+// Edge of the square regions of the error maps, a multiple of the SSIM window
+constexpr size_t kMetricsTileSize = 32;
+
+/// @brief Errors of an image against a reference. Every mean is accumulated in double precision.
+struct ImageErrors
+{
+    double l1      = 0.0; // Absolute difference of the mean channel averages, the measure the tuning data has always recorded
+    double mae     = 0.0; // Mean absolute error over the colour channels
+    double l2      = 0.0; // Mean squared error over the colour channels
+    double rel_mse = 0.0; // Mean squared error relative to the squared reference, so dark regions weigh as much as bright ones
+    double psnr    = 0.0; // Peak signal to noise ratio in dB for a peak of 1, infinite for identical images
+    double ssim    = 1.0; // Mean structural similarity of the tonemapped luminance over 8x8 windows
+    double flip    = 0.0; // Mean perceived colour difference in [0, 1], following the colour pipeline of FLIP
+};
+
+/// @brief Errors of the square regions of an image, row by row
+struct ErrorMap
+{
+    size_t tile_size = kMetricsTileSize;
+    size_t tiles_x   = 0;
+    size_t tiles_y   = 0;
+    std::vector<ImageErrors> tiles;
+
+    const ImageErrors& operator()(size_t x, size_t y) const { return tiles[y * tiles_x + x]; }
+};
+
+/// @brief Errors of a whole image and of each of its regions
+struct ImageComparison
+{
+    ImageErrors image;
+    ErrorMap map;
+};
+
+/// @brief Compare an image against a reference. Regions are compared in parallel, each with vectorised row operations.
+/// @param reference RGBA, as loaded by tinyexr
+/// @param image RGB, as held by a film
+/// @param width
+/// @param height
+/// @param threads
+/// @param tile_size Edge of the regions of the error map, rounded up to a multiple of 8
+/// @return
+ImageComparison CompareImages(const float* reference, const float* image, size_t width, size_t height, size_t threads, size_t tile_size = kMetricsTileSize);
+}
@@ -0,0 +1,232 @@
+#include "costmodel.hpp"
+#include "renderer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "camera/camera.hpp"
+#include "camera/film.hpp"
+#include "config/options.hpp"
+
+namespace CT
+{
+// Calibration renders trace one pixel per kCalibrationStride x kCalibrationStride block of the film, spread evenly over the image
+constexpr size_t kCalibrationStride = 8;
+constexpr size_t kCalibrationMinSize = 16;
+
+// Hemisphere and direct samples of the calibration renders that separate the path rates
+constexpr size_t kCalibrationSamples = 4;
+
+/// @brief Rays traced and time taken by one calibration render
+struct CalibrationRun
+{
+    RenderParameters parameters;
+    RayCounts rays;
+    double seconds;
+};
+
+static CalibrationRun RunCalibration(const RenderParameters& parameters, Renderer& renderer, Camera& camera, size_t threads, size_t width, size_t height)
+{
+    ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    cs.samples_per_pixel = parameters.samples_per_pixel;
+    cs.direct_samples    = parameters.direct_samples;
+    cs.indirect_samples  = parameters.indirect_samples;
+    cs.recursion_depth   = parameters.recursion_depth;
+
+    Film film(width, height, Eigen::Vector2i(cs.canvas_width, cs.canvas_height));
+
+    CalibrationRun run { parameters, {}, 0.0 };
+    for (size_t t = 0; t < run.rays.size(); t++)
+        run.rays[t] = -static_cast<double>(GetRayCount(static_cast<RayType>(t)));
+
+    const auto start = std::chrono::steady_clock::now();
+    renderer.RenderFilm(film, camera, threads);
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t t = 0; t < run.rays.size(); t++)
+        run.rays[t] += static_cast<double>(GetRayCount(static_cast<RayType>(t)));
+    return run;
+}
+
+/// @brief Least squares fit of y = X c with c >= 0, by coordinate descent on the normal equations
+/// @param rows Rows of X
+/// @param y
+/// @return c
+template<size_t N>
+static std::array<double, N> FitNonNegative(const std::vector<std::array<double, N>>& rows, const std::vector<double>& y)
+{
+    // Columns are scaled to a unit maximum so the costs of rare and frequent rays converge alike
+    std::array<double, N> scale {};
+    for (const auto& row : rows)
+        for (size_t j = 0; j < N; j++)
+            scale[j] = std::max(scale[j], row[j]);
+
+    std::array<std::array<double, N>, N> xtx {};
+    std::array<double, N> xty {};
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        for (size_t j = 0; j < N; j++)
+        {
+            const double xj = scale[j] > 0.0 ? rows[r][j] / scale[j] : 0.0;
+            xty[j] += xj * y[r];
+            for (size_t k = 0; k < N; k++)
+                xtx[j][k] += xj * (scale[k] > 0.0 ? rows[r][k] / scale[k] : 0.0);
+        }
+    }
+
+    std::array<double, N> c {};
+    for (size_t iteration = 0; iteration < 1000; iteration++)
+    {
+        for (size_t j = 0; j < N; j++)
+        {
+            if (xtx[j][j] <= 0.0)
+                continue;
+            double residual = xty[j];
+            for (size_t k = 0; k < N; k++)
+                if (k != j)
+                    residual -= xtx[j][k] * c[k];
+            c[j] = std::max(0.0, residual / xtx[j][j]);
+        }
+    }
+
+    for (size_t j = 0; j < N; j++)
+        c[j] = scale[j] > 0.0 ? c[j] / scale[j] : 0.0;
+    return c;
+}
+
+CostModel CostModel::Calibrate(Renderer& renderer, Camera& camera, size_t threads)
+{
+    ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    const RenderParameters saved { cs.samples_per_pixel, cs.direct_samples, cs.indirect_samples, cs.recursion_depth };
+    const float saved_budget = cs.time_budget;
+    const float saved_error  = cs.adaptive_error;
+    cs.time_budget    = 0.0F;
+    cs.adaptive_error = 0.0F;
+
+    const size_t width  = std::max(cs.image_width  / kCalibrationStride, kCalibrationMinSize);
+    const size_t height = std::max(cs.image_height / kCalibrationStride, kCalibrationMinSize);
+    std::cout << "Calibrating the cost model on a " << width << "x" << height << " film" << std::endl;
+
+    // Warm up the caches and the workers, this run is not measured
+    RunCalibration({ 1, 1, 1, 1 }, renderer, camera, threads, width, height);
+
+    // The first three runs isolate the path rates, the rest add variety to the fit of the ray costs
+    constexpr size_t S = kCalibrationSamples;
+    const std::vector<RenderParameters> configurations = {
+        { 1, S, S, 0 },
+        { 1, 1, S, 1 },
+        { 1, 1, 1, 1 },
+        { 2, 1, 1, 0 },
+        { 1, 2 * S, 1, 0 },
+        { 1, 1, 2 * S, 1 },
+        { 1, 2, S, 2 },
+    };
+
+    std::vector<CalibrationRun> runs;
+    for (const RenderParameters& parameters : configurations)
+        runs.push_back(RunCalibration(parameters, renderer, camera, threads, width, height));
+
+    cs.samples_per_pixel = saved.samples_per_pixel;
+    cs.direct_samples    = saved.direct_samples;
+    cs.indirect_samples  = saved.indirect_samples;
+    cs.recursion_depth   = saved.recursion_depth;
+    cs.time_budget       = saved_budget;
+    cs.adaptive_error    = saved_error;
+
+    const auto rays = [](const CalibrationRun& run, RayType type) { return run.rays[static_cast<size_t>(type)]; };
+    const auto ratio = [](double a, double b) { return b > 0.0 ? a / b : 0.0; };
+
+    CostModel model;
+
+    // Without recursion every shading point casts exactly S hemisphere rays and S direct samples.
+    // Calibration renders take one sample per pixel, so shading points at depth 0 are the primary hits.
+    const CalibrationRun& flat = runs[0];
+    const double flat_points = rays(flat, RayType::Hemisphere) / S;
+    model._primary_hit      = ratio(flat_points, rays(flat, RayType::Primary));
+    model._shadow_per_light = ratio(rays(flat, RayType::Shadow), flat_points * S);
+
+    // With one recursion the reflection rays per shading point grow with the hemisphere samples, the rest are mirror rays
+    const CalibrationRun& wide   = runs[1];
+    const CalibrationRun& narrow = runs[2];
+    const double wide_points   = model._primary_hit * rays(wide, RayType::Primary);
+    const double narrow_points = model._primary_hit * rays(narrow, RayType::Primary);
+    const double wide_reflections   = ratio(rays(wide, RayType::Reflection), wide_points);
+    const double narrow_reflections = ratio(rays(narrow, RayType::Reflection), narrow_points);
+    model._hemisphere_hit = std::max(0.0, (wide_reflections - narrow_reflections) / (S - 1));
+    model._mirror         = std::max(0.0, narrow_reflections - model._hemisphere_hit);
+
+    // Shading points at depth 1 cast one hemisphere ray each
+    const double second_points = std::max(0.0, rays(wide, RayType::Hemisphere) - wide_points * S);
+    model._reflection_hit = ratio(second_points, rays(wide, RayType::Reflection));
+
+    std::vector<std::array<double, static_cast<size_t>(RayType::Count) + 1>> rows;
+    std::vector<double> seconds;
+    for (const CalibrationRun& run : runs)
+    {
+        std::array<double, static_cast<size_t>(RayType::Count) + 1> row;
+        std::copy(run.rays.begin(), run.rays.end(), row.begin());
+        row.back() = 1.0;
+        rows.push_back(row);
+        seconds.push_back(run.seconds);
+    }
+
+    const auto costs = FitNonNegative(rows, seconds);
+    std::copy(costs.begin(), costs.end() - 1, model._seconds_per_ray.begin());
+    model._overhead = costs.back();
+
+    return model;
+}
+
+RayCounts CostModel::PredictRays(const RenderParameters& parameters) const
+{
+    RayCounts rays {};
+    const auto add = [&rays](RayType type, double n) { rays[static_cast<size_t>(type)] += n; };
+
+    // Primary hits are traced once and shaded samples_per_pixel times
+    add(RayType::Primary, 1.0);
+
+    // Walk the path tree one depth at a time, the root casts indirect_samples hemisphere rays and deeper points one
+    double points = static_cast<double>(parameters.samples_per_pixel) * _primary_hit;
+    for (size_t depth = 0; depth <= parameters.recursion_depth; depth++)
+    {
+        const double hemisphere = depth == 0 ? static_cast<double>(parameters.indirect_samples) : 1.0;
+        add(RayType::Shadow, points * static_cast<double>(parameters.direct_samples) * _shadow_per_light);
+        add(RayType::Hemisphere, points * hemisphere);
+
+        if (depth == parameters.recursion_depth)
+            break;
+
+        const double reflections = points * (hemisphere * _hemisphere_hit + _mirror);
+        add(RayType::Reflection, reflections);
+        points = reflections * _reflection_hit;
+    }
+
+    return rays;
+}
+
+double CostModel::PredictSeconds(const RenderParameters& parameters, size_t width, size_t height) const
+{
+    const RayCounts rays = PredictRays(parameters);
+    const auto pixels = static_cast<double>(width * height);
+
+    double seconds = _overhead;
+    for (size_t t = 0; t < rays.size(); t++)
+        seconds += rays[t] * pixels * _seconds_per_ray[t];
+    return seconds;
+}
+
+void CostModel::Print() const
+{
+    static constexpr std::array<const char*, static_cast<size_t>(RayType::Count)> kNames = { "primary", "hemisphere", "reflection", "shadow" };
+
+    std::cout << "Cost model: " << _primary_hit << " hits per primary ray, " << _shadow_per_light << " shadow rays per direct sample, "
+              << _hemisphere_hit << " reflections per hemisphere ray, " << _mirror << " mirror rays per hit, "
+              << _reflection_hit << " hits per reflection ray" << std::endl;
+    for (size_t t = 0; t < kNames.size(); t++)
+        std::cout << "Cost model: " << std::setw(10) << kNames[t] << " rays take " << _seconds_per_ray[t] * 1e9 << " ns" << std::endl;
+    std::cout << "Cost model: " << _overhead * 1e3 << " ms per render" << std::endl;
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "utils/raystats.hpp"
+
+namespace CT
+{
+class Camera;
+class Renderer;
+
+/// @brief Sampling parameters of a render, the ones the cost model predicts for
+struct RenderParameters
+{
+    size_t samples_per_pixel;
+    size_t direct_samples;
+    size_t indirect_samples;
+    size_t recursion_depth;
+};
+
+using RayCounts = std::array<double, static_cast<size_t>(RayType::Count)>;
+
+/// @brief Predicts the time RenderFilm takes from the sampling parameters, without rendering.
+/// The rays a pixel traces follow from the shape of the path tree: how often primary rays hit, how many shadow rays a
+/// direct sample casts, and how often hemisphere and reflection rays continue the path. Those rates and the time of
+/// each ray category are measured once, on a few renders of a downscaled film.
+class CostModel
+{
+public:
+    /// @brief Measure the path rates and ray costs of the loaded scene.
+    /// The configuration is restored afterwards.
+    /// @param renderer The renderer the predicted renders will use, the ray costs differ between renderers
+    /// @param camera
+    /// @param threads
+    /// @return
+    static CostModel Calibrate(Renderer& renderer, Camera& camera, size_t threads);
+
+    /// @brief Rays each pixel is expected to trace
+    /// @param parameters
+    /// @return Rays per category
+    RayCounts PredictRays(const RenderParameters& parameters) const;
+
+    /// @brief Expected duration of RenderFilm
+    /// @param parameters
+    /// @param width Film width
+    /// @param height Film height
+    /// @return Seconds
+    double PredictSeconds(const RenderParameters& parameters, size_t width, size_t height) const;
+
+    void Print() const;
+
+private:
+    // Path rates
+    double _primary_hit       = 0.0; // Shading points per primary ray
+    double _shadow_per_light  = 0.0; // Shadow rays per direct sample
+    double _hemisphere_hit    = 0.0; // Reflection rays per hemisphere ray
+    double _mirror            = 0.0; // Mirror reflection rays per shading point
+    double _reflection_hit    = 0.0; // Shading points per reflection ray
+
+    // Costs, seconds per ray of each category and per render
+    RayCounts _seconds_per_ray {};
+    double _overhead = 0.0;
+};
+}
@@ -0,0 +1,61 @@
+#include "renderer.hpp"
+#include "threadpool.hpp"
+#include "workstealing.hpp"
+
+#include <cassert>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "camera/film.hpp"
+#include "config/options.hpp"
+
+namespace CT
+{
+Renderer::Renderer() = default;
+Renderer::~Renderer() = default;
+
+void Renderer::ForEachCanvas(Film& film, size_t threads, const std::function<void(size_t)>& render_canvas)
+{
+    const ConfigSingleton& cs = ConfigSingleton::GetInstance();
+
+    const std::function<void(size_t)> render = [&](size_t i)
+    {
+        render_canvas(i);
+        if (on_canvas_complete)
+            on_canvas_complete(i);
+    };
+
+    if (cs.legacy_pool)
+    {
+        ThreadPool pool(threads);               // Create a thread pool
+        std::vector<std::future<void>> futures; // Create a vector of futures
+        futures.reserve(film.canvases.size());  // Reserve space for the futures
+
+        for (size_t i = 0; i < film.canvases.size(); i++) // Enqueue the task for each canvas
+            futures.emplace_back(pool.enqueue(render, i));
+
+        for (auto& future : futures)
+            future.get();
+        return;
+    }
+
+    // Canvases are created row by row, the first row is the one touching the top of the film
+    size_t columns = 0;
+    while (columns < film.canvases.size() && film.canvases[columns].rect.uly == 0)
+        columns++;
+    const size_t rows = columns > 0 ? film.canvases.size() / columns : 0;
+
+    const std::vector<size_t> order = HilbertTileOrder(columns, rows);
+    assert(order.size() == film.canvases.size());
+
+    if (!_scheduler || _scheduler->GetThreadCount() != threads)
+        _scheduler = std::make_unique<WorkStealingScheduler>(threads);
+
+    _scheduler->ParallelFor(order.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            render(order[i]);
+    });
+}
+}
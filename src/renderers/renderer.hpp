@@ -1,17 +1,38 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
+#include <memory>
 
 namespace CT
 {
 class Film;
 class Camera;
+class WorkStealingScheduler;
 
 class Renderer
 {
 public:
-    virtual ~Renderer() = default;
+    Renderer();
+    virtual ~Renderer();
 
     virtual void RenderFilm(Film& film, Camera& camera, size_t threads) = 0;
+
+    /// @brief Called from the render threads with the index of each canvas as it completes, e.g. to denoise finished
+    /// regions of the film while the rest renders. Called once per pass when rendering progressively.
+    std::function<void(size_t)> on_canvas_complete;
+
+protected:
+    /// @brief Render every canvas of a film in parallel and wait for them to complete.
+    /// Canvases are scheduled in Hilbert order by the work stealing scheduler, or one task per canvas
+    /// on the legacy thread pool if requested.
+    /// @param film
+    /// @param threads
+    /// @param render_canvas Called with the index of each canvas
+    void ForEachCanvas(Film& film, size_t threads, const std::function<void(size_t)>& render_canvas);
+
+private:
+    // Workers outlive the film so repeated renders with one renderer, as in the server or the tuner, do not respawn them
+    std::unique_ptr<WorkStealingScheduler> _scheduler;
 };
-}
\ No newline at end of file
+}
@@ -0,0 +1,199 @@
+#include "shading.hpp"
+
+#include "embree/embreesingleton.hpp"
+#include "loaders/object.hpp"
+#include "loaders/objloader.hpp"
+#include "utils/utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numbers>
+
+using namespace Eigen;
+
+namespace CT
+{
+// Lowest survival probability russian roulette assigns a path
+constexpr float kMinSurvivalProbability = 0.05F;
+
+// Keeps dark pixels from demanding samples for noise that is invisible in the image
+constexpr float kRelativeErrorFloor = 0.01F;
+
+void PixelEstimate::Add(const RGB& sample)
+{
+    sum += sample;
+    samples++;
+
+    const float l     = Luminance(sample);
+    const float delta = l - mean;
+    mean += delta / static_cast<float>(samples);
+    m2   += delta * (l - mean);
+}
+
+RGB PixelEstimate::Colour() const
+{
+    return samples > 0 ? sum / static_cast<float>(samples) : BLACK;
+}
+
+float PixelEstimate::RelativeError() const
+{
+    if (samples < 2)
+        return std::numeric_limits<float>::infinity();
+
+    const auto n = static_cast<float>(samples);
+    const float variance = m2 / (n - 1.0F);
+    return std::sqrt(variance / n) / (mean + kRelativeErrorFloor);
+}
+
+void DrawColourToCanvas(Canvas::PixelRef& pixel_ref, const RGB& colour)
+{
+    pixel_ref.r = std::clamp(colour.r, 0.0F, 1.0F);
+    pixel_ref.g = std::clamp(colour.g, 0.0F, 1.0F);
+    pixel_ref.b = std::clamp(colour.b, 0.0F, 1.0F);
+}
+
+void DrawFeaturesToCanvas(Canvas& canvas, size_t x, size_t y, const HitSurface& surface, const RTCHit& hit)
+{
+    const RGB& kd = surface.object->material->kd;
+    auto albedo = canvas.Albedo(x, y);
+    albedo.r = std::clamp(kd.r, 0.0F, 1.0F);
+    albedo.g = std::clamp(kd.g, 0.0F, 1.0F);
+    albedo.b = std::clamp(kd.b, 0.0F, 1.0F);
+
+    const Vector3f n = InterpolateNormals(surface, hit);
+    auto normal = canvas.Normal(x, y);
+    normal.r = n.x();
+    normal.g = n.y();
+    normal.b = n.z();
+}
+
+Vector2i FilmPixel(const Canvas& canvas, size_t x, size_t y)
+{
+    return { static_cast<int>(x + canvas.rect.ulx), static_cast<int>(y + canvas.rect.uly) };
+}
+
+RTCRayHit ExtractRayHit(const RTCRayHit16& packet, size_t lane)
+{
+    RTCRayHit ret;
+    ret.ray.org_x  = packet.ray.org_x[lane];
+    ret.ray.org_y  = packet.ray.org_y[lane];
+    ret.ray.org_z  = packet.ray.org_z[lane];
+    ret.ray.tnear  = packet.ray.tnear[lane];
+    ret.ray.dir_x  = packet.ray.dir_x[lane];
+    ret.ray.dir_y  = packet.ray.dir_y[lane];
+    ret.ray.dir_z  = packet.ray.dir_z[lane];
+    ret.ray.time   = packet.ray.time[lane];
+    ret.ray.tfar   = packet.ray.tfar[lane];
+    ret.ray.mask   = packet.ray.mask[lane];
+    ret.ray.id     = packet.ray.id[lane];
+    ret.ray.flags  = packet.ray.flags[lane];
+    ret.hit.Ng_x   = packet.hit.Ng_x[lane];
+    ret.hit.Ng_y   = packet.hit.Ng_y[lane];
+    ret.hit.Ng_z   = packet.hit.Ng_z[lane];
+    ret.hit.u      = packet.hit.u[lane];
+    ret.hit.v      = packet.hit.v[lane];
+    ret.hit.primID = packet.hit.primID[lane];
+    ret.hit.geomID = packet.hit.geomID[lane];
+    ret.hit.instID[0] = packet.hit.instID[0][lane];
+    return ret;
+}
+
+HitSurface ResolveHit(const RTCHit& hit)
+{
+    const RTCScene scene = EmbreeSingleton::GetInstance().scene;
+    if (hit.instID[0] == RTC_INVALID_GEOMETRY_ID)
+    {
+        const RTCGeometry geometry = rtcGetGeometry(scene, hit.geomID);
+        return { geometry, static_cast<const Object*>(rtcGetGeometryUserData(geometry)), nullptr };
+    }
+
+    // geomID names the geometry within the prototype scene of the instance
+    const auto* instance = static_cast<const Instance*>(rtcGetGeometryUserData(rtcGetGeometry(scene, hit.instID[0])));
+    return { rtcGetGeometry(instance->prototype, hit.geomID), instance->object, &instance->normal_transformation };
+}
+
+Vector3f InterpolateNormals(const HitSurface& surface, const RTCHit& hit)
+{
+    // Interpolate normals
+    std::array<float, 3> interp_P;
+    rtcInterpolate0(surface.geometry, hit.primID, hit.u, hit.v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, interp_P.data(), interp_P.size());
+    Vector3f hit_normal(interp_P[0], interp_P[1], interp_P[2]);
+    if (surface.normal_transformation != nullptr)
+        hit_normal = *surface.normal_transformation * hit_normal;
+    hit_normal.normalize();
+    return hit_normal;
+}
+
+CWHData SampleCosineWeightedHemisphere(const Vector3f& n, const Vector2f& u)
+{
+    // Project a point on the unit disk up onto the hemisphere (Malley's method)
+    double disk_x = 0.0;
+    double disk_y = 0.0;
+    ToUnitDisk(u.x(), u.y(), &disk_x, &disk_y);
+    const auto x = static_cast<float>(disk_x);
+    const auto y = static_cast<float>(disk_y);
+
+    Vector3f hemisphere_dir
+    {
+        x,
+        y,
+        std::sqrt(std::max(1e-6F, 1.0F - x * x - y * y))
+    };
+
+    Vector3f u_basis;
+    if (std::abs(n.x()) > std::abs(n.y()))
+    {
+        float ilen = 1.0F / sqrtf(n.x() * n.x() + n.z() * n.z());
+        u_basis = Vector3f(-n.z() * ilen, 0, n.x() * ilen);
+    }
+    else
+    {
+        float ilen = 1.0F / sqrtf(n.y() * n.y() + n.z() * n.z());
+        u_basis = Vector3f(0, n.z() * ilen, -n.y() * ilen);
+    }
+    Vector3f v_basis = n.cross(u_basis);
+    u_basis = n.cross(v_basis);
+
+    Vector3f retdir = Vector3f(
+        hemisphere_dir.x() * u_basis.x() + hemisphere_dir.y() * v_basis.x() + hemisphere_dir.z() * n.x(),
+        hemisphere_dir.x() * u_basis.y() + hemisphere_dir.y() * v_basis.y() + hemisphere_dir.z() * n.y(),
+        hemisphere_dir.x() * u_basis.z() + hemisphere_dir.y() * v_basis.z() + hemisphere_dir.z() * n.z());
+
+    CWHData ret
+    {
+        .dir = retdir,
+        .pdf = hemisphere_dir.z() / std::numbers::pi_v<float>
+    };
+
+    assert(ret.pdf > 0.0F && ret.pdf <= 1.0F);
+    assert(ret.dir.norm() > 0.0F);
+
+    return { ret };
+}
+
+Vector3f SampleJitter(SampleStream& samples)
+{
+    const float x = samples.Next1D();
+    const float y = samples.Next1D();
+    const float z = samples.Next1D();
+    return Vector3f(x, y, z) * 2.0F - Vector3f::Ones();
+}
+
+Vector3f Reflect(const Vector3f& dir, const Vector3f& n)
+{
+    return (dir - 2.0F * n * n.dot(dir)).normalized();
+}
+
+float SurvivalProbability(const RGB& throughput)
+{
+    return std::clamp(Luminance(throughput), kMinSurvivalProbability, 1.0F);
+}
+
+RGB EvaluateBSDF(const Mat& material, float cosphi)
+{
+    return (material.kd / std::numbers::pi_v<float>) + (material.ks * ((material.shininess + 2.0F) / (2.0F * std::numbers::pi_v<float>)) * std::pow(cosphi, material.shininess));
+}
+}
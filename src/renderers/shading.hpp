@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <embree3/rtcore.h>
+
+#include "camera/canvas.hpp"
+#include "materials/mat.hpp"
+#include "samplers/sampler.hpp"
+#include "utils/rgb.hpp"
+
+namespace CT
+{
+struct Object;
+
+/// @brief Surface a ray hit. Hits on an instance are looked up through it, so the geometry is the prototype geometry
+/// and the object is the placement.
+struct HitSurface
+{
+    RTCGeometry geometry; // Triangle geometry holding the hit primitive
+    const Object* object; // Placement the material is taken from
+    const Eigen::Matrix3f* normal_transformation; // Takes the normals of a prototype to world space, nullptr for baked geometry
+};
+
+/// @brief Direction and probability density of a cosine weighted hemisphere sample
+struct CWHData
+{
+    Eigen::Vector3f dir;
+    float pdf;
+};
+
+/// @brief Running estimate of one pixel. The mean and variance of the luminance are tracked with
+/// Welford's algorithm so the error of the estimate is known after every sample.
+struct PixelEstimate
+{
+    RGB sum = BLACK;
+    float mean = 0.0F;
+    float m2 = 0.0F;
+    uint32_t samples = 0;
+
+    /// @brief Add one radiance sample to the estimate
+    /// @param sample
+    void Add(const RGB& sample);
+
+    /// @brief Mean colour of the samples taken so far
+    /// @return
+    RGB Colour() const;
+
+    /// @brief Standard error of the mean luminance, relative to the mean
+    /// @return Infinity while fewer than two samples have been taken
+    float RelativeError() const;
+};
+
+/// @brief Clamp a colour to [0, 1] and write it to a canvas pixel
+/// @param pixel_ref
+/// @param colour
+void DrawColourToCanvas(Canvas::PixelRef& pixel_ref, const RGB& colour);
+
+/// @brief Write the denoiser features of a primary hit to a canvas pixel
+/// @param canvas
+/// @param x
+/// @param y
+/// @param surface Surface that was hit
+/// @param hit
+void DrawFeaturesToCanvas(Canvas& canvas, size_t x, size_t y, const HitSurface& surface, const RTCHit& hit);
+
+/// @brief Film coordinates of a canvas pixel
+/// @param canvas
+/// @param x
+/// @param y
+/// @return
+Eigen::Vector2i FilmPixel(const Canvas& canvas, size_t x, size_t y);
+
+/// @brief Copy one lane of a ray packet into a single ray
+/// @param packet
+/// @param lane
+/// @return
+RTCRayHit ExtractRayHit(const RTCRayHit16& packet, size_t lane);
+
+/// @brief Look up the geometry and object of a hit in the scene
+/// @param hit Hit on a scene geometry or an instance
+/// @return
+HitSurface ResolveHit(const RTCHit& hit);
+
+/// @brief Interpolate the vertex normals of a surface at a hit
+/// @param surface
+/// @param hit
+/// @return Normalised shading normal in world space
+Eigen::Vector3f InterpolateNormals(const HitSurface& surface, const RTCHit& hit);
+
+/// @brief Sample a direction on the hemisphere around a normal, weighted by the cosine to the normal
+/// @param n
+/// @param u Uniform sample in [0, 1)^2, mapped through the concentric disk so stratification is preserved
+/// @return
+CWHData SampleCosineWeightedHemisphere(const Eigen::Vector3f& n, const Eigen::Vector2f& u);
+
+/// @brief Uniform jitter in [-1, 1)^3 drawn from a sample stream
+/// @param samples
+/// @return
+Eigen::Vector3f SampleJitter(SampleStream& samples);
+
+/// @brief Reflect a direction about a normal
+/// @param dir
+/// @param n
+/// @return Normalised reflected direction
+Eigen::Vector3f Reflect(const Eigen::Vector3f& dir, const Eigen::Vector3f& n);
+
+/// @brief Probability that russian roulette lets a path continue, proportional to the luminance of its throughput
+/// @param throughput
+/// @return Survival probability in (0, 1], floored so surviving paths are never weighted up by more than 20x
+float SurvivalProbability(const RGB& throughput);
+
+/// @brief Evaluate the diffuse + normalised Phong BSDF of a material
+/// @param material
+/// @param cosphi Cosine between the reflection and the sampled direction
+/// @return
+RGB EvaluateBSDF(const Mat& material, float cosphi);
+}
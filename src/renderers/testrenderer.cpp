@@ -1,16 +1,22 @@
 #include "testrenderer.hpp"
-#include "threadpool.hpp"
+#include "shading.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <future>
 #include <queue>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <random>
 #include <numbers>
+#include <numeric>
 
 #include <Eigen/Dense>
 
 #include "bvh/bvh.hpp"
+#include "bvh/intersector.hpp"
 #include "camera/camera.hpp"
 #include "camera/film.hpp"
 #include "config/options.hpp"
@@ -19,10 +25,13 @@
 //#include "materials/mat.hpp"
 #include "textures/texture.hpp"
 #include "utils/depthcounter.hpp"
+#include "utils/pathstatistics.hpp"
+#include "utils/raystats.hpp"
 #include "utils/rgb.hpp"
 #include "utils/exr.hpp"
 #include "utils/ppm.hpp"
 #include "utils/timer.hpp"
+#include "samplers/sampler.hpp"
 #include "utils/utils.hpp"
 
 //#include  "lights/light.hpp"
@@ -32,24 +41,7 @@ using namespace Eigen;
 
 namespace CT
 {
-static void DrawColourToCanvas(Canvas::PixelRef& pixel_ref, const RGB& colour)
-{
-    pixel_ref.r = std::clamp(colour.r, 0.0F, 1.0F);
-    pixel_ref.g = std::clamp(colour.g, 0.0F, 1.0F);
-    pixel_ref.b = std::clamp(colour.b, 0.0F, 1.0F);
-}
-
-static Vector3f InterpolateNormals(const RTCGeometry& rtcg, const RTCHit& hit)
-{
-    // Interpolate normals
-    std::array<float, 3> interp_P;
-    rtcInterpolate0(rtcg, hit.primID, hit.u, hit.v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, interp_P.data(), interp_P.size());
-    Vector3f hit_normal(interp_P[0], interp_P[1], interp_P[2]);
-    hit_normal.normalize();
-    return hit_normal;
-}
-
-static RTCRayHit CastRay(const Vector3f& origin, const Vector3f& direction, float tfar, RTCIntersectContext& context)
+static RTCRayHit CastRay(const Vector3f& origin, const Vector3f& direction, float tfar, RTCIntersectContext& context, RayType type)
 {
     RTCRayHit ret;
     ret.ray.org_x  = origin.x();
@@ -63,127 +55,91 @@ static RTCRayHit CastRay(const Vector3f& origin, const Vector3f& direction, floa
     ret.ray.mask   = 0xFFFFFFFF;
     ret.hit.geomID = RTC_INVALID_GEOMETRY_ID;
 
-    rtcIntersect1(EmbreeSingleton::GetInstance().scene, &context, &ret);
+    Intersect1(context, ret);
+    CountRays(type);
 
     return ret;    
 }
 
-struct CWHData
-{
-    Vector3f dir;
-    float pdf;
-};
-
-static CWHData SampleCosineWeightedHemisphere(const Vector3f& n)
-{
-    // Generate random point on hemisphere
-    float u           = RandomRange(0.0F, 1.0F);
-    float v           = RandomRange(0.0F, 1.0F);
-    float psi         = 2.0F * std::numbers::pi_v<float> * u;
-    float cos_veriphi = std::sqrt(1.0F - v);
-    float sin_veriphi = std::sqrt(1.0F - cos_veriphi * cos_veriphi);
-
-    // Convert to cartesian coordinates
-    Vector3f hemisphere_dir 
-    {
-        std::cos(psi) * sin_veriphi,
-        std::sin(psi) * sin_veriphi,
-        cos_veriphi 
-    };
-    
-    Vector3f u_basis;
-    if (std::abs(n.x()) > std::abs(n.y()))
-    {
-        float ilen = 1.0F / sqrtf(n.x() * n.x() + n.z() * n.z());
-        u_basis = Vector3f(-n.z() * ilen, 0, n.x() * ilen);
-    } 
-    else
-    {
-        float ilen = 1.0F / sqrtf(n.y() * n.y() + n.z() * n.z());
-        u_basis = Vector3f(0, n.z() * ilen, -n.y() * ilen);
-    }
-    Vector3f v_basis = n.cross(u_basis);
-    u_basis = n.cross(v_basis);
-
-    Vector3f retdir = Vector3f(
-        hemisphere_dir.x() * u_basis.x() + hemisphere_dir.y() * v_basis.x() + hemisphere_dir.z() * n.x(),
-        hemisphere_dir.x() * u_basis.y() + hemisphere_dir.y() * v_basis.y() + hemisphere_dir.z() * n.y(),
-        hemisphere_dir.x() * u_basis.z() + hemisphere_dir.y() * v_basis.z() + hemisphere_dir.z() * n.z());
- 
-    CWHData ret
-    {
-        .dir = retdir,
-        .pdf = hemisphere_dir.z() / std::numbers::pi_v<float>
-    };
-
-    assert(ret.pdf > 0.0F && ret.pdf <= 1.0F);
-    assert(ret.dir.norm() > 0.0F);
-
-    return { ret };
-}
-
-static RGB PerformSample(const RTCRayHit& rh, RTCIntersectContext& context, size_t recursion_depth, RGB path_throughput = WHITE)
+static RGB PerformSample(const RTCRayHit& rh, RTCIntersectContext& context, const Sampler& sampler, const LightSampler* light_sampler, const SamplePath& path, size_t recursion_depth,
+                         PathStatistics& statistics, RGB path_throughput = WHITE)
 {   
     // Initialise return value
     RGB returned_pixel_colour_value = BLACK;
 
-    if (path_throughput == BLACK)
-        return (returned_pixel_colour_value);
-
     // Get singletons
-    const EmbreeSingleton& es = EmbreeSingleton::GetInstance();
     const ConfigSingleton& cs = ConfigSingleton::GetInstance();
 
+    // Paths without energy contribute nothing
+    if (Luminance(path_throughput) <= 0.0F)
+        return (returned_pixel_colour_value);
+
+    // Russian roulette, surviving paths are weighted up by the inverse survival probability to stay unbiased
+    float survival = 1.0F;
+    if (cs.russian_roulette && recursion_depth >= cs.roulette_depth)
+    {
+        survival = SurvivalProbability(path_throughput);
+        SampleStream roulette_samples(sampler, path, recursion_depth, SampleSlot::Roulette);
+        const bool survived = roulette_samples.Next1D() < survival;
+        statistics.Record(recursion_depth, survived);
+        if (!survived)
+            return (returned_pixel_colour_value);
+    }
+
     // Get environment
     const Lights lights = cs.environment.lights;
-    const RTCGeometry incident_geometry = rtcGetGeometry(es.scene, rh.hit.geomID);
-    const auto* obj = static_cast<const Object*>(rtcGetGeometryUserData(incident_geometry));
+    const HitSurface incident_surface = ResolveHit(rh.hit);
+    const Object* obj = incident_surface.object;
 
     // Calculate vectors on hit object
-    Vector3f incident_shading_normal = InterpolateNormals(incident_geometry, rh.hit);
+    Vector3f incident_shading_normal = InterpolateNormals(incident_surface, rh.hit);
     Vector3f incident_direction { rh.ray.dir_x, rh.ray.dir_y, rh.ray.dir_z };
-    Vector3f incident_reflection = (incident_direction - 2.0F * incident_shading_normal * incident_shading_normal.dot(incident_direction)).normalized();
+    Vector3f incident_reflection = Reflect(incident_direction, incident_shading_normal);
     Vector3f incident_hit_worldspace { rh.ray.org_x + rh.ray.dir_x * rh.ray.tfar, rh.ray.org_y + rh.ray.dir_y * rh.ray.tfar, rh.ray.org_z + rh.ray.dir_z * rh.ray.tfar };
     if (ConfigSingleton::GetInstance().visualise_normals)
         return FromNormal(incident_shading_normal); 
 
-    // Calculate direct lighting
+    // Calculate direct lighting, the shadow rays of every light and direct sample are traced together
     // if(recursion_depth > 0)
-    RGB direct_sample = BLACK;
+    ShadowRayBatch shadow_rays(incident_hit_worldspace, context);
     for (size_t i = 0; i < cs.direct_samples; i++)
     {
-        direct_sample += path_throughput * EvaluateLighting(incident_hit_worldspace, incident_shading_normal, incident_reflection, obj, lights, context, recursion_depth);
+        SampleStream light_samples(sampler, path, recursion_depth, SampleSlot::Light, i, cs.direct_samples);
+        SampleLights(incident_hit_worldspace, incident_shading_normal, incident_reflection, obj, lights, light_sampler, recursion_depth, light_samples,
+                     [&](const LightSample& ls) { shadow_rays.Add(ls); });
     }
     
-    returned_pixel_colour_value += direct_sample / static_cast<float>(cs.direct_samples);
+    returned_pixel_colour_value += path_throughput * shadow_rays.Resolve() / static_cast<float>(cs.direct_samples);
 
     RGB indirect_sum = BLACK;
-    for (size_t i = 0; i < (recursion_depth == 0 ? cs.indirect_samples : 1); i++) // Do N hemisphere samples if depth is 0, otherwise do 1
+    const size_t hemisphere_samples = (recursion_depth == 0 ? cs.indirect_samples : 1); // Do N hemisphere samples if depth is 0, otherwise do 1
+    for (size_t i = 0; i < hemisphere_samples; i++)
     {
         RGB indirect = BLACK;
-        CWHData hemisphere_sample = SampleCosineWeightedHemisphere(incident_shading_normal);
-        RTCRayHit hemisphere_sample_ray = CastRay(incident_hit_worldspace, hemisphere_sample.dir, std::numeric_limits<float>::infinity(), context);
+        SampleStream hemisphere_stream(sampler, path, recursion_depth, SampleSlot::Hemisphere, i, hemisphere_samples);
+        CWHData hemisphere_sample = SampleCosineWeightedHemisphere(incident_shading_normal, hemisphere_stream.Next2D());
+        RTCRayHit hemisphere_sample_ray = CastRay(incident_hit_worldspace, hemisphere_sample.dir, std::numeric_limits<float>::infinity(), context, RayType::Hemisphere);
         if (hemisphere_sample_ray.hit.geomID != RTC_INVALID_GEOMETRY_ID)
         {
-        	const RTCGeometry hemisphere_sample_geometry = rtcGetGeometry(es.scene, hemisphere_sample_ray.hit.geomID);
+        	const HitSurface hemisphere_sample_surface = ResolveHit(hemisphere_sample_ray.hit);
 
             // Compute hemisphere sample reflection vectors
-        	Vector3f hemisphere_sample_shading_normal = InterpolateNormals(hemisphere_sample_geometry, hemisphere_sample_ray.hit);
-        	Vector3f hemisphere_sample_reflection = (hemisphere_sample.dir - 2.0F * hemisphere_sample_shading_normal * hemisphere_sample_shading_normal.dot(hemisphere_sample.dir)).normalized();
+        	Vector3f hemisphere_sample_shading_normal = InterpolateNormals(hemisphere_sample_surface, hemisphere_sample_ray.hit);
+        	Vector3f hemisphere_sample_reflection = Reflect(hemisphere_sample.dir, hemisphere_sample_shading_normal);
 
         	// Update paththrought
             float cosphi = std::max(0.0F, incident_reflection.dot(hemisphere_sample.dir));
-            RGB bsdf = (obj->material->kd / std::numbers::pi_v<float>) + (obj->material->ks * ((obj->material->shininess + 2.0F) / (2.0F * std::numbers::pi_v<float>)) * std::pow(cosphi, obj->material->shininess));
+            RGB bsdf = EvaluateBSDF(*obj->material, cosphi);
         	path_throughput *= (bsdf * std::abs((incident_shading_normal.dot(hemisphere_sample.dir)) / hemisphere_sample.pdf));
 
         	// Recurse for N indirect samples
         	if (recursion_depth < cs.recursion_depth)
         	{
-                RTCRayHit refl_ray = CastRay(incident_hit_worldspace, hemisphere_sample_reflection, std::numeric_limits<float>::infinity(), context);
+                RTCRayHit refl_ray = CastRay(incident_hit_worldspace, hemisphere_sample_reflection, std::numeric_limits<float>::infinity(), context, RayType::Reflection);
                 if (refl_ray.hit.geomID != RTC_INVALID_GEOMETRY_ID)
                 {
                     // Get object hit by reflected ray
-                    indirect = PerformSample(refl_ray, context, recursion_depth + 1, path_throughput);
+                    indirect = PerformSample(refl_ray, context, sampler, light_sampler, path.Split(i, hemisphere_samples), recursion_depth + 1, statistics, path_throughput);
                     indirect_sum += indirect;
                 }
         	}
@@ -195,8 +151,9 @@ static RGB PerformSample(const RTCRayHit& rh, RTCIntersectContext& context, size
     // Recurse for reflections
     if (obj->material->mirror && recursion_depth < cs.recursion_depth)
     {        
-        Vector3f offset_reflection = (incident_reflection + Vector3f::Random() * (1.0F - obj->material->shininess)).normalized();
-        RTCRayHit refl_ray = CastRay(incident_hit_worldspace, offset_reflection, std::numeric_limits<float>::infinity(), context);
+        SampleStream mirror_samples(sampler, path, recursion_depth, SampleSlot::Mirror);
+        Vector3f offset_reflection = (incident_reflection + SampleJitter(mirror_samples) * (1.0F - obj->material->shininess)).normalized();
+        RTCRayHit refl_ray = CastRay(incident_hit_worldspace, offset_reflection, std::numeric_limits<float>::infinity(), context, RayType::Reflection);
 
         // Get reflected ray direction
         Vector3f refl_direction { refl_ray.ray.dir_x, refl_ray.ray.dir_y, refl_ray.ray.dir_z };
@@ -204,47 +161,123 @@ static RGB PerformSample(const RTCRayHit& rh, RTCIntersectContext& context, size
         if (refl_ray.hit.geomID != RTC_INVALID_GEOMETRY_ID)
         {
             float cosphi = std::max(0.0F, incident_reflection.dot(incident_reflection));
-            RGB bsdf = (obj->material->kd / std::numbers::pi_v<float>) + (obj->material->ks * ((obj->material->shininess + 2.0F) / (2.0F * std::numbers::pi_v<float>)) * std::pow(cosphi, obj->material->shininess));
-            returned_pixel_colour_value += PerformSample(refl_ray, context, recursion_depth + 1, WHITE) * bsdf;
+            RGB bsdf = EvaluateBSDF(*obj->material, cosphi);
+            returned_pixel_colour_value += PerformSample(refl_ray, context, sampler, light_sampler, path.Mirror(), recursion_depth + 1, statistics, WHITE) * bsdf;
         }
     }
     
-    return (returned_pixel_colour_value);
+    return (returned_pixel_colour_value / survival);
 }
 
-static void RenderCanvas(Canvas& canvas, const Camera& camera)
+// Upper bound on the passes of a progressive render, every pass draws from a prefix of the same sample block
+constexpr uint32_t kMaxProgressivePasses = 1024;
+
+/// @brief Render the samples of one canvas
+/// @param film_estimates Film sized estimates kept across the passes of a progressive render, nullptr for a single pass
+/// @return Number of samples taken
+static size_t RenderCanvas(Canvas& canvas, const Camera& camera, const Sampler& sampler, const LightSampler* light_sampler, PathStatistics& statistics,
+                           std::vector<PixelEstimate>* film_estimates = nullptr)
 {
-    for (size_t y = 0; y < canvas.rect.GetHeight(); y++)
+    ConfigSingleton& cs = ConfigSingleton::GetInstance();
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+    const size_t width  = canvas.rect.GetWidth();
+    const size_t height = canvas.rect.GetHeight();
+
+    // Primary hits are kept so the adaptive passes can return to a pixel without retracing it
+    std::vector<RTCRayHit> primary(width * height);
+
+    // Estimates only live as long as the canvas unless the render is progressive
+    std::vector<PixelEstimate> local_estimates(film_estimates == nullptr ? width * height : 0);
+    const size_t film_width = canvas.GetFilm().rect.GetWidth();
+    auto estimate_at = [&](size_t index) -> PixelEstimate&
     {
-        for (size_t x = 0; x < canvas.rect.GetWidth(); x++)
-        {
-            auto pixel_ref = canvas(x, y);
-            EmbreeSingleton& es = EmbreeSingleton::GetInstance();
-            ConfigSingleton& cs = ConfigSingleton::GetInstance();
-            RTCRayHit ray { camera.GetRayForPixel(canvas, Vector2i(x, y)) };
+        if (film_estimates == nullptr)
+            return local_estimates[index];
+        const Vector2i film_pixel = FilmPixel(canvas, index % width, index / width);
+        return (*film_estimates)[static_cast<size_t>(film_pixel.y()) * film_width + static_cast<size_t>(film_pixel.x())];
+    };
 
-            RTCIntersectContext context;
-            rtcInitIntersectContext(&context);
-            context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+    // Trace primary rays in 4x4 pixel packets
+    for (size_t by = 0; by < height; by += Camera::kPacket16Height)
+    {
+        for (size_t bx = 0; bx < width; bx += Camera::kPacketWidth)
+        {
+            alignas(64) std::array<int, 16> valid;
+            RTCRayHit16 packet;
+            CountRays(RayType::Primary, camera.GetRayPacket16(canvas, bx, by, packet, valid.data()));
+            Intersect16(valid.data(), context, packet);
 
-            rtcIntersect1(es.scene, &context, &ray);           
-            if (ray.hit.geomID != RTC_INVALID_GEOMETRY_ID)  // If the ray hit something, handle the hit
+            for (size_t lane = 0; lane < valid.size(); lane++)
             {
-                RGB col = BLACK;
-                for (size_t i = 0; i < cs.samples_per_pixel; i++)
-                    col += (PerformSample(ray, context, 0) / static_cast<float>(cs.samples_per_pixel));
+                if (valid[lane] == 0)
+                    continue;
 
-                DrawColourToCanvas(pixel_ref, col);
+                const size_t x = bx + lane % Camera::kPacketWidth;
+                const size_t y = by + lane / Camera::kPacketWidth;
+                primary[y * width + x] = ExtractRayHit(packet, lane);
             }
-                
-            else // Draw black background if no hit
-                DrawColourToCanvas(pixel_ref, BLACK);
+        }
+    }
+
+    // Without a target error every pixel gets exactly samples_per_pixel, progressive passes are never adaptive
+    const bool adaptive   = cs.adaptive_error > 0.0F && film_estimates == nullptr;
+    const auto base_spp   = static_cast<uint32_t>(cs.samples_per_pixel);
+    const auto max_spp    = static_cast<uint32_t>(adaptive ? std::max(cs.max_samples_per_pixel, cs.samples_per_pixel) : cs.samples_per_pixel);
+    const uint32_t block  = film_estimates == nullptr ? max_spp : base_spp * kMaxProgressivePasses;
+    size_t samples_taken  = 0;
+
+    // Samples are indexed within a block of indices, so a pixel that stops early still uses a prefix of its sequence
+    auto sample_pixel = [&](size_t index, uint32_t count)
+    {
+        const Vector2i film_pixel = FilmPixel(canvas, index % width, index / width);
+        PixelEstimate& estimate = estimate_at(index);
+        for (uint32_t i = 0; i < count; i++)
+            estimate.Add(PerformSample(primary[index], context, sampler, light_sampler, SamplePath{ film_pixel, estimate.samples, block }, 0, statistics));
+        samples_taken += count;
+    };
+
+    // Base pass
+    for (size_t i = 0; i < primary.size(); i++)
+        if (primary[i].hit.geomID != RTC_INVALID_GEOMETRY_ID)
+            sample_pixel(i, base_spp);
+
+    // Adaptive passes, spend the remaining budget only on pixels whose estimate is still above the target error
+    for (bool active = adaptive; active;)
+    {
+        active = false;
+        for (size_t i = 0; i < primary.size(); i++)
+        {
+            const PixelEstimate& estimate = estimate_at(i);
+            if (primary[i].hit.geomID == RTC_INVALID_GEOMETRY_ID || estimate.samples >= max_spp || estimate.RelativeError() <= cs.adaptive_error)
+                continue;
+
+            sample_pixel(i, std::min(std::max(base_spp, 1U), max_spp - estimate.samples));
+            active = true;
+        }
+    }
+
+    for (size_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            auto pixel_ref = canvas(x, y);
+            DrawColourToCanvas(pixel_ref, estimate_at(y * width + x).Colour()); // Black background if no hit
+
+            const RTCRayHit& hit = primary[y * width + x];
+            if (hit.hit.geomID != RTC_INVALID_GEOMETRY_ID)
+                DrawFeaturesToCanvas(canvas, x, y, ResolveHit(hit.hit), hit.hit);
 
             // Visualise the canvases if enabled
             if (cs.visualise_canvases)
                 if (x == 0 || y == 0) { DrawColourToCanvas(pixel_ref, PURPLE); }
         }
     }
+
+    return samples_taken;
 }
 
 void TestRenderer::RenderFilm(Film& film, Camera& camera, size_t threads)
@@ -259,11 +292,87 @@ void TestRenderer::RenderFilm(Film& film, Camera& camera, size_t threads)
     std::cout << "Rendering film with " << cs.indirect_samples << " indirect samples" << std::endl;
     std::cout << "Rendering film with " << cs.recursion_depth  << " recursion depth"  << std::endl;
  
-    ThreadPool pool(threads);               // Create a thread pool    
-    std::vector<std::future<void>> futures; // Create a vector of futures    
-    futures.reserve(film.canvases.size());  // Reserve space for the futures
+    // Samplers are stateless, one is shared by every canvas
+    const std::unique_ptr<Sampler> sampler = MakeSampler(cs.sampler, cs.seed, film.rect.GetWidth(), film.rect.GetHeight());
+    const std::unique_ptr<LightSampler> light_sampler = MakeLightSampler(cs.light_sampler, cs.environment.lights);
+
+    const uint64_t rays_before = GetTotalRayCount();
+    const auto render_start    = std::chrono::steady_clock::now();
+
+    std::vector<size_t> samples(film.canvases.size(), 0);
+    PathStatistics statistics;
+    std::mutex statistics_mutex;
 
-    for (auto& canvas : film.canvases) // Enqueue the task for each canvas
-        futures.emplace_back(pool.enqueue(RenderCanvas, std::ref(canvas), std::ref(camera)));
+    if (cs.time_budget > 0.0F)
+    {
+        // Progressive: add samples_pp samples to every pixel per pass until the budget runs out.
+        // The first pass always completes so no canvas is left black. In later passes canvases that start after the
+        // deadline are skipped, so those overrun by at most one canvas per thread.
+        const auto deadline = render_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(cs.time_budget));
+        std::vector<PixelEstimate> film_estimates(film.rect.GetWidth() * film.rect.GetHeight());
+        std::vector<uint32_t> canvas_passes(film.canvases.size(), 0);
+
+        if (cs.adaptive_error > 0.0F)
+            std::cout << "Adaptive sampling is not used by time budgeted renders" << std::endl;
+
+        uint32_t passes = 0;
+        for (; passes < kMaxProgressivePasses && (passes == 0 || std::chrono::steady_clock::now() < deadline); passes++)
+        {
+            ForEachCanvas(film, threads, [&, first = passes == 0](size_t i)
+            {
+                if (!first && std::chrono::steady_clock::now() >= deadline)
+                    return;
+
+                PathStatistics canvas_statistics;
+                samples[i] += RenderCanvas(film.canvases[i], camera, *sampler, light_sampler.get(), canvas_statistics, &film_estimates);
+                canvas_passes[i]++;
+
+                std::lock_guard<std::mutex> lock(statistics_mutex);
+                statistics.Merge(canvas_statistics);
+            });
+        }
+
+        const uint32_t complete = *std::min_element(canvas_passes.begin(), canvas_passes.end());
+        std::cout << "Time budget of " << cs.time_budget << " s allowed " << complete << " complete passes of " << passes << " started, "
+                  << complete * cs.samples_per_pixel << " spp on every pixel" << std::endl;
+        if (passes == 1 && std::chrono::steady_clock::now() > deadline)
+            std::cerr << "The first pass took longer than the time budget of " << cs.time_budget << " s" << std::endl;
+    }
+    else
+    {
+        ForEachCanvas(film, threads, [&](size_t i)
+        {
+            PathStatistics canvas_statistics;
+            samples[i] = RenderCanvas(film.canvases[i], camera, *sampler, light_sampler.get(), canvas_statistics);
+
+            std::lock_guard<std::mutex> lock(statistics_mutex);
+            statistics.Merge(canvas_statistics);
+        });
+    }
+
+    // Report throughput
+    const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - render_start).count();
+    const uint64_t rays = GetTotalRayCount() - rays_before;
+    const size_t total_samples = std::accumulate(samples.begin(), samples.end(), size_t{ 0 });
+    std::cout << "Rendered " << static_cast<float>(total_samples) / static_cast<float>(film.rect.GetWidth() * film.rect.GetHeight()) << " spp on average, "
+              << rays << " rays in " << seconds << " s, " << static_cast<float>(rays) / seconds / 1e6F << " Mrays/s" << std::endl;
+
+    if (cs.russian_roulette)
+        statistics.Print(std::cout);
+
+    // Report where the adaptive sampler spent its budget
+    if (cs.adaptive_error > 0.0F && cs.time_budget <= 0.0F)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            const Rect& rect = film.canvases[i].rect;
+            std::cout << "Canvas (" << rect.ulx << ", " << rect.uly << ") consumed " << samples[i] << " samples, "
+                      << static_cast<float>(samples[i]) / static_cast<float>(rect.GetWidth() * rect.GetHeight()) << " spp" << std::endl;
+            total += samples[i];
+        }
+        std::cout << "Adaptive sampling consumed " << total << " samples, "
+                  << static_cast<float>(total) / static_cast<float>(film.rect.GetWidth() * film.rect.GetHeight()) << " spp" << std::endl;
+    }
 }
 }
\ No newline at end of file
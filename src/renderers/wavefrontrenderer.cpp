@@ -0,0 +1,545 @@
+#include "wavefrontrenderer.hpp"
+#include "shading.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "camera/camera.hpp"
+#include "camera/film.hpp"
+#include "bvh/intersector.hpp"
+#include "config/options.hpp"
+#include "embree/embreesingleton.hpp"
+#include "lights/light.hpp"
+#include "loaders/scene.hpp"
+#include "samplers/sampler.hpp"
+#include "utils/pathstatistics.hpp"
+#include "utils/raystats.hpp"
+#include "utils/rgb.hpp"
+#include "utils/timer.hpp"
+
+using namespace Eigen;
+
+namespace CT
+{
+// Width of the Embree ray packets
+constexpr size_t kPacketSize = 16;
+
+// Number of primary samples started together, bounds the size of the path queues
+constexpr size_t kWaveSize = 1024;
+
+/// @brief Structure-of-arrays queue of rays and the hits they produce
+struct RayQueue
+{
+    std::vector<float> org_x, org_y, org_z;
+    std::vector<float> dir_x, dir_y, dir_z;
+    std::vector<float> tnear, tfar;
+
+    // Hit record, filled by IntersectQueue
+    std::vector<unsigned int> geom_id, prim_id, inst_id;
+    std::vector<float> u, v;
+
+    size_t Size() const { return org_x.size(); }
+
+    void Clear()
+    {
+        org_x.clear(); org_y.clear(); org_z.clear();
+        dir_x.clear(); dir_y.clear(); dir_z.clear();
+        tnear.clear(); tfar.clear();
+        geom_id.clear(); prim_id.clear(); inst_id.clear();
+        u.clear(); v.clear();
+    }
+
+    void Push(const Vector3f& org, const Vector3f& dir, float near, float far)
+    {
+        org_x.push_back(org.x()); org_y.push_back(org.y()); org_z.push_back(org.z());
+        dir_x.push_back(dir.x()); dir_y.push_back(dir.y()); dir_z.push_back(dir.z());
+        tnear.push_back(near);
+        tfar.push_back(far);
+        geom_id.push_back(RTC_INVALID_GEOMETRY_ID);
+        prim_id.push_back(RTC_INVALID_GEOMETRY_ID);
+        inst_id.push_back(RTC_INVALID_GEOMETRY_ID);
+        u.push_back(0.0F);
+        v.push_back(0.0F);
+    }
+
+    void Resize(size_t n)
+    {
+        org_x.resize(n); org_y.resize(n); org_z.resize(n);
+        dir_x.resize(n); dir_y.resize(n); dir_z.resize(n);
+        tnear.resize(n); tfar.resize(n);
+        geom_id.resize(n, RTC_INVALID_GEOMETRY_ID); prim_id.resize(n, RTC_INVALID_GEOMETRY_ID); inst_id.resize(n, RTC_INVALID_GEOMETRY_ID);
+        u.resize(n); v.resize(n);
+    }
+
+    /// @brief Store one lane of a traced packet
+    void Set(size_t i, const RTCRayHit16& packet, size_t lane)
+    {
+        org_x[i]   = packet.ray.org_x[lane]; org_y[i] = packet.ray.org_y[lane]; org_z[i] = packet.ray.org_z[lane];
+        dir_x[i]   = packet.ray.dir_x[lane]; dir_y[i] = packet.ray.dir_y[lane]; dir_z[i] = packet.ray.dir_z[lane];
+        tnear[i]   = packet.ray.tnear[lane];
+        tfar[i]    = packet.ray.tfar[lane];
+        geom_id[i] = packet.hit.geomID[lane];
+        prim_id[i] = packet.hit.primID[lane];
+        inst_id[i] = packet.hit.instID[0][lane];
+        u[i]       = packet.hit.u[lane];
+        v[i]       = packet.hit.v[lane];
+    }
+
+    /// @brief Copy a ray and its hit record from another queue
+    void Push(const RayQueue& other, size_t i)
+    {
+        Push(other.Origin(i), other.Direction(i), other.tnear[i], other.tfar[i]);
+        geom_id.back() = other.geom_id[i];
+        prim_id.back() = other.prim_id[i];
+        inst_id.back() = other.inst_id[i];
+        u.back()       = other.u[i];
+        v.back()       = other.v[i];
+    }
+
+    Vector3f Origin(size_t i) const    { return { org_x[i], org_y[i], org_z[i] }; }
+    Vector3f Direction(size_t i) const { return { dir_x[i], dir_y[i], dir_z[i] }; }
+    Vector3f HitPoint(size_t i) const  { return Origin(i) + Direction(i) * tfar[i]; }
+    bool     IsHit(size_t i) const     { return geom_id[i] != RTC_INVALID_GEOMETRY_ID; }
+
+    RTCHit Hit(size_t i) const
+    {
+        RTCHit hit;
+        hit.u      = u[i];
+        hit.v      = v[i];
+        hit.primID = prim_id[i];
+        hit.geomID = geom_id[i];
+        hit.instID[0] = inst_id[i];
+        return hit;
+    }
+};
+
+/// @brief Paths waiting to be shaded, aligned index for index with their rays
+struct PathQueue
+{
+    RayQueue rays;
+
+    // Throughput carried into the next bounce, as passed down by PerformSample
+    std::vector<RGB> throughput;
+
+    // Factor the path's radiance is scaled by before it reaches the pixel
+    std::vector<RGB> weight;
+
+    // Index of the pixel within the canvas
+    std::vector<uint32_t> pixel;
+
+    // Sample sequence the path draws from
+    std::vector<SamplePath> path;
+
+    size_t Size() const { return rays.Size(); }
+
+    void Clear()
+    {
+        rays.Clear();
+        throughput.clear();
+        weight.clear();
+        pixel.clear();
+        path.clear();
+    }
+
+    void Push(const RGB& t, const RGB& w, uint32_t p, const SamplePath& sp)
+    {
+        throughput.push_back(t);
+        weight.push_back(w);
+        pixel.push_back(p);
+        path.push_back(sp);
+    }
+};
+
+/// @brief Shadow rays and the radiance they deliver if unoccluded
+struct ShadowQueue
+{
+    RayQueue rays;
+    std::vector<RGB> contribution;
+    std::vector<uint32_t> pixel;
+
+    void Clear()
+    {
+        rays.Clear();
+        contribution.clear();
+        pixel.clear();
+    }
+};
+
+/// @brief Hemisphere sample rays, grouped contiguously by the path that spawned them
+struct ProbeQueue
+{
+    RayQueue rays;
+    std::vector<float> pdf;
+    std::vector<uint32_t> parent;
+
+    // Index of the sample among the hemisphere samples of its parent
+    std::vector<uint32_t> split;
+
+    void Clear()
+    {
+        rays.Clear();
+        pdf.clear();
+        parent.clear();
+        split.clear();
+    }
+};
+
+/// @brief Surface data of a shaded path that its hemisphere samples need
+struct PathSurface
+{
+    Vector3f hit_worldspace;
+    Vector3f shading_normal;
+    Vector3f reflection;
+    const Object* obj;
+};
+
+/// @brief Find the closest hit of every ray in the queue, 16 rays at a time
+/// @param type Category the rays are counted under
+static void IntersectQueue(RayQueue& q, RTCIntersectContext& context, RayType type)
+{
+    for (size_t base = 0; base < q.Size(); base += kPacketSize)
+    {
+        const size_t count = std::min(kPacketSize, q.Size() - base);
+
+        alignas(64) std::array<int, kPacketSize> valid;
+        RTCRayHit16 packet;
+
+        for (size_t i = 0; i < kPacketSize; i++)
+        {
+            valid[i] = i < count ? -1 : 0;
+            if (i >= count)
+                continue;
+
+            const size_t r = base + i;
+            packet.ray.org_x[i]  = q.org_x[r];
+            packet.ray.org_y[i]  = q.org_y[r];
+            packet.ray.org_z[i]  = q.org_z[r];
+            packet.ray.dir_x[i]  = q.dir_x[r];
+            packet.ray.dir_y[i]  = q.dir_y[r];
+            packet.ray.dir_z[i]  = q.dir_z[r];
+            packet.ray.tnear[i]  = q.tnear[r];
+            packet.ray.tfar[i]   = q.tfar[r];
+            packet.ray.time[i]   = 0.0F;
+            packet.ray.mask[i]   = 0xFFFFFFFF;
+            packet.ray.id[i]     = static_cast<unsigned int>(r);
+            packet.ray.flags[i]  = 0;
+            packet.hit.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+        }
+
+        Intersect16(valid.data(), context, packet);
+        CountRays(type, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const size_t r = base + i;
+            q.tfar[r]    = packet.ray.tfar[i];
+            q.geom_id[r] = packet.hit.geomID[i];
+            q.prim_id[r] = packet.hit.primID[i];
+            q.inst_id[r] = packet.hit.instID[0][i];
+            q.u[r]       = packet.hit.u[i];
+            q.v[r]       = packet.hit.v[i];
+        }
+    }
+}
+
+/// @brief Test every ray in the queue for occlusion, 16 rays at a time. Occluded rays are marked as hits.
+static void OccludeQueue(RayQueue& q, RTCIntersectContext& context)
+{
+    for (size_t base = 0; base < q.Size(); base += kPacketSize)
+    {
+        const size_t count = std::min(kPacketSize, q.Size() - base);
+
+        alignas(64) std::array<int, kPacketSize> valid;
+        RTCRay16 packet;
+
+        for (size_t i = 0; i < kPacketSize; i++)
+        {
+            valid[i] = i < count ? -1 : 0;
+            if (i >= count)
+                continue;
+
+            const size_t r = base + i;
+            packet.org_x[i] = q.org_x[r];
+            packet.org_y[i] = q.org_y[r];
+            packet.org_z[i] = q.org_z[r];
+            packet.dir_x[i] = q.dir_x[r];
+            packet.dir_y[i] = q.dir_y[r];
+            packet.dir_z[i] = q.dir_z[r];
+            packet.tnear[i] = q.tnear[r];
+            packet.tfar[i]  = q.tfar[r];
+            packet.time[i]  = 0.0F;
+            packet.mask[i]  = 0xFFFFFFFF;
+            packet.id[i]    = static_cast<unsigned int>(r);
+            packet.flags[i] = 0;
+        }
+
+        Occluded16(valid.data(), context, packet);
+        CountRays(RayType::Shadow, count);
+
+        // Embree sets tfar to -inf for occluded rays
+        for (size_t i = 0; i < count; i++)
+            if (packet.tfar[i] < q.tfar[base + i])
+                q.geom_id[base + i] = 0;
+    }
+}
+
+/// @brief Trace the queued rays and keep only the paths that hit something and survive russian roulette
+/// @param depth Depth the extended paths are shaded at
+static void ExtendPaths(PathQueue& pending, PathQueue& live, RTCIntersectContext& context, const Sampler& sampler, size_t depth, PathStatistics& statistics)
+{
+    const ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    const bool roulette = cs.russian_roulette && depth >= cs.roulette_depth;
+
+    // Pending rays continue paths along mirror and hemisphere reflections
+    IntersectQueue(pending.rays, context, RayType::Reflection);
+
+    live.Clear();
+    for (size_t i = 0; i < pending.Size(); i++)
+    {
+        // Terminate paths that escaped or carry no energy
+        if (!pending.rays.IsHit(i) || Luminance(pending.throughput[i]) <= 0.0F)
+            continue;
+
+        // Survivors are weighted up by the inverse survival probability, as PerformSample does
+        RGB weight = pending.weight[i];
+        if (roulette)
+        {
+            const float survival = SurvivalProbability(pending.throughput[i]);
+            SampleStream roulette_samples(sampler, pending.path[i], depth, SampleSlot::Roulette);
+            const bool survived = roulette_samples.Next1D() < survival;
+            statistics.Record(depth, survived);
+            if (!survived)
+                continue;
+            weight *= 1.0F / survival;
+        }
+
+        live.rays.Push(pending.rays, i);
+        live.Push(pending.throughput[i], weight, pending.pixel[i], pending.path[i]);
+    }
+}
+
+static void RenderCanvas(Canvas& canvas, const Camera& camera, const Sampler& sampler, const LightSampler* light_sampler, PathStatistics& statistics)
+{
+    const ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    const Lights& lights      = cs.environment.lights;
+
+    RTCIntersectContext coherent;
+    rtcInitIntersectContext(&coherent);
+    coherent.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+    RTCIntersectContext incoherent;
+    rtcInitIntersectContext(&incoherent);
+
+    const size_t width  = canvas.rect.GetWidth();
+    const size_t pixels = width * canvas.rect.GetHeight();
+
+    std::vector<RGB> radiance(pixels, BLACK);
+
+    // Primary rays for the whole canvas, traced in 4x4 pixel packets
+    RayQueue primary;
+    primary.Resize(pixels);
+    for (size_t by = 0; by < canvas.rect.GetHeight(); by += Camera::kPacket16Height)
+    {
+        for (size_t bx = 0; bx < width; bx += Camera::kPacketWidth)
+        {
+            alignas(64) std::array<int, kPacketSize> valid;
+            RTCRayHit16 packet;
+            CountRays(RayType::Primary, camera.GetRayPacket16(canvas, bx, by, packet, valid.data()));
+            Intersect16(valid.data(), coherent, packet);
+
+            for (size_t lane = 0; lane < kPacketSize; lane++)
+                if (valid[lane] != 0)
+                    primary.Set((by + lane / Camera::kPacketWidth) * width + bx + lane % Camera::kPacketWidth, packet, lane);
+        }
+    }
+
+    PathQueue live, pending;
+    ShadowQueue shadows;
+    ProbeQueue probes;
+    std::vector<PathSurface> surfaces;
+
+    const size_t wave_pixels = std::max<size_t>(1, kWaveSize / std::max<size_t>(1, cs.samples_per_pixel));
+    const float  inv_direct  = 1.0F / static_cast<float>(cs.direct_samples);
+    const float  inv_indirect = 1.0F / static_cast<float>(cs.indirect_samples);
+
+    for (size_t first = 0; first < pixels; first += wave_pixels)
+    {
+        // Start one path per primary sample
+        live.Clear();
+        for (size_t p = first; p < std::min(pixels, first + wave_pixels); p++)
+        {
+            if (!primary.IsHit(p))
+                continue;
+
+            DrawFeaturesToCanvas(canvas, p % width, p / width, ResolveHit(primary.Hit(p)), primary.Hit(p));
+
+            if (cs.visualise_normals)
+            {
+                radiance[p] = FromNormal(InterpolateNormals(ResolveHit(primary.Hit(p)), primary.Hit(p)));
+                continue;
+            }
+
+            const Vector2i film_pixel = FilmPixel(canvas, p % width, p / width);
+            const auto spp = static_cast<uint32_t>(cs.samples_per_pixel);
+            for (uint32_t s = 0; s < spp; s++)
+            {
+                live.rays.Push(primary, p);
+                live.Push(WHITE, WHITE / static_cast<float>(cs.samples_per_pixel), static_cast<uint32_t>(p), SamplePath{ film_pixel, s, spp });
+            }
+        }
+
+        for (size_t depth = 0; live.Size() > 0; depth++)
+        {
+            const bool   can_recurse        = depth < cs.recursion_depth;
+            const size_t hemisphere_samples = depth == 0 ? cs.indirect_samples : 1;
+
+            shadows.Clear();
+            probes.Clear();
+            pending.Clear();
+            surfaces.resize(live.Size());
+
+            // Shade: queue shadow rays, hemisphere samples and mirror reflections for every live path
+            for (size_t i = 0; i < live.Size(); i++)
+            {
+                const RTCHit hit       = live.rays.Hit(i);
+                const HitSurface hit_surface = ResolveHit(hit);
+                PathSurface& surface = surfaces[i];
+                surface.obj            = hit_surface.object;
+                surface.shading_normal = InterpolateNormals(hit_surface, hit);
+                surface.reflection     = Reflect(live.rays.Direction(i), surface.shading_normal);
+                surface.hit_worldspace = live.rays.HitPoint(i);
+
+                const SamplePath& path = live.path[i];
+
+                const RGB direct_weight = live.weight[i] * live.throughput[i] * inv_direct;
+                for (size_t d = 0; d < cs.direct_samples; d++)
+                {
+                    SampleStream light_samples(sampler, path, depth, SampleSlot::Light, d, cs.direct_samples);
+                    SampleLights(surface.hit_worldspace, surface.shading_normal, surface.reflection, surface.obj, lights, light_sampler, depth, light_samples, [&](const LightSample& ls)
+                    {
+                        shadows.rays.Push(surface.hit_worldspace, ls.direction, 0.0001F, ls.distance);
+                        shadows.contribution.push_back(direct_weight * ls.contribution);
+                        shadows.pixel.push_back(live.pixel[i]);
+                    });
+                }
+
+                for (size_t h = 0; h < hemisphere_samples; h++)
+                {
+                    SampleStream hemisphere_stream(sampler, path, depth, SampleSlot::Hemisphere, h, hemisphere_samples);
+                    const CWHData hemisphere_sample = SampleCosineWeightedHemisphere(surface.shading_normal, hemisphere_stream.Next2D());
+                    probes.rays.Push(surface.hit_worldspace, hemisphere_sample.dir, 0.01F, std::numeric_limits<float>::infinity());
+                    probes.pdf.push_back(hemisphere_sample.pdf);
+                    probes.parent.push_back(static_cast<uint32_t>(i));
+                    probes.split.push_back(static_cast<uint32_t>(h));
+                }
+
+                if (surface.obj->material->mirror && can_recurse)
+                {
+                    SampleStream mirror_samples(sampler, path, depth, SampleSlot::Mirror);
+                    const Vector3f offset_reflection = (surface.reflection + SampleJitter(mirror_samples) * (1.0F - surface.obj->material->shininess)).normalized();
+                    const RGB bsdf = EvaluateBSDF(*surface.obj->material, std::max(0.0F, surface.reflection.dot(surface.reflection)));
+                    pending.rays.Push(surface.hit_worldspace, offset_reflection, 0.01F, std::numeric_limits<float>::infinity());
+                    pending.Push(WHITE, live.weight[i] * bsdf, live.pixel[i], path.Mirror());
+                }
+            }
+
+            // Shadow: deliver direct lighting from unoccluded light samples
+            OccludeQueue(shadows.rays, incoherent);
+            for (size_t i = 0; i < shadows.rays.Size(); i++)
+                if (!shadows.rays.IsHit(i))
+                    radiance[shadows.pixel[i]] += shadows.contribution[i];
+
+            // Hemisphere: update throughput in sample order and queue the reflected bounce
+            IntersectQueue(probes.rays, incoherent, RayType::Hemisphere);
+            for (size_t j = 0; j < probes.rays.Size(); j++)
+            {
+                if (!probes.rays.IsHit(j))
+                    continue;
+
+                const uint32_t parent      = probes.parent[j];
+                const PathSurface& surface = surfaces[parent];
+                const Vector3f probe_dir   = probes.rays.Direction(j);
+
+                const Vector3f probe_normal     = InterpolateNormals(ResolveHit(probes.rays.Hit(j)), probes.rays.Hit(j));
+                const Vector3f probe_reflection = Reflect(probe_dir, probe_normal);
+
+                const float cosphi = std::max(0.0F, surface.reflection.dot(probe_dir));
+                const RGB bsdf     = EvaluateBSDF(*surface.obj->material, cosphi);
+                live.throughput[parent] *= (bsdf * std::abs(surface.shading_normal.dot(probe_dir) / probes.pdf[j]));
+
+                if (can_recurse)
+                {
+                    pending.rays.Push(surface.hit_worldspace, probe_reflection, 0.01F, std::numeric_limits<float>::infinity());
+                    pending.Push(live.throughput[parent], live.weight[parent] * inv_indirect, live.pixel[parent],
+                                 live.path[parent].Split(probes.split[j], static_cast<uint32_t>(hemisphere_samples)));
+                }
+            }
+
+            // Extend + terminate: trace the next bounce and drop finished paths
+            ExtendPaths(pending, live, incoherent, sampler, depth + 1, statistics);
+        }
+    }
+
+    for (size_t p = 0; p < pixels; p++)
+    {
+        const size_t x = p % width;
+        const size_t y = p / width;
+        auto pixel_ref = canvas(x, y);
+        DrawColourToCanvas(pixel_ref, radiance[p]);
+
+        // Visualise the canvases if enabled
+        if (cs.visualise_canvases)
+            if (x == 0 || y == 0) { DrawColourToCanvas(pixel_ref, PURPLE); }
+    }
+}
+
+void WavefrontRenderer::RenderFilm(Film& film, Camera& camera, size_t threads)
+{
+    Timer t("RenderFilm");
+    // Assert that the number of threads is valid
+    assert(threads > 0 && threads <= std::thread::hardware_concurrency());
+
+    const ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    std::cout << "Rendering wavefront film with " << threads             << " threads"          << std::endl;
+    std::cout << "Rendering wavefront film with " << cs.direct_samples   << " direct samples"   << std::endl;
+    std::cout << "Rendering wavefront film with " << cs.indirect_samples << " indirect samples" << std::endl;
+    std::cout << "Rendering wavefront film with " << cs.recursion_depth  << " recursion depth"  << std::endl;
+    if (cs.adaptive_error > 0.0F)
+        std::cout << "Adaptive sampling is not supported by the wavefront renderer, using " << cs.samples_per_pixel << " spp" << std::endl;
+    if (cs.time_budget > 0.0F)
+        std::cout << "Time budgets are not supported by the wavefront renderer, rendering a single pass" << std::endl;
+
+    // Samplers are stateless, one is shared by every canvas
+    const std::unique_ptr<Sampler> sampler = MakeSampler(cs.sampler, cs.seed, film.rect.GetWidth(), film.rect.GetHeight());
+    const std::unique_ptr<LightSampler> light_sampler = MakeLightSampler(cs.light_sampler, cs.environment.lights);
+
+    const uint64_t rays_before = GetTotalRayCount();
+    const auto render_start    = std::chrono::steady_clock::now();
+
+    PathStatistics statistics;
+    std::mutex statistics_mutex;
+    ForEachCanvas(film, threads, [&](size_t i)
+    {
+        PathStatistics canvas_statistics;
+        RenderCanvas(film.canvases[i], camera, *sampler, light_sampler.get(), canvas_statistics);
+
+        std::lock_guard<std::mutex> lock(statistics_mutex);
+        statistics.Merge(canvas_statistics);
+    });
+
+    const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - render_start).count();
+    const uint64_t rays = GetTotalRayCount() - rays_before;
+    std::cout << "Traced " << rays << " rays in " << seconds << " s, " << static_cast<float>(rays) / seconds / 1e6F << " Mrays/s" << std::endl;
+
+    if (cs.russian_roulette)
+        statistics.Print(std::cout);
+}
+}
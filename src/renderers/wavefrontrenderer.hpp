@@ -0,0 +1,15 @@
+#pragma once
+
+#include "renderer.hpp"
+
+namespace CT
+{
+/// @brief Iterative path tracer that advances every path of a canvas one bounce at a time.
+/// Paths are held in structure-of-arrays queues and each stage (extend, shade, shadow, terminate)
+/// is traced with 16-wide Embree packets instead of recursing per ray.
+class WavefrontRenderer : public Renderer
+{
+public:
+    void RenderFilm(Film& film, Camera& camera, size_t threads) override;
+};
+}
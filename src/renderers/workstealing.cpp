@@ -0,0 +1,220 @@
+#include "workstealing.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <utility>
+
+namespace CT
+{
+void WorkDeque::Reset(size_t capacity)
+{
+    const size_t size = std::bit_ceil(std::max<size_t>(capacity, 1));
+    _buffer.resize(size);
+    _mask = size - 1;
+    _top.store(0, std::memory_order_relaxed);
+    _bottom.store(0, std::memory_order_relaxed);
+}
+
+void WorkDeque::Push(const WorkRange& range)
+{
+    const int64_t b = _bottom.load(std::memory_order_relaxed);
+    assert(b - _top.load(std::memory_order_relaxed) < static_cast<int64_t>(_buffer.size()));
+    _buffer[static_cast<size_t>(b) & _mask] = range;
+    _bottom.store(b + 1, std::memory_order_release);
+}
+
+bool WorkDeque::Pop(WorkRange& range)
+{
+    const int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+
+    if (t > b) // Empty
+    {
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    range = _buffer[static_cast<size_t>(b) & _mask];
+    if (t == b) // Last range, race the thieves for it
+    {
+        const bool won = _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool WorkDeque::Steal(WorkRange& range)
+{
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = _bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+        return false;
+
+    range = _buffer[static_cast<size_t>(t) & _mask];
+    return _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+WorkStealingScheduler::WorkStealingScheduler(size_t threads) : _deques(std::max<size_t>(threads, 1))
+{
+    _threads.reserve(_deques.size() - 1);
+    for (size_t i = 1; i < _deques.size(); i++)
+        _threads.emplace_back([this, i] { WorkerLoop(i); });
+}
+
+WorkStealingScheduler::~WorkStealingScheduler()
+{
+    _stop.store(true, std::memory_order_release);
+    _epoch.fetch_add(1, std::memory_order_release);
+    _epoch.notify_all();
+
+    for (std::thread& worker : _threads)
+        worker.join();
+}
+
+void WorkStealingScheduler::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+    if (count == 0)
+        return;
+
+    grain = std::max<size_t>(grain, 1);
+    const size_t ranges  = (count + grain - 1) / grain;
+    const size_t workers = _deques.size();
+
+    // Give each worker a contiguous block, pushed in reverse so the owner pops it front to back
+    for (size_t w = 0; w < workers; w++)
+    {
+        const size_t first = ranges * w / workers;
+        const size_t last  = ranges * (w + 1) / workers;
+        _deques[w].Reset(last - first);
+        for (size_t r = last; r > first; r--)
+            _deques[w].Push({ (r - 1) * grain, std::min(count, r * grain) });
+    }
+
+    _body = &body;
+    _pending.store(ranges, std::memory_order_relaxed);
+    _finished.store(0, std::memory_order_relaxed);
+    _failed.store(false, std::memory_order_relaxed);
+
+    // Wake the background workers and join in as worker 0
+    _epoch.fetch_add(1, std::memory_order_release);
+    _epoch.notify_all();
+    RunWorker(0);
+
+    // Workers may still be looking for ranges to steal, the deques are only reused once all have left
+    for (size_t finished; (finished = _finished.load(std::memory_order_acquire)) != _threads.size();)
+        _finished.wait(finished, std::memory_order_acquire);
+
+    _body = nullptr;
+    if (_error)
+        std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void WorkStealingScheduler::WorkerLoop(size_t index)
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        _epoch.wait(seen, std::memory_order_acquire);
+        seen = _epoch.load(std::memory_order_acquire);
+
+        if (_stop.load(std::memory_order_acquire))
+            return;
+
+        RunWorker(index);
+
+        _finished.fetch_add(1, std::memory_order_release);
+        _finished.notify_one();
+    }
+}
+
+void WorkStealingScheduler::RunWorker(size_t index)
+{
+    WorkRange range;
+    auto execute = [&]()
+    {
+        // After a failure the remaining ranges are only drained, the loop is rethrown by ParallelFor
+        if (!_failed.load(std::memory_order_acquire))
+        {
+            try
+            {
+                (*_body)(range.begin, range.end);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(_error_mutex);
+                if (!_error)
+                    _error = std::current_exception();
+                _failed.store(true, std::memory_order_release);
+            }
+        }
+        _pending.fetch_sub(1, std::memory_order_acq_rel);
+    };
+
+    // Work through our own block first
+    while (_deques[index].Pop(range))
+        execute();
+
+    // Then steal from the other workers until every range has completed
+    const size_t workers = _deques.size();
+    for (size_t victim = index + 1; _pending.load(std::memory_order_acquire) > 0; victim++)
+    {
+        if (victim % workers == index)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        if (_deques[victim % workers].Steal(range))
+            execute();
+    }
+}
+
+// Distance of a cell along the Hilbert curve filling an n x n grid, n a power of two
+static size_t HilbertIndex(size_t n, size_t x, size_t y)
+{
+    size_t d = 0;
+    for (size_t s = n / 2; s > 0; s /= 2)
+    {
+        const size_t rx = static_cast<size_t>((x & s) > 0);
+        const size_t ry = static_cast<size_t>((y & s) > 0);
+        d += s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve stays continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::vector<size_t> HilbertTileOrder(size_t columns, size_t rows)
+{
+    const size_t n = std::bit_ceil(std::max<size_t>({ columns, rows, 1 }));
+
+    std::vector<std::pair<size_t, size_t>> keyed;
+    keyed.reserve(columns * rows);
+    for (size_t y = 0; y < rows; y++)
+        for (size_t x = 0; x < columns; x++)
+            keyed.emplace_back(HilbertIndex(n, x, y), y * columns + x);
+
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<size_t> order;
+    order.reserve(keyed.size());
+    for (const auto& [key, tile] : keyed)
+        order.push_back(tile);
+    return order;
+}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CT
+{
+/// @brief Half open range of work item indices
+struct WorkRange
+{
+    size_t begin;
+    size_t end;
+};
+
+/// @brief Chase-Lev work stealing deque. The owning worker pops from the bottom while other workers
+/// steal from the top, neither takes a lock. Items are pushed before the deque is shared, so the
+/// buffer never grows while thieves are reading it.
+class WorkDeque
+{
+public:
+    /// @brief Empty the deque and make room for at least capacity items
+    /// @param capacity
+    void Reset(size_t capacity);
+
+    /// @brief Push a range onto the bottom, only the owner may push
+    /// @param range
+    void Push(const WorkRange& range);
+
+    /// @brief Pop the most recently pushed range, only the owner may pop
+    /// @param range
+    /// @return False if the deque is empty or the last range was stolen
+    bool Pop(WorkRange& range);
+
+    /// @brief Steal the oldest range from another worker's deque
+    /// @param range
+    /// @return False if the deque is empty or another thief won the race
+    bool Steal(WorkRange& range);
+
+private:
+    std::vector<WorkRange> _buffer;
+    size_t _mask = 0;
+    alignas(64) std::atomic<int64_t> _top    = 0;
+    alignas(64) std::atomic<int64_t> _bottom = 0;
+};
+
+/// @brief Persistent workers that execute parallel loops by work stealing.
+/// Each worker starts on a contiguous block of the loop so neighbouring items stay on one thread,
+/// and idle workers steal from the far end of a busy worker's block.
+/// Loops must not be run from two threads at once.
+class WorkStealingScheduler
+{
+public:
+    /// @brief Create a scheduler, the calling thread counts as one of the workers
+    /// @param threads Total number of threads executing each loop
+    explicit WorkStealingScheduler(size_t threads);
+
+    WorkStealingScheduler(const WorkStealingScheduler&) = delete;
+    WorkStealingScheduler& operator=(const WorkStealingScheduler&) = delete;
+
+    ~WorkStealingScheduler();
+
+    /// @brief Execute body over [0, count) in ranges of grain items and wait for all of them.
+    /// If body throws, the ranges that have not started are skipped and the first exception is rethrown once every
+    /// worker has left the loop.
+    /// @param count Number of items
+    /// @param grain Items per range, the unit of stealing
+    /// @param body Called with the begin and end of each range
+    void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    size_t GetThreadCount() const { return _deques.size(); }
+
+private:
+    void WorkerLoop(size_t index);
+
+    void RunWorker(size_t index);
+
+    std::vector<std::thread> _threads;
+    std::vector<WorkDeque> _deques; // One per worker, index 0 belongs to the calling thread
+
+    const std::function<void(size_t, size_t)>* _body = nullptr;
+    std::atomic<size_t> _pending  = 0; // Ranges of the current loop that have not completed
+    std::atomic<size_t> _finished = 0; // Background workers that have left the current loop
+    std::atomic<uint64_t> _epoch  = 0; // Incremented to wake the workers for each loop
+    std::atomic<bool> _stop       = false;
+
+    std::atomic<bool> _failed = false; // Set once a range of the current loop has thrown
+    std::exception_ptr _error;         // First exception of the current loop
+    std::mutex _error_mutex;
+};
+
+/// @brief Order the tiles of a grid along a Hilbert curve so consecutive tiles are spatially adjacent
+/// @param columns
+/// @param rows
+/// @return Row major tile indices in curve order
+std::vector<size_t> HilbertTileOrder(size_t columns, size_t rows);
+}
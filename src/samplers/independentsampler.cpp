@@ -0,0 +1,24 @@
+#include "independentsampler.hpp"
+
+#include "utils/random.hpp"
+
+namespace CT
+{
+IndependentSampler::IndependentSampler(uint64_t seed) : _seed(seed) { }
+
+float IndependentSampler::Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    const uint64_t pixel_key = (static_cast<uint64_t>(pixel.y()) << 32U) | static_cast<uint32_t>(pixel.x());
+    RNG rng(MixBits(_seed ^ pixel_key) ^ dimension, index);
+    return rng.Uniform();
+}
+
+Eigen::Vector2f IndependentSampler::Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    const uint64_t pixel_key = (static_cast<uint64_t>(pixel.y()) << 32U) | static_cast<uint32_t>(pixel.x());
+    RNG rng(MixBits(_seed ^ pixel_key) ^ dimension, index);
+    const float u = rng.Uniform();
+    const float v = rng.Uniform();
+    return { u, v };
+}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "sampler.hpp"
+
+namespace CT
+{
+/// @brief Uncorrelated uniform values, hashed from the pixel, dimension and index
+class IndependentSampler : public Sampler
+{
+public:
+    IndependentSampler(uint64_t seed);
+
+    float Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const override;
+    Eigen::Vector2f Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const override;
+
+private:
+    uint64_t _seed;
+};
+}
@@ -0,0 +1,38 @@
+#include "sampler.hpp"
+#include "independentsampler.hpp"
+#include "sobolsampler.hpp"
+
+#include "utils/random.hpp"
+
+namespace CT
+{
+uint32_t Sampler::Dimension(size_t depth, SampleSlot slot, uint32_t branch)
+{
+    const uint64_t key = (static_cast<uint64_t>(depth) << 40U) | (static_cast<uint64_t>(slot) << 32U) | branch;
+    return static_cast<uint32_t>(MixBits(key));
+}
+
+SampleStream::SampleStream(const Sampler& sampler, const SamplePath& path, size_t depth, SampleSlot slot, uint32_t split, uint32_t splits)
+    : _sampler(sampler), _pixel(path.pixel), _dimension(Sampler::Dimension(depth, slot, path.branch)),
+      _index(path.index * splits + split), _count(path.count * splits) { }
+
+float SampleStream::Next1D()
+{
+    return _sampler.Get1D(_pixel, _dimension++, _index, _count);
+}
+
+Eigen::Vector2f SampleStream::Next2D()
+{
+    return _sampler.Get2D(_pixel, _dimension++, _index, _count);
+}
+
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, uint64_t seed, size_t film_width, size_t film_height)
+{
+    switch (type)
+    {
+        case SamplerType::Sobol:  return std::make_unique<SobolSampler>(seed);
+        case SamplerType::ZSobol: return std::make_unique<ZSobolSampler>(seed, film_width, film_height);
+        default:                  return std::make_unique<IndependentSampler>(seed);
+    }
+}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Eigen/Core>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace CT
+{
+/// @brief Purpose of the values drawn at a bounce, each slot is given its own dimensions
+enum class SampleSlot : uint32_t
+{
+    Light,
+    Hemisphere,
+    Mirror,
+    Roulette
+};
+
+/// @brief Identifies the sample sequence a path draws from
+struct SamplePath
+{
+    // Film pixel the path contributes to
+    Eigen::Vector2i pixel;
+
+    // Index of the path among all paths of the pixel at its depth, and the number of such paths
+    uint32_t index;
+    uint32_t count;
+
+    // Records which reflection lobes led to the path, so mirror and hemisphere branches never share dimensions
+    uint32_t branch = 0;
+
+    /// @brief Path continuing from split i of n, e.g. the i-th of n hemisphere samples
+    SamplePath Split(uint32_t i, uint32_t n) const { return { pixel, index * n + i, count * n, branch * 2 }; }
+
+    /// @brief Path continuing through the mirror lobe
+    SamplePath Mirror() const { return { pixel, index, count, branch * 2 + 1 }; }
+};
+
+/// @brief Source of sample values in [0, 1). Samplers are stateless, each value is a pure function of
+/// the pixel, the dimension and the sample index, so one sampler is shared by every render thread.
+class Sampler
+{
+public:
+    virtual ~Sampler() = default;
+
+    /// @brief Value of one dimension
+    /// @param pixel Film pixel
+    /// @param dimension Dimension key, see Dimension()
+    /// @param index Sample index within the pixel
+    /// @param count Number of indices the pixel draws from this dimension
+    /// @return
+    virtual float Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const = 0;
+
+    /// @brief Stratified pair of values of one dimension
+    virtual Eigen::Vector2f Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const = 0;
+
+    /// @brief Dimension key of a slot at a given bounce and branch
+    static uint32_t Dimension(size_t depth, SampleSlot slot, uint32_t branch);
+};
+
+/// @brief Consecutive dimensions of one sample, handed to sampling routines so they can draw
+/// values without knowing the dimension layout
+class SampleStream
+{
+public:
+    /// @param sampler
+    /// @param path Path that draws the values
+    /// @param depth Bounce of the path
+    /// @param slot
+    /// @param split Index of this draw among the splits the path makes in this slot, e.g. the direct sample index
+    /// @param splits Number of splits
+    SampleStream(const Sampler& sampler, const SamplePath& path, size_t depth, SampleSlot slot, uint32_t split = 0, uint32_t splits = 1);
+
+    float Next1D();
+    Eigen::Vector2f Next2D();
+
+private:
+    const Sampler& _sampler;
+    Eigen::Vector2i _pixel;
+    uint32_t _dimension;
+    uint32_t _index;
+    uint32_t _count;
+};
+
+enum class SamplerType
+{
+    Independent,
+    Sobol,
+    ZSobol
+};
+
+/// @brief Create a sampler for a render
+/// @param type 
+/// @param seed Render seed
+/// @param film_width 
+/// @param film_height 
+/// @return 
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, uint64_t seed, size_t film_width, size_t film_height);
+}
@@ -0,0 +1,163 @@
+#include "sobolsampler.hpp"
+
+#include "utils/random.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+namespace CT
+{
+// Direction numbers of the first two Sobol dimensions
+static constexpr std::array<std::array<uint32_t, 32>, 2> kSobolDirections = []
+{
+    std::array<std::array<uint32_t, 32>, 2> v{};
+    for (size_t i = 0; i < 32; i++)
+        v[0][i] = 1U << (31U - i);
+
+    v[1][0] = 1U << 31U;
+    for (size_t i = 1; i < 32; i++)
+        v[1][i] = v[1][i - 1] ^ (v[1][i - 1] >> 1U);
+
+    return v;
+}();
+
+static uint32_t Sobol(uint32_t index, size_t dim)
+{
+    uint32_t x = 0;
+    for (size_t bit = 0; index != 0; index >>= 1U, bit++)
+        if ((index & 1U) != 0)
+            x ^= kSobolDirections[dim][bit];
+    return x;
+}
+
+static uint32_t ReverseBits(uint32_t x)
+{
+    x = ((x >> 1U) & 0x55555555U) | ((x & 0x55555555U) << 1U);
+    x = ((x >> 2U) & 0x33333333U) | ((x & 0x33333333U) << 2U);
+    x = ((x >> 4U) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4U);
+    x = ((x >> 8U) & 0x00FF00FFU) | ((x & 0x00FF00FFU) << 8U);
+    return (x >> 16U) | (x << 16U);
+}
+
+// Hash based Owen scrambling (Burley 2020, "Practical Hash-based Owen Scrambling")
+static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6C50B47CU;
+    x ^= x * 0xB82F1E52U;
+    x ^= x * 0xC7AFE638U;
+    x ^= x * 0x8D22F6E6U;
+    return ReverseBits(x);
+}
+
+static float ToUnitFloat(uint32_t x)
+{
+    return std::min(static_cast<float>(x) * 0x1p-32F, 0x1.fffffep-1F);
+}
+
+static uint32_t HashSeed(uint64_t a, uint64_t b)
+{
+    return static_cast<uint32_t>(MixBits(a ^ MixBits(b)));
+}
+
+static Eigen::Vector2f ScrambledSobol2D(uint32_t index, uint32_t seed)
+{
+    const float x = ToUnitFloat(NestedUniformScramble(Sobol(index, 0), HashSeed(seed, 0)));
+    const float y = ToUnitFloat(NestedUniformScramble(Sobol(index, 1), HashSeed(seed, 1)));
+    return { x, y };
+}
+
+/* Sobol */
+
+SobolSampler::SobolSampler(uint64_t seed) : _seed(seed) { }
+
+uint32_t SobolSampler::PixelSeed(const Eigen::Vector2i& pixel, uint32_t dimension) const
+{
+    const uint64_t pixel_key = (static_cast<uint64_t>(pixel.y()) << 32U) | static_cast<uint32_t>(pixel.x());
+    return HashSeed(_seed ^ pixel_key, dimension);
+}
+
+float SobolSampler::Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    const uint32_t seed = PixelSeed(pixel, dimension);
+    return ToUnitFloat(NestedUniformScramble(Sobol(NestedUniformScramble(index, seed), 0), HashSeed(seed, 0)));
+}
+
+Eigen::Vector2f SobolSampler::Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    // Shuffling the index decorrelates dimensions that share the same index
+    const uint32_t seed = PixelSeed(pixel, dimension);
+    return ScrambledSobol2D(NestedUniformScramble(index, seed), seed);
+}
+
+/* Z-order Sobol */
+
+static uint64_t EncodeMorton2(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint64_t v)
+    {
+        v &= 0xFFFFFFFFULL;
+        v = (v | (v << 16U)) & 0x0000FFFF0000FFFFULL;
+        v = (v | (v << 8U))  & 0x00FF00FF00FF00FFULL;
+        v = (v | (v << 4U))  & 0x0F0F0F0F0F0F0F0FULL;
+        v = (v | (v << 2U))  & 0x3333333333333333ULL;
+        v = (v | (v << 1U))  & 0x5555555555555555ULL;
+        return v;
+    };
+    return (spread(y) << 1U) | spread(x);
+}
+
+ZSobolSampler::ZSobolSampler(uint64_t seed, size_t film_width, size_t film_height)
+    : _seed(seed), _log2_resolution(static_cast<uint32_t>(std::bit_width(std::bit_ceil(std::max(film_width, film_height)) - 1))) { }
+
+uint32_t ZSobolSampler::SequenceIndex(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    // All permutations of the four digits of a base 4 number
+    static constexpr std::array<std::array<uint8_t, 4>, 24> kPermutations =
+    {{
+        {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+        {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+        {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+        {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+    }};
+
+    const auto log2_samples = static_cast<uint32_t>(std::bit_width(std::bit_ceil(std::max<uint32_t>(count, 1)) - 1));
+    const uint64_t morton   = (EncodeMorton2(pixel.x(), pixel.y()) << log2_samples) | index;
+
+    // Randomly permute the base 4 digits of the Morton index, seeded by the digits above them,
+    // so the Z-order curve does not show up as structure in the image
+    const bool odd_samples  = (log2_samples & 1U) != 0;
+    const uint32_t digits   = _log2_resolution + (log2_samples + 1) / 2;
+    const uint32_t last     = odd_samples ? 1 : 0;
+    const uint64_t dim_hash = 0x55555555ULL * dimension;
+
+    uint64_t sample_index = 0;
+    for (uint32_t i = digits; i-- > last;)
+    {
+        const uint32_t shift = 2 * i - last;
+        const uint64_t digit = (morton >> shift) & 3U;
+        const uint64_t above = morton >> (shift + 2);
+        const uint64_t perm  = (MixBits(above ^ dim_hash) >> 24U) % kPermutations.size();
+        sample_index |= static_cast<uint64_t>(kPermutations[perm][digit]) << shift;
+    }
+
+    if (odd_samples)
+        sample_index |= (morton & 1U) ^ (MixBits((morton >> 1U) ^ dim_hash) & 1U);
+
+    // Wrap very large films onto the 32 bit sequence, distant pixels may then share indices
+    return static_cast<uint32_t>(sample_index);
+}
+
+float ZSobolSampler::Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    const uint32_t seed = HashSeed(_seed, dimension);
+    return ToUnitFloat(NestedUniformScramble(Sobol(SequenceIndex(pixel, dimension, index, count), 0), seed));
+}
+
+Eigen::Vector2f ZSobolSampler::Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const
+{
+    return ScrambledSobol2D(SequenceIndex(pixel, dimension, index, count), HashSeed(_seed, dimension));
+}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "sampler.hpp"
+
+namespace CT
+{
+/// @brief Owen scrambled Sobol (0,2) sequence with hash based shuffling per pixel and dimension.
+/// Each dimension of a pixel is a well stratified 2D net, pixels are decorrelated from each other.
+class SobolSampler : public Sampler
+{
+public:
+    SobolSampler(uint64_t seed);
+
+    float Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const override;
+    Eigen::Vector2f Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const override;
+
+private:
+    uint32_t PixelSeed(const Eigen::Vector2i& pixel, uint32_t dimension) const;
+
+    uint64_t _seed;
+};
+
+/// @brief Owen scrambled Sobol sequence indexed along a Z-order curve over the film (Ahmed & Wonka 2020).
+/// Neighbouring pixels take consecutive blocks of one sequence, which distributes the error as blue noise.
+class ZSobolSampler : public Sampler
+{
+public:
+    ZSobolSampler(uint64_t seed, size_t film_width, size_t film_height);
+
+    float Get1D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const override;
+    Eigen::Vector2f Get2D(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const override;
+
+private:
+    uint32_t SequenceIndex(const Eigen::Vector2i& pixel, uint32_t dimension, uint32_t index, uint32_t count) const;
+
+    uint64_t _seed;
+    uint32_t _log2_resolution;
+};
+}
@@ -0,0 +1,646 @@
+#include "session.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bvh/bvh.hpp"
+#include "bvh/intersector.hpp"
+#include "camera/camera.hpp"
+#include "camera/film.hpp"
+#include "config/options.hpp"
+#include "embree/embreesingleton.hpp"
+#include "renderers/shading.hpp"
+#include "renderers/testrenderer.hpp"
+#include "renderers/wavefrontrenderer.hpp"
+#include "utils/exr.hpp"
+#include "utils/random.hpp"
+#include "utils/timer.hpp"
+
+namespace CT
+{
+std::optional<RenderJob> RenderJob::Parse(const std::string& line)
+{
+    RenderJob job;
+    std::istringstream tokens(line);
+    std::string token;
+    while (tokens >> token)
+    {
+        const size_t eq = token.find('=');
+        if (eq == std::string::npos)
+            return std::nullopt;
+
+        const std::string key   = token.substr(0, eq);
+        const std::string value = token.substr(eq + 1);
+        try
+        {
+            if (key == "spp")
+                job.samples_per_pixel = std::stoul(value);
+            else if (key == "direct")
+                job.direct_samples = std::stoul(value);
+            else if (key == "indirect")
+                job.indirect_samples = std::stoul(value);
+            else if (key == "depth")
+                job.recursion_depth = std::stoul(value);
+            else if (key == "output")
+                job.output = value;
+            else
+                return std::nullopt;
+        }
+        catch (const std::exception&)
+        {
+            return std::nullopt;
+        }
+    }
+    return job;
+}
+
+std::string RenderResult::ToString() const
+{
+    std::ostringstream ss;
+    ss << "render_ms=" << render_ms << " denoise_ms=" << denoise_ms << " write_ms=" << write_ms << " total_ms=" << total_ms;
+    if (errors)
+        ss << " l1=" << errors->l1 << " l2=" << errors->l2 << " psnr=" << errors->psnr << " ssim=" << errors->ssim
+           << " rel_mse=" << errors->rel_mse << " flip=" << errors->flip;
+    return ss.str();
+}
+
+/// @brief The renderer chosen by the configuration
+static std::unique_ptr<Renderer> MakeRenderer()
+{
+    if (ConfigSingleton::GetInstance().use_wavefront)
+        return std::make_unique<WavefrontRenderer>();
+    return std::make_unique<TestRenderer>();
+}
+
+RenderSession::RenderSession()
+{
+    ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    EmbreeSingleton& embree = EmbreeSingleton::GetInstance();
+
+    _defaults           = { cs.samples_per_pixel, cs.direct_samples, cs.indirect_samples, cs.recursion_depth };
+    _default_filename   = cs.image_filename;
+    _default_save_image = cs.save_image;
+
+    // Textures
+    assert(!embree.textures.contains("water"));
+    embree.textures.emplace("water", std::make_unique<Texture>(Texture("/home/Charlie/CGD-CTD/textures/water.png")));
+    assert(!embree.textures.contains("stone"));
+    embree.textures.emplace("stone", std::make_unique<Texture>(Texture("/home/Charlie/CGD-CTD/textures/stone.jpg")));
+    assert(!embree.textures.contains("test"));
+    embree.textures.emplace("test", std::make_unique<Texture>(Texture("/home/Charlie/CGD-CTD/textures/capsule0.jpg")));
+
+    _loader.LoadObjects(cs.environment.objects);
+    _renderer = MakeRenderer();
+
+    if (cs.use_bvh)
+    {
+        _bvh.emplace(BuildBVH(cs.scene_quality, _loader.GetTriangles(), cs.spatial_splits));
+        if (cs.intersector == Intersector::BVH4)
+            SetIntersectorBVH(&*_bvh);
+    }
+
+    // Reference image, renders are still written without it but are not compared
+    if (!cs.reference_filename.empty())
+    {
+        try
+        {
+            _reference.emplace(cs.reference_filename, cs.reference_cache);
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << "Could not load reference " << cs.reference_filename << ", differences will not be reported" << std::endl;
+        }
+    }
+}
+
+RenderSession::~RenderSession()
+{
+    // Frames still being post-processed read the reference
+    Wait();
+
+    if (_bvh)
+        SetIntersectorBVH(nullptr);
+}
+
+/// @brief A rendered film on its way through the post-processing stages, with the settings it was rendered with
+struct RenderSession::Frame
+{
+    Frame(size_t width, size_t height, const Eigen::Vector2i& canvas_size) : film(width, height, canvas_size) { }
+
+    Film film;
+    bool denoise;
+    bool streamed = false; // Denoised while rendering, raw holds the beauty before denoising if save_raw is set
+    std::vector<float> raw;
+    bool save_image;
+    bool save_raw;
+    bool save_aovs;
+    EXRSettings exr_settings;
+    std::filesystem::path filename;
+    DenoiserSettings denoiser_settings;
+    std::chrono::steady_clock::time_point start;
+    RenderResult result;
+};
+
+/// @brief Path of the raw image written next to a denoised one, e.g. out.exr becomes out-raw.exr
+static std::filesystem::path RawFilename(const std::filesystem::path& filename)
+{
+    std::filesystem::path raw = filename;
+    raw.replace_filename(filename.stem().string() + "-raw" + filename.extension().string());
+    return raw;
+}
+
+/// @brief Write an image on the writer thread, a failed write is reported and does not fail the frame
+/// @return Milliseconds taken by the write
+static int64_t WriteImage(const std::vector<EXRLayer>& layers, size_t width, size_t height, const std::filesystem::path& filename, const EXRSettings& settings)
+{
+    int64_t write_ms = 0;
+    {
+        Timer t([&write_ms](int64_t ms) { write_ms = ms; });
+        try
+        {
+            WriteEXR(layers, width, height, filename, settings);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    return write_ms;
+}
+
+std::shared_future<RenderResult> RenderSession::Submit(const RenderJob& job)
+{
+    ConfigSingleton& cs = ConfigSingleton::GetInstance();
+
+    // Bound the films waiting for post-processing, each holds a full resolution image
+    while (!_in_flight.empty() && (_in_flight.size() >= kMaxFramesInFlight || _in_flight.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+    {
+        _in_flight.front().wait();
+        _in_flight.pop_front();
+    }
+
+    const RenderParameters parameters = Resolve(job);
+    cs.samples_per_pixel = parameters.samples_per_pixel;
+    cs.direct_samples    = parameters.direct_samples;
+    cs.indirect_samples  = parameters.indirect_samples;
+    cs.recursion_depth   = parameters.recursion_depth;
+    cs.image_filename    = job.output.value_or(_default_filename);
+    cs.save_image        = job.output || _default_save_image;
+
+    // The post-processing stages read the settings of their frame, not the configuration, which the next job changes
+    auto frame = std::make_shared<Frame>(cs.image_width, cs.image_height, Eigen::Vector2i(cs.canvas_width, cs.canvas_height));
+    frame->denoise           = cs.denoiser;
+    frame->save_image        = cs.save_image;
+    frame->save_raw          = cs.save_raw;
+    frame->save_aovs         = cs.save_aovs;
+    frame->exr_settings      = cs.exr_settings;
+    frame->filename          = cs.image_filename;
+    frame->denoiser_settings = cs.denoiser_settings;
+    frame->start             = std::chrono::steady_clock::now();
+
+    Camera camera = cs.environment.camera;
+
+    _renderer->on_canvas_complete = nullptr;
+
+    // Progressive renders revisit every canvas each pass, so no region is final before the render ends
+    if (cs.denoiser && cs.stream_denoise && cs.time_budget <= 0.0F)
+    {
+        if (!_stream_denoiser)
+            _stream_denoiser.emplace(cs.denoiser_settings);
+        else
+            _stream_denoiser->SetSettings(cs.denoiser_settings);
+
+        frame->streamed = _stream_denoiser->BeginStream(frame->film);
+        if (frame->streamed)
+            _renderer->on_canvas_complete = [this](size_t canvas) { _stream_denoiser->CanvasComplete(canvas); };
+        else
+            std::cout << "The denoising device cannot read the film, denoising after the render" << std::endl;
+    }
+
+    // Render
+    {
+        Timer t([&frame](int64_t ms) { frame->result.render_ms = ms; });
+        _renderer->RenderFilm(frame->film, camera, std::thread::hardware_concurrency());
+    }
+
+    // Only the regions completed last are left to denoise
+    if (frame->streamed)
+    {
+        Timer t([&frame](int64_t ms) { frame->result.denoise_ms = ms; });
+        // A failed stream leaves the raw beauty in the film, which is then denoised whole
+        frame->streamed = _stream_denoiser->EndStream(frame->save_image && frame->save_raw ? &frame->raw : nullptr);
+    }
+
+    std::shared_future<RenderResult> result = _post.enqueue([this, frame] { return PostProcess(*frame); }).share();
+    _in_flight.push_back(result);
+    return result;
+}
+
+RenderResult RenderSession::PostProcess(Frame& frame)
+{
+    RenderResult& result = frame.result;
+    const size_t width   = frame.film.rect.GetWidth();
+    const size_t height  = frame.film.rect.GetHeight();
+
+    // The raw image is written while the denoiser works on the film
+    std::vector<float> raw;
+    std::future<int64_t> raw_write;
+    if (frame.denoise && frame.save_image && frame.save_raw)
+    {
+        raw = frame.streamed ? std::move(frame.raw) : frame.film.rgb;
+        raw_write = _writer.enqueue(WriteImage, std::vector<EXRLayer>{ { "", raw.data() } }, width, height, RawFilename(frame.filename), frame.exr_settings);
+    }
+
+    if (frame.streamed)
+        std::cout << "Denoised while rendering" << std::endl;
+    else if (frame.denoise)
+    {
+        Timer t([&result](int64_t ms) { result.denoise_ms = ms; });
+        if (!_denoiser)
+            _denoiser.emplace(frame.denoiser_settings);
+        else
+            _denoiser->SetSettings(frame.denoiser_settings);
+        _denoiser->Denoise(frame.film);
+        std::cout << "Denoised" << std::endl;
+    }
+    else
+        std::cout << "Raw" << std::endl;
+
+    // Denoised in place
+    const float* image = frame.film.rgb.data();
+
+    // Write to .EXR file while the differences are computed, both only read the image
+    std::future<int64_t> write;
+    if (frame.save_image)
+    {
+        std::vector<EXRLayer> layers = { { "", image } };
+        if (frame.save_aovs)
+        {
+            layers.push_back({ "albedo", frame.film.albedo.data() });
+            layers.push_back({ "normal", frame.film.normal.data() });
+        }
+        write = _writer.enqueue(WriteImage, std::move(layers), width, height, frame.filename, frame.exr_settings);
+    }
+
+    if (_reference && _reference->GetWidth() == width && _reference->GetHeight() == height)
+    {
+        const ImageComparison comparison = CompareImages(_reference->GetPixels(), image, width, height, std::thread::hardware_concurrency());
+        result.errors = comparison.image;
+        std::cout << "L1 difference: " << result.errors->l1 << std::endl;
+        std::cout << "L2 difference: " << result.errors->l2 << std::endl;
+        std::cout << "PSNR: " << result.errors->psnr << " dB, SSIM: " << result.errors->ssim << ", relMSE: " << result.errors->rel_mse
+                  << ", FLIP: " << result.errors->flip << std::endl;
+
+        // Point at the region that differs most, where a render setting falls short
+        const auto worst = std::max_element(comparison.map.tiles.begin(), comparison.map.tiles.end(),
+                                            [](const ImageErrors& a, const ImageErrors& b) { return a.flip < b.flip; });
+        const auto index = static_cast<size_t>(worst - comparison.map.tiles.begin());
+        std::cout << "Largest FLIP error " << worst->flip << " in the region at (" << index % comparison.map.tiles_x * comparison.map.tile_size << ", "
+                  << index / comparison.map.tiles_x * comparison.map.tile_size << ")" << std::endl;
+    }
+    else if (_reference)
+        std::cout << "Reference is " << _reference->GetWidth() << "x" << _reference->GetHeight() << ", differences are not reported" << std::endl;
+
+    if (raw_write.valid())
+        result.write_ms += raw_write.get();
+    if (write.valid())
+        result.write_ms += write.get();
+
+    result.total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - frame.start).count();
+    return result;
+}
+
+RenderResult RenderSession::Render(const RenderJob& job)
+{
+    return Submit(job).get();
+}
+
+void RenderSession::Wait()
+{
+    for (const auto& frame : _in_flight)
+        frame.wait();
+    _in_flight.clear();
+}
+
+RenderParameters RenderSession::Resolve(const RenderJob& job) const
+{
+    return {
+        job.samples_per_pixel.value_or(_defaults.samples_per_pixel),
+        job.direct_samples.value_or(_defaults.direct_samples),
+        job.indirect_samples.value_or(_defaults.indirect_samples),
+        job.recursion_depth.value_or(_defaults.recursion_depth)
+    };
+}
+
+double RenderSession::PredictRenderSeconds(const RenderJob& job)
+{
+    const ConfigSingleton& cs = ConfigSingleton::GetInstance();
+
+    if (!_cost_model)
+    {
+        // Calibration renders would compete with post-processing for the cores
+        Wait();
+
+        // Calibrate with the renderer the jobs use, the wavefront renderer traces the same rays at different costs
+        Camera camera = cs.environment.camera;
+        _renderer->on_canvas_complete = nullptr;
+        _cost_model = CostModel::Calibrate(*_renderer, camera, std::thread::hardware_concurrency());
+        _cost_model->Print();
+    }
+
+    return _cost_model->PredictSeconds(Resolve(job), cs.image_width, cs.image_height);
+}
+
+void RenderSession::ReportBVH(std::ostream& out)
+{
+    const ConfigSingleton& cs = ConfigSingleton::GetInstance();
+    assert(_bvh);
+
+    // One primary ray per pixel, and a diffuse bounce off every surface they hit
+    struct Ray
+    {
+        Eigen::Vector3f org;
+        Eigen::Vector3f dir;
+    };
+    std::vector<Ray> primary;
+    std::vector<Ray> bounce;
+
+    const Film film(cs.image_width, cs.image_height, Eigen::Vector2i(cs.canvas_width, cs.canvas_height));
+    RNG rng(cs.seed);
+    for (const Canvas& canvas : film.canvases)
+    {
+        for (size_t y = 0; y < canvas.rect.GetHeight(); y++)
+        {
+            for (size_t x = 0; x < canvas.rect.GetWidth(); x++)
+            {
+                const RTCRayHit rayhit = cs.environment.camera.GetRayForPixel(canvas, Eigen::Vector2i(x, y));
+                const Ray& ray = primary.emplace_back(Ray{ { rayhit.ray.org_x, rayhit.ray.org_y, rayhit.ray.org_z }, { rayhit.ray.dir_x, rayhit.ray.dir_y, rayhit.ray.dir_z } });
+
+                BVHHit hit;
+                if (!_bvh->Intersect(ray.org, ray.dir, 0.0F, std::numeric_limits<float>::infinity(), hit))
+                    continue;
+
+                Eigen::Vector3f normal = hit.Ng.normalized();
+                if (normal.dot(ray.dir) > 0.0F)
+                    normal = -normal;
+                bounce.push_back({ ray.org + hit.t * ray.dir, SampleCosineWeightedHemisphere(normal, Eigen::Vector2f(rng.Uniform(), rng.Uniform())).dir });
+            }
+        }
+    }
+
+    // Millions of rays per second
+    const auto trace = [](const BVH4& bvh, const std::vector<Ray>& rays)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+        BVHHit hit;
+        for (const Ray& ray : rays)
+            bvh.Intersect(ray.org, ray.dir, 0.0001F, std::numeric_limits<float>::infinity(), hit);
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        return static_cast<double>(rays.size()) / static_cast<double>(std::max<int64_t>(us, 1));
+    };
+
+    out << "BVH report for " << _loader.GetTriangles().size() << " triangles, " << primary.size() << " primary and " << bounce.size() << " bounce rays" << std::endl;
+    for (const RTCBuildQuality quality : { RTC_BUILD_QUALITY_LOW, RTC_BUILD_QUALITY_MEDIUM, RTC_BUILD_QUALITY_HIGH })
+    {
+        for (const bool spatial_splits : { false, true })
+        {
+            const BVH4 bvh = BuildBVH(quality, _loader.GetTriangles(), spatial_splits);
+            out << "bvh quality=" << BuildQualityName(quality) << " spatial_splits=" << spatial_splits << " " << bvh.GetStatistics().ToString()
+                << " primary_mrays=" << trace(bvh, primary) << " bounce_mrays=" << trace(bvh, bounce) << std::endl;
+        }
+    }
+}
+
+/// @brief Reply to one request, either known immediately or once a submitted frame completes
+struct Reply
+{
+    std::string text; // Whole reply, or the prefix of the result
+    std::shared_future<RenderResult> result;
+};
+
+/// @brief Sends replies in request order from its own thread, so requests keep being read and rendered
+/// while earlier frames are still post-processed
+class ReplyWriter
+{
+public:
+    explicit ReplyWriter(std::function<void(const std::string&)> send) :
+        _send(std::move(send)),
+        _thread([this] { Run(); })
+    {
+    }
+
+    ReplyWriter(const ReplyWriter&) = delete;
+    ReplyWriter& operator=(const ReplyWriter&) = delete;
+
+    /// @brief Send every queued reply, then stop
+    ~ReplyWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_one();
+        _thread.join();
+    }
+
+    void Push(Reply reply)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _replies.push_back(std::move(reply));
+        }
+        _condition.notify_one();
+    }
+
+private:
+    void Run()
+    {
+        while (true)
+        {
+            Reply reply;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this] { return _stop || !_replies.empty(); });
+                if (_replies.empty())
+                    return;
+                reply = std::move(_replies.front());
+                _replies.pop_front();
+            }
+
+            if (!reply.result.valid())
+            {
+                _send(reply.text);
+                continue;
+            }
+
+            // A frame that failed to post-process is answered like a job that failed to parse, the server keeps going
+            std::string text;
+            try
+            {
+                text = reply.text + reply.result.get().ToString();
+            }
+            catch (const std::exception& e)
+            {
+                text = std::string("error frame failed: ") + e.what();
+            }
+            _send(text);
+        }
+    }
+
+    const std::function<void(const std::string&)> _send;
+    std::deque<Reply> _replies;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stop = false;
+    std::thread _thread;
+};
+
+/// @brief Handle one request line
+/// @return Reply, or nothing if the client asked the server to quit
+static std::optional<Reply> HandleRequest(RenderSession& session, const std::string& line)
+{
+    if (line == "quit")
+        return std::nullopt;
+
+    // "predict <job>" answers with the predicted render time instead of rendering
+    const bool predict = line.starts_with("predict");
+    const std::optional<RenderJob> job = RenderJob::Parse(predict ? line.substr(7) : line);
+    if (!job)
+        return Reply{ "error could not parse job: " + line, {} };
+
+    if (predict)
+        return Reply{ "prediction render_s=" + std::to_string(session.PredictRenderSeconds(*job)), {} };
+
+    return Reply{ "result ", session.Submit(*job) };
+}
+
+/// @brief Write a reply and its newline in full
+/// @param fd
+/// @param reply
+/// @param socket Whether fd is a socket, which is written with MSG_NOSIGNAL
+/// @return False if the reader has gone away
+static bool WriteReply(int fd, const std::string& reply, bool socket)
+{
+    const std::string message = reply + "\n";
+    for (size_t sent = 0; sent < message.size();)
+    {
+        const ssize_t n = socket ? send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL)
+                                 : write(fd, message.data() + sent, message.size() - sent);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool ServeStream(RenderSession& session, std::istream& in, int out)
+{
+    ReplyWriter replies([out](const std::string& reply) { WriteReply(out, reply, false); });
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty())
+            continue;
+
+        std::optional<Reply> reply = HandleRequest(session, line);
+        if (!reply)
+            return false;
+        replies.Push(std::move(*reply));
+    }
+    return true;
+}
+
+/// @brief Serve the requests of one socket connection
+/// @param session
+/// @param client Connected socket
+/// @return False if the client asked the server to quit
+static bool ServeClient(RenderSession& session, int client)
+{
+    // Clients may disconnect with replies still queued, e.g. a killed sweep worker. MSG_NOSIGNAL turns the SIGPIPE that
+    // would end the server into EPIPE, and the remaining replies of the client are dropped.
+    bool disconnected = false; // Only touched by the reply thread
+    ReplyWriter replies([client, &disconnected](const std::string& reply)
+    {
+        if (!disconnected)
+            disconnected = !WriteReply(client, reply, true);
+    });
+
+    // Split the incoming bytes into lines, each line is one request
+    std::string pending;
+    std::array<char, 4096> buffer;
+    ssize_t received;
+    while ((received = read(client, buffer.data(), buffer.size())) > 0)
+    {
+        pending.append(buffer.data(), static_cast<size_t>(received));
+        for (size_t newline; (newline = pending.find('\n')) != std::string::npos;)
+        {
+            const std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (line.empty())
+                continue;
+
+            std::optional<Reply> reply = HandleRequest(session, line);
+            if (!reply)
+                return false;
+            replies.Push(std::move(*reply));
+        }
+    }
+    return true;
+}
+
+void ServeSocket(RenderSession& session, const std::filesystem::path& path)
+{
+    const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+        throw std::runtime_error("Could not create socket");
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + path.native());
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    unlink(path.c_str());
+    if (bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(server, 1) != 0)
+    {
+        close(server);
+        throw std::runtime_error("Could not listen on " + path.native());
+    }
+    std::cout << "Listening on " << path << std::endl;
+
+    for (bool serving = true; serving;)
+    {
+        const int client = accept(server, nullptr, nullptr);
+        if (client < 0)
+            continue;
+
+        serving = ServeClient(session, client);
+        close(client);
+    }
+
+    close(server);
+    unlink(path.c_str());
+}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "bvh/bvh.hpp"
+#include "denoiser/denoiser.hpp"
+#include "loaders/objloader.hpp"
+#include "metrics/metrics.hpp"
+#include "renderers/threadpool.hpp"
+#include "renderers/costmodel.hpp"
+#include "utils/referencecache.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace CT
+{
+class Renderer;
+
+/// @brief Parameters of one render. Fields that are not set keep the values parsed from the command line.
+struct RenderJob
+{
+    std::optional<size_t> samples_per_pixel;
+    std::optional<size_t> direct_samples;
+    std::optional<size_t> indirect_samples;
+    std::optional<size_t> recursion_depth;
+    std::optional<std::filesystem::path> output;
+
+    /// @brief Parse a job from whitespace separated key=value pairs, e.g. "spp=4 direct=8 indirect=8 depth=3 output=out.exr"
+    /// @param line
+    /// @return Nothing if a key or value is not recognised
+    static std::optional<RenderJob> Parse(const std::string& line);
+};
+
+/// @brief Timings and reference differences of a finished render
+struct RenderResult
+{
+    int64_t render_ms  = 0;
+    int64_t denoise_ms = 0;
+    int64_t write_ms   = 0;
+    int64_t total_ms   = 0;
+    std::optional<ImageErrors> errors; // Against the reference, if it has the resolution of the render
+
+    /// @brief Format the result as key=value pairs on one line
+    /// @return
+    std::string ToString() const;
+};
+
+/// @brief Everything that outlives a single render: the loaded scene and its BVH, the denoiser and the
+/// reference image. A session is created once per process and renders any number of jobs.
+/// Rendering happens on the thread that submits a job; denoising, comparing and writing the frame then run on a
+/// post-processing thread and a writer thread, overlapping with each other and with the render of the next job.
+class RenderSession
+{
+public:
+    /// @brief Load the textures, the scene and the reference image of the current configuration
+    RenderSession();
+
+    RenderSession(const RenderSession&) = delete;
+    RenderSession& operator=(const RenderSession&) = delete;
+
+    ~RenderSession();
+
+    /// @brief Apply a job to the configuration and render it, then queue the frame to be denoised, compared against the
+    /// reference and written. Waits first if kMaxFramesInFlight frames are still being post-processed.
+    /// @param job
+    /// @return Result, ready once the frame is written
+    std::shared_future<RenderResult> Submit(const RenderJob& job);
+
+    /// @brief Render a job and wait for its post-processing
+    /// @param job
+    /// @return
+    RenderResult Render(const RenderJob& job);
+
+    /// @brief Wait for every submitted frame to be post-processed
+    void Wait();
+
+    /// @brief Predict how long rendering a job would take, calibrating the cost model on first use
+    /// @param job
+    /// @return Seconds spent in RenderFilm
+    double PredictRenderSeconds(const RenderJob& job);
+
+    /// @brief Build the custom BVH at every build quality, with and without spatial splits, and print the statistics of
+    /// each build along with how fast it traces primary and diffuse bounce rays of the current camera on one thread
+    /// @param out
+    void ReportBVH(std::ostream& out);
+
+    static constexpr size_t kMaxFramesInFlight = 2;
+
+private:
+    struct Frame;
+
+    /// @brief Denoise, compare and write a rendered frame, runs on the post-processing thread
+    /// @param frame
+    /// @return
+    RenderResult PostProcess(Frame& frame);
+
+    /// @brief Sampling parameters of a job, falling back to the command line for the fields it does not set
+    /// @param job
+    /// @return
+    RenderParameters Resolve(const RenderJob& job) const;
+
+    // Settings parsed from the command line. Each job starts from them rather than from the configuration the previous
+    // job left behind.
+    RenderParameters _defaults {};
+    std::filesystem::path _default_filename;
+    bool _default_save_image = false;
+
+    ObjectLoader _loader;
+    std::unique_ptr<Renderer> _renderer; // Chosen by the configuration, keeps its render threads between jobs
+    std::optional<BVH4> _bvh; // Built from the loaded triangles if the custom BVH is enabled
+    std::optional<CostModel> _cost_model;
+
+    std::optional<Denoiser> _denoiser; // Created by the first render that denoises
+    std::optional<Denoiser> _stream_denoiser; // Denoises during the render on the caller thread, alongside the post-processing of the previous frame
+
+    std::optional<ReferenceImage> _reference;
+
+    std::deque<std::shared_future<RenderResult>> _in_flight;
+
+    // Post-processing tasks wait on writes, so the writer is declared first and outlives them
+    ThreadPool _writer { 1 };
+    ThreadPool _post   { 1 };
+};
+
+/// @brief Render one job per line read from a stream until it closes or reads "quit".
+/// Each job is answered with a line starting with "result", or "error" if it could not be parsed.
+/// A job prefixed with "predict" is answered with its predicted render time instead of being rendered.
+/// @param session
+/// @param in
+/// @param out File descriptor the replies are written to. Nothing else may write to it, or log lines would land
+/// between and inside replies.
+/// @return False if the stream asked the server to quit
+bool ServeStream(RenderSession& session, std::istream& in, int out);
+
+/// @brief Listen on a Unix domain socket and serve each connection with ServeStream, one at a time
+/// @param session
+/// @param path Socket path, an existing socket file is replaced
+void ServeSocket(RenderSession& session, const std::filesystem::path& path);
+}
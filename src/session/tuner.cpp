@@ -0,0 +1,283 @@
+#include "tuner.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "session.hpp"
+
+namespace CT
+{
+std::array<size_t, kTunerParameters.size()> ToParameters(const TunerPoint& point)
+{
+    std::array<size_t, kTunerParameters.size()> parameters;
+    for (size_t i = 0; i < kTunerParameters.size(); i++)
+    {
+        const TunerParameter& parameter = kTunerParameters[i];
+        parameters[i] = parameter.min + static_cast<size_t>(std::lround(point[i] * static_cast<double>(parameter.max - parameter.min)));
+    }
+    return parameters;
+}
+
+Tuner::Tuner(RenderSession& session, double time_weight, uint32_t seed) :
+    _session(session),
+    _time_weight(time_weight),
+    _rng(seed)
+{
+}
+
+double Tuner::Evaluate(TunerPoint point)
+{
+    for (double& p : point)
+        p = std::clamp(p, 0.0, 1.0);
+
+    const auto parameters = ToParameters(point);
+    if (const auto cached = _cache.find(parameters); cached != _cache.end())
+        return cached->second.objective;
+
+    RenderJob job;
+    job.samples_per_pixel = parameters[0];
+    job.direct_samples    = parameters[1];
+    job.indirect_samples  = parameters[2];
+    job.recursion_depth   = parameters[3];
+
+    if (_budget > 0.0)
+    {
+        const double predicted = _session.PredictRenderSeconds(job);
+        if (predicted > _budget)
+        {
+            std::cout << "Skipping " << kTunerParameters[0].name << "=" << parameters[0] << " " << kTunerParameters[1].name << "=" << parameters[1] << " "
+                      << kTunerParameters[2].name << "=" << parameters[2] << " " << kTunerParameters[3].name << "=" << parameters[3]
+                      << ", predicted to take " << predicted << " s" << std::endl;
+
+            // Rejected parameters are remembered so the search does not predict them again, but never become samples
+            TunerSample rejected {};
+            rejected.point     = point;
+            rejected.objective = std::numeric_limits<double>::infinity();
+            _cache.emplace(parameters, rejected);
+            return rejected.objective;
+        }
+    }
+
+    std::cout << "Tuning " << kTunerParameters[0].name << "=" << parameters[0] << " " << kTunerParameters[1].name << "=" << parameters[1] << " "
+              << kTunerParameters[2].name << "=" << parameters[2] << " " << kTunerParameters[3].name << "=" << parameters[3] << std::endl;
+
+    const RenderResult result = _session.Render(job);
+    if (!result.errors)
+        throw std::runtime_error("Tuning needs a reference image with the resolution of the render");
+
+    TunerSample sample;
+    sample.time_weight = _time_weight;
+    sample.attempt     = _attempt;
+    sample.iteration   = ++_iteration;
+    sample.point       = point;
+    sample.render_ms   = result.render_ms;
+    sample.l1          = static_cast<float>(result.errors->l1);
+    sample.objective   = result.errors->l1 + result.errors->l2 + _time_weight * static_cast<double>(result.render_ms);
+
+    std::cout << "Objective value: " << sample.objective << std::endl;
+
+    _samples.push_back(sample);
+    _cache.emplace(parameters, sample);
+    return sample.objective;
+}
+
+void Tuner::Sweep(size_t steps)
+{
+    assert(steps >= 2);
+
+    const size_t dimensions = kTunerParameters.size();
+    size_t combinations = 1;
+    for (size_t d = 0; d < dimensions; d++)
+        combinations *= steps;
+
+    _iteration = 0;
+    for (size_t c = 0; c < combinations; c++)
+    {
+        TunerPoint point;
+        for (size_t d = 0, index = c; d < dimensions; d++, index /= steps)
+            point[d] = static_cast<double>(index % steps) / static_cast<double>(steps - 1);
+        Evaluate(point);
+    }
+    _attempt++;
+}
+
+void Tuner::Optimise(size_t attempts, size_t max_evaluations)
+{
+    for (size_t a = 0; a < attempts; a++)
+    {
+        TunerPoint start {};
+        if (!_samples.empty())
+        {
+            // Search ever closer around the best point found so far
+            const double range = 1.0 / static_cast<double>((a + 1) * (a + 1));
+            std::uniform_real_distribution<double> perturbation(-range, range);
+            start = Best().point;
+            for (double& p : start)
+                p = std::clamp(p + perturbation(_rng), 0.0, 1.0);
+        }
+
+        std::cout << "Attempt " << a + 1 << " of " << attempts << std::endl;
+        _iteration = 0;
+        NelderMead(start, max_evaluations);
+        _attempt++;
+    }
+}
+
+void Tuner::NelderMead(const TunerPoint& start, size_t max_evaluations)
+{
+    constexpr size_t kDimensions = kTunerParameters.size();
+    constexpr double kStep       = 0.25; // Initial edge of the simplex
+    constexpr double kTolerance  = 1e-3; // Simplex edge below which no parameter changes any more
+
+    size_t evaluations = 0;
+    const auto evaluate = [&](const TunerPoint& point)
+    {
+        evaluations++;
+        return Evaluate(point);
+    };
+
+    std::array<std::pair<TunerPoint, double>, kDimensions + 1> simplex;
+    simplex[0] = { start, evaluate(start) };
+    for (size_t d = 0; d < kDimensions; d++)
+    {
+        TunerPoint vertex = start;
+        vertex[d] += vertex[d] + kStep <= 1.0 ? kStep : -kStep;
+        simplex[d + 1] = { vertex, evaluate(vertex) };
+    }
+
+    const auto combine = [](const TunerPoint& a, const TunerPoint& b, double t)
+    {
+        TunerPoint point;
+        for (size_t d = 0; d < kDimensions; d++)
+            point[d] = std::clamp(a[d] + t * (b[d] - a[d]), 0.0, 1.0);
+        return point;
+    };
+
+    while (evaluations < max_evaluations)
+    {
+        std::sort(simplex.begin(), simplex.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+
+        double size = 0.0;
+        for (size_t v = 1; v <= kDimensions; v++)
+            for (size_t d = 0; d < kDimensions; d++)
+                size = std::max(size, std::abs(simplex[v].first[d] - simplex[0].first[d]));
+        if (size < kTolerance)
+            break;
+
+        TunerPoint centroid {};
+        for (size_t v = 0; v < kDimensions; v++)
+            for (size_t d = 0; d < kDimensions; d++)
+                centroid[d] += simplex[v].first[d] / static_cast<double>(kDimensions);
+
+        auto& worst = simplex[kDimensions];
+
+        const TunerPoint reflected   = combine(centroid, worst.first, -1.0);
+        const double reflected_value = evaluate(reflected);
+
+        if (reflected_value < simplex[0].second)
+        {
+            const TunerPoint expanded   = combine(centroid, worst.first, -2.0);
+            const double expanded_value = evaluate(expanded);
+            worst = expanded_value < reflected_value ? std::make_pair(expanded, expanded_value) : std::make_pair(reflected, reflected_value);
+            continue;
+        }
+
+        if (reflected_value < simplex[kDimensions - 1].second)
+        {
+            worst = { reflected, reflected_value };
+            continue;
+        }
+
+        // Contract towards the better of the worst and the reflected point
+        const bool outside            = reflected_value < worst.second;
+        const TunerPoint contracted   = combine(centroid, outside ? reflected : worst.first, 0.5);
+        const double contracted_value = evaluate(contracted);
+        if (contracted_value < std::min(reflected_value, worst.second))
+        {
+            worst = { contracted, contracted_value };
+            continue;
+        }
+
+        // Shrink towards the best vertex
+        for (size_t v = 1; v <= kDimensions && evaluations < max_evaluations; v++)
+        {
+            simplex[v].first  = combine(simplex[0].first, simplex[v].first, 0.5);
+            simplex[v].second = evaluate(simplex[v].first);
+        }
+    }
+}
+
+const TunerSample& Tuner::Best() const
+{
+    assert(!_samples.empty());
+    return *std::min_element(_samples.begin(), _samples.end(), [](const TunerSample& a, const TunerSample& b) { return a.objective < b.objective; });
+}
+
+std::vector<TunerSample> ParetoFront(const std::vector<TunerSample>& samples)
+{
+    std::vector<TunerSample> sorted = samples;
+    std::sort(sorted.begin(), sorted.end(), [](const TunerSample& a, const TunerSample& b)
+    {
+        return a.render_ms != b.render_ms ? a.render_ms < b.render_ms : a.l1 < b.l1;
+    });
+
+    // Walking from the fastest render, a sample is on the front if it is closer to the reference than every faster one
+    std::vector<TunerSample> front;
+    float best_l1 = std::numeric_limits<float>::infinity();
+    for (const TunerSample& sample : sorted)
+    {
+        if (sample.l1 < best_l1)
+        {
+            front.push_back(sample);
+            best_l1 = sample.l1;
+        }
+    }
+    return front;
+}
+
+template<typename T>
+static void WriteJSONArray(std::ostream& out, const char* key, const std::vector<TunerSample>& samples, size_t begin, size_t end, const std::function<T(const TunerSample&)>& value, bool last)
+{
+    out << "        \"" << key << "\": [\n";
+    for (size_t i = begin; i < end; i++)
+        out << "            " << value(samples[i]) << (i + 1 < end ? ",\n" : "\n");
+    out << "        ]" << (last ? "\n" : ",\n");
+}
+
+void WriteTuningJSON(const std::vector<TunerSample>& samples, const std::filesystem::path& path, bool per_attempt)
+{
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Could not open " + path.string());
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+    out << "[\n";
+    for (size_t begin = 0; begin < samples.size();)
+    {
+        size_t end = begin + 1;
+        while (end < samples.size() && (!per_attempt || samples[end].attempt == samples[begin].attempt))
+            end++;
+
+        out << "    {\n";
+        WriteJSONArray<double>(out, "time_weight", samples, begin, end, [](const TunerSample& s) { return s.time_weight; }, false);
+        WriteJSONArray<size_t>(out, "attempt",     samples, begin, end, [](const TunerSample& s) { return s.attempt; }, false);
+        WriteJSONArray<size_t>(out, "iteration",   samples, begin, end, [](const TunerSample& s) { return s.iteration; }, false);
+        for (size_t p = 0; p < kTunerParameters.size(); p++)
+            WriteJSONArray<double>(out, kTunerParameters[p].name, samples, begin, end, [p](const TunerSample& s) { return s.point[p]; }, false);
+        WriteJSONArray<int64_t>(out, "render_time",     samples, begin, end, [](const TunerSample& s) { return s.render_ms; }, false);
+        WriteJSONArray<float>(out,   "L1_difference",   samples, begin, end, [](const TunerSample& s) { return s.l1; }, false);
+        WriteJSONArray<double>(out,  "objective_value", samples, begin, end, [](const TunerSample& s) { return s.objective; }, true);
+        out << "    }" << (end < samples.size() ? ",\n" : "\n");
+
+        begin = end;
+    }
+    out << "]\n";
+}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace CT
+{
+class RenderSession;
+
+/// @brief Range of one tuned parameter, the tuner works on values normalised to [0, 1] over it
+struct TunerParameter
+{
+    const char* name; // Key in the tuning JSON
+    size_t min;
+    size_t max;
+};
+
+/// @brief The tuned parameters, in the order of a TunerPoint. Ranges are those of oingo.py.
+inline constexpr std::array<TunerParameter, 4> kTunerParameters = {{
+    { "samples_pp",       1, 4  },
+    { "direct_samples",   1, 32 },
+    { "indirect_samples", 1, 16 },
+    { "recursion_depth",  1, 3  },
+}};
+
+using TunerPoint = std::array<double, kTunerParameters.size()>;
+
+/// @brief One evaluated render
+struct TunerSample
+{
+    double time_weight;
+    size_t attempt;
+    size_t iteration; // Starts at 1 within each attempt
+    TunerPoint point; // Normalised parameters
+    int64_t render_ms;
+    float l1;
+    double objective;
+};
+
+/// @brief Searches the sample counts and recursion depth for the best trade off between the difference to the
+/// reference and the render time. Every render happens in the session, so the scene, BVH and workers are reused.
+class Tuner
+{
+public:
+    /// @param session Session with a reference image matching the configured resolution
+    /// @param time_weight Weight of the render time in ms against the L1 + L2 difference
+    /// @param seed Seed of the perturbations between attempts
+    Tuner(RenderSession& session, double time_weight, uint32_t seed = 0);
+
+    /// @brief Render every combination of steps values per parameter, spread evenly over their ranges
+    /// @param steps
+    void Sweep(size_t steps);
+
+    /// @brief Run Nelder-Mead several times, each attempt starting from a perturbation of the best point so far as oingo.py does
+    /// @param attempts
+    /// @param max_evaluations Renders per attempt
+    void Optimise(size_t attempts, size_t max_evaluations);
+
+    /// @brief Skip parameters the cost model predicts to render for longer than a budget
+    /// @param seconds
+    void SetBudget(double seconds) { _budget = seconds; }
+
+    /// @brief Sample with the lowest objective, there must be at least one sample
+    const TunerSample& Best() const;
+
+    const std::vector<TunerSample>& GetSamples() const { return _samples; }
+
+private:
+    /// @brief Render the parameters at a point, renders of points that round to the same parameters are reused
+    /// @param point Normalised parameters, clamped to [0, 1]
+    /// @return Objective, infinity if the render was predicted to overrun the budget
+    double Evaluate(TunerPoint point);
+
+    /// @brief Downhill simplex over the normalised parameters
+    /// @param start
+    /// @param max_evaluations
+    void NelderMead(const TunerPoint& start, size_t max_evaluations);
+
+    RenderSession& _session;
+    const double _time_weight;
+    double _budget = 0.0; // Seconds, no limit if 0
+    std::mt19937 _rng;
+
+    size_t _attempt   = 0;
+    size_t _iteration = 0;
+    std::vector<TunerSample> _samples;
+    std::map<std::array<size_t, kTunerParameters.size()>, TunerSample> _cache;
+};
+
+/// @brief Map a normalised point to the parameters it renders with
+/// @param point
+/// @return
+std::array<size_t, kTunerParameters.size()> ToParameters(const TunerPoint& point);
+
+/// @brief Samples that no other sample beats in both L1 difference and render time
+/// @param samples
+/// @return Front sorted by render time
+std::vector<TunerSample> ParetoFront(const std::vector<TunerSample>& samples);
+
+/// @brief Write samples in the schema of testdata/*.json
+/// @param samples
+/// @param path
+/// @param per_attempt Start a new entry whenever the attempt changes, otherwise write a single entry
+void WriteTuningJSON(const std::vector<TunerSample>& samples, const std::filesystem::path& path, bool per_attempt = true);
+}
@@ -1,88 +1,295 @@
 #include "exr.hpp"
 
-#include "utils/timer.hpp"
+#include "renderers/threadpool.hpp"
 
+#include <Eigen/Core>
 #include <tinyexr.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstring>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
 #include <vector>
-#include <array>
-#include <cassert>
 
 
 namespace CT
 {
+/// @brief One channel of the file, read from a plane of interleaved RGB
+struct EXRChannel
+{
+    std::string name;
+    const float* rgb;
+    size_t component; // 0 for R, 1 for G, 2 for B
+};
 
-/// @brief Saves an EXR file from a float array
-/// @param rgb An array of floats representing the RGB values of the image
-/// @param width Width of the image
-/// @param height Height of the image
-/// @param outfilename File path and name of the output file
-/// @return 
-void WriteToEXR(const float* rgb, size_t width, size_t height, const char* outfilename) //TODO: replace const chat* with std::filesystem::path
+/// @brief Pixels covered by one chunk of the file, a block of scanlines or a tile
+struct EXRBlock
 {
-    Timer t = Timer("WriteToEXR");
+    size_t x0, y0, x1, y1; // x1 and y1 exclusive
+    std::array<int32_t, 2> tile; // Tile coordinates, unused for scanline blocks
+};
 
-    EXRHeader header;
-    InitEXRHeader(&header);
+std::optional<EXRCompression> ParseEXRCompression(const std::string& name)
+{
+    if (name == "none") return EXRCompression::None;
+    if (name == "zips") return EXRCompression::ZIPS;
+    if (name == "zip")  return EXRCompression::ZIP;
+    if (name == "piz")  return EXRCompression::PIZ;
+    if (name == "dwaa") return EXRCompression::DWAA;
+    return std::nullopt;
+}
+
+/// @brief Channels of the layers, sorted by name as EXR requires
+static std::vector<EXRChannel> SortedChannels(const std::vector<EXRLayer>& layers)
+{
+    std::vector<EXRChannel> channels;
+    for (const EXRLayer& layer : layers)
+    {
+        const std::string prefix = layer.name.empty() ? "" : layer.name + ".";
+        channels.push_back({ prefix + "R", layer.rgb, 0 });
+        channels.push_back({ prefix + "G", layer.rgb, 1 });
+        channels.push_back({ prefix + "B", layer.rgb, 2 });
+    }
+    std::sort(channels.begin(), channels.end(), [](const EXRChannel& a, const EXRChannel& b) { return a.name < b.name; });
+    return channels;
+}
+
+/// @brief Pixels of a block in file order: every line holds all of its first channel, then all of its second, and so on
+static std::vector<uint8_t> PackBlock(const std::vector<EXRChannel>& channels, const EXRBlock& block, size_t width, bool half)
+{
+    const size_t pixel_bytes = half ? sizeof(uint16_t) : sizeof(float);
+    const size_t line_pixels = block.x1 - block.x0;
+
+    std::vector<uint8_t> packed((block.y1 - block.y0) * line_pixels * channels.size() * pixel_bytes);
+    uint8_t* out = packed.data();
+    for (size_t y = block.y0; y < block.y1; y++)
+    {
+        for (const EXRChannel& channel : channels)
+        {
+            const float* in = channel.rgb + 3 * (y * width + block.x0) + channel.component;
+            for (size_t x = 0; x < line_pixels; x++, out += pixel_bytes)
+            {
+                if (half)
+                {
+                    const uint16_t bits = Eigen::numext::bit_cast<uint16_t>(Eigen::half(in[3 * x]));
+                    std::memcpy(out, &bits, sizeof(bits));
+                }
+                else
+                    std::memcpy(out, &in[3 * x], sizeof(float));
+            }
+        }
+    }
+    return packed;
+}
+
+/// @brief Deflate a block as the ZIP and ZIPS compressions of OpenEXR do
+/// @return The raw block if compressing does not make it smaller, readers then take it as uncompressed
+static std::vector<uint8_t> DeflateBlock(std::vector<uint8_t> raw)
+{
+    const size_t n = raw.size();
+
+    // Split the bytes at even and odd positions, which separates the low and high bytes of the values
+    std::vector<uint8_t> reordered(n);
+    for (size_t i = 0, half = (n + 1) / 2; i < n; i++)
+        reordered[(i % 2 == 0 ? 0 : half) + i / 2] = raw[i];
+
+    // Store differences to the previous byte, smooth images then deflate to long runs
+    for (size_t i = n; i-- > 1;)
+        reordered[i] = static_cast<uint8_t>(reordered[i] - reordered[i - 1] + 128);
+
+    uLongf size = compressBound(static_cast<uLong>(n));
+    std::vector<uint8_t> compressed(size);
+    if (compress2(compressed.data(), &size, reordered.data(), static_cast<uLong>(n), Z_DEFAULT_COMPRESSION) != Z_OK || size >= n)
+        return raw;
+
+    compressed.resize(size);
+    return compressed;
+}
+
+template<typename T>
+static void WriteValue(std::ostream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void WriteAttribute(std::ostream& out, const char* name, const char* type, const std::vector<char>& value)
+{
+    out.write(name, static_cast<std::streamsize>(std::strlen(name) + 1));
+    out.write(type, static_cast<std::streamsize>(std::strlen(type) + 1));
+    WriteValue(out, static_cast<int32_t>(value.size()));
+    out.write(value.data(), static_cast<std::streamsize>(value.size()));
+}
+
+template<typename... T>
+static std::vector<char> AttributeValue(const T&... values)
+{
+    std::vector<char> bytes;
+    (bytes.insert(bytes.end(), reinterpret_cast<const char*>(&values), reinterpret_cast<const char*>(&values) + sizeof(T)), ...);
+    return bytes;
+}
+
+/// @brief Write the file through tinyexr, for compressions the writer does not implement
+static void WriteEXRWithTinyEXR(const std::vector<EXRChannel>& channels, size_t width, size_t height, const std::filesystem::path& filename, const EXRSettings& settings)
+{
+    // tinyexr takes whole planes
+    std::vector<std::vector<float>> planes(channels.size(), std::vector<float>(width * height));
+    std::vector<float*> plane_pointers;
+    for (size_t c = 0; c < channels.size(); c++)
+    {
+        for (size_t i = 0; i < width * height; i++)
+            planes[c][i] = channels[c].rgb[3 * i + channels[c].component];
+        plane_pointers.push_back(planes[c].data());
+    }
 
     EXRImage image;
     InitEXRImage(&image);
+    image.num_channels = static_cast<int>(channels.size());
+    image.images = reinterpret_cast<unsigned char**>(plane_pointers.data());
+    image.width  = static_cast<int>(width);
+    image.height = static_cast<int>(height);
 
-    image.num_channels = 3;
+    EXRHeader header;
+    InitEXRHeader(&header);
+    header.num_channels = static_cast<int>(channels.size());
 
-    std::array<std::vector<float>, 3> images;
-    images[0].resize(width * height);
-    images[1].resize(width * height);
-    images[2].resize(width * height);
+    std::vector<EXRChannelInfo> infos(channels.size());
+    std::vector<int> pixel_types(channels.size(), TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<int> requested_pixel_types(channels.size(), settings.half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
+    for (size_t c = 0; c < channels.size(); c++)
+        strncpy(&infos[c].name[0], channels[c].name.c_str(), 255);
+    header.channels              = infos.data();
+    header.pixel_types           = pixel_types.data();
+    header.requested_pixel_types = requested_pixel_types.data();
+    header.compression_type      = TINYEXR_COMPRESSIONTYPE_PIZ;
 
-    // Split RGBRGBRGB... into R, G and B layer
-    for (size_t i = 0; i < width * height; i++)
+    if (settings.tiled)
     {
-        images[0][i] = rgb[3*i+0]; // R
-        images[1][i] = rgb[3*i+1]; // G
-        images[2][i] = rgb[3*i+2]; // B
+        header.tiled              = 1;
+        header.tile_size_x        = static_cast<int>(settings.tile_size);
+        header.tile_size_y        = static_cast<int>(settings.tile_size);
+        header.tile_level_mode    = TINYEXR_TILE_ONE_LEVEL;
+        header.tile_rounding_mode = TINYEXR_TILE_ROUND_DOWN;
     }
 
-    std::array<float*, 3> img_array;
-    img_array[0] = images[2].data(); // B
-    img_array[1] = images[1].data(); // G
-    img_array[2] = images[0].data(); // R
+    const char* err = nullptr;
+    if (SaveEXRImageToFile(&image, &header, filename.c_str(), &err) != TINYEXR_SUCCESS)
+    {
+        const std::string message = err ? err : "unknown error";
+        FreeEXRErrorMessage(err);
+        throw std::runtime_error("Could not write " + filename.string() + ": " + message);
+    }
+}
 
-    image.images = reinterpret_cast<unsigned char**>(img_array.data());
-    image.width  = static_cast<int>(width);
-    image.height = static_cast<int>(height);
+void WriteEXR(const std::vector<EXRLayer>& layers, size_t width, size_t height, const std::filesystem::path& filename, const EXRSettings& settings)
+{
+    const std::vector<EXRChannel> channels = SortedChannels(layers);
 
-    constexpr size_t num_channels = 3;
-    header.num_channels = static_cast<int>(num_channels);
-    std::array<EXRChannelInfo, num_channels> channels;
-    header.channels = channels.data();
+    EXRCompression compression = settings.compression;
+    if (compression == EXRCompression::DWAA)
+    {
+        std::cerr << "DWAA compression is not supported, writing " << filename << " with ZIP" << std::endl;
+        compression = EXRCompression::ZIP;
+    }
+    if (compression == EXRCompression::PIZ)
+    {
+        WriteEXRWithTinyEXR(channels, width, height, filename, settings);
+        return;
+    }
+
+    // Blocks in the order of the offset table: scanline blocks top to bottom, tiles row by row
+    std::vector<EXRBlock> blocks;
+    if (settings.tiled)
+    {
+        const size_t size = settings.tile_size;
+        for (size_t y = 0; y < height; y += size)
+            for (size_t x = 0; x < width; x += size)
+                blocks.push_back({ x, y, std::min(x + size, width), std::min(y + size, height), { static_cast<int32_t>(x / size), static_cast<int32_t>(y / size) } });
+    }
+    else
+    {
+        const size_t lines = compression == EXRCompression::ZIP ? 16 : 1;
+        for (size_t y = 0; y < height; y += lines)
+            blocks.push_back({ 0, y, width, std::min(y + lines, height), {} });
+    }
 
-    // Must be (A)BGR order, since most EXR viewers expect this channel order.
-    strncpy(&header.channels[0].name[0], "\0", 255); header.channels[0].name[0] = 'B';
-    strncpy(&header.channels[1].name[0], "\0", 255); header.channels[1].name[0] = 'G';
-    strncpy(&header.channels[2].name[0], "\0", 255); header.channels[2].name[0] = 'R';
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Could not open " + filename.string());
 
-    header.pixel_types           = new int[header.num_channels];
-    header.requested_pixel_types = new int[header.num_channels];
+    // Magic number and version, flagged as tiled if needed
+    WriteValue(out, static_cast<int32_t>(20000630));
+    WriteValue(out, static_cast<int32_t>(settings.tiled ? 2 | 0x200 : 2));
 
-    for (int i = 0; i < header.num_channels; i++) 
+    std::vector<char> channel_list;
+    for (const EXRChannel& channel : channels)
     {
-        // pixel type of input image
-        header.pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+        channel_list.insert(channel_list.end(), channel.name.begin(), channel.name.end());
+        channel_list.push_back('\0');
+        const std::vector<char> info = AttributeValue(static_cast<int32_t>(settings.half ? 1 : 2), static_cast<uint8_t>(0), std::array<uint8_t, 3>{},
+                                                      static_cast<int32_t>(1), static_cast<int32_t>(1));
+        channel_list.insert(channel_list.end(), info.begin(), info.end());
+    }
+    channel_list.push_back('\0');
 
-        // pixel type of output image to be stored in .EXR
-        header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_HALF; 
-    }    
+    const auto max_x = static_cast<int32_t>(width - 1);
+    const auto max_y = static_cast<int32_t>(height - 1);
+    WriteAttribute(out, "channels",           "chlist",      channel_list);
+    WriteAttribute(out, "compression",        "compression", AttributeValue(static_cast<uint8_t>(compression == EXRCompression::None ? 0 : compression == EXRCompression::ZIPS ? 2 : 3)));
+    WriteAttribute(out, "dataWindow",         "box2i",       AttributeValue(int32_t{ 0 }, int32_t{ 0 }, max_x, max_y));
+    WriteAttribute(out, "displayWindow",      "box2i",       AttributeValue(int32_t{ 0 }, int32_t{ 0 }, max_x, max_y));
+    WriteAttribute(out, "lineOrder",          "lineOrder",   AttributeValue(uint8_t{ 0 })); // Increasing y
+    WriteAttribute(out, "pixelAspectRatio",   "float",       AttributeValue(1.0F));
+    WriteAttribute(out, "screenWindowCenter", "v2f",         AttributeValue(0.0F, 0.0F));
+    WriteAttribute(out, "screenWindowWidth",  "float",       AttributeValue(1.0F));
+    if (settings.tiled)
+        WriteAttribute(out, "tiles", "tiledesc", AttributeValue(static_cast<uint32_t>(settings.tile_size), static_cast<uint32_t>(settings.tile_size), uint8_t{ 0 })); // One level
+    out.put('\0');
 
-    const char* err = nullptr;
-    int ret = SaveEXRImageToFile(&image, &header, outfilename, &err);
+    // The offset table is filled in once the size of every chunk is known
+    const std::streampos table = out.tellp();
+    std::vector<uint64_t> offsets(blocks.size(), 0);
+    out.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
 
-    delete[] header.pixel_types;
-    delete[] header.requested_pixel_types;
+    // Blocks are packed and compressed by the pool while this thread writes the finished ones in order
+    const size_t threads = settings.threads > 0 ? settings.threads : std::max<unsigned>(1, std::thread::hardware_concurrency());
+    ThreadPool pool(std::min(threads, blocks.size()));
+    std::vector<std::future<std::vector<uint8_t>>> compressed;
+    compressed.reserve(blocks.size());
+    for (const EXRBlock& block : blocks)
+    {
+        compressed.push_back(pool.enqueue([&channels, block, width, compression, half = settings.half]
+        {
+            std::vector<uint8_t> packed = PackBlock(channels, block, width, half);
+            return compression == EXRCompression::None ? packed : DeflateBlock(std::move(packed));
+        }));
+    }
 
-    assert(ret == TINYEXR_SUCCESS);
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        const std::vector<uint8_t> data = compressed[b].get();
+        offsets[b] = static_cast<uint64_t>(out.tellp());
+        if (settings.tiled)
+        {
+            WriteValue(out, blocks[b].tile[0]);
+            WriteValue(out, blocks[b].tile[1]);
+            WriteValue(out, int32_t{ 0 }); // Level
+            WriteValue(out, int32_t{ 0 });
+        }
+        else
+            WriteValue(out, static_cast<int32_t>(blocks[b].y0));
+        WriteValue(out, static_cast<int32_t>(data.size()));
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
 
-    std::cout << ret << std::endl;
+    out.seekp(table);
+    out.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+    if (!out)
+        throw std::runtime_error("Could not write " + filename.string());
+}
 }
-}
\ No newline at end of file
@@ -1,7 +1,51 @@
 #pragma once
 #include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace CT
 {
-void WriteToEXR(const float* rgb, size_t width, size_t height, const char* outfilename);
-}
\ No newline at end of file
+/// @brief Compression of the pixel blocks of an EXR
+enum class EXRCompression
+{
+    None,
+    ZIPS, // Deflate, one scanline per block
+    ZIP,  // Deflate, 16 scanlines per block
+    PIZ,  // Wavelet and Huffman, written through tinyexr
+    DWAA, // Lossy DCT, not supported by the writer, ZIP is used instead
+};
+
+/// @brief Parse a compression name, e.g. "zip"
+/// @param name
+/// @return Nothing if the name is not recognised
+std::optional<EXRCompression> ParseEXRCompression(const std::string& name);
+
+/// @brief How an EXR is laid out and compressed
+struct EXRSettings
+{
+    EXRCompression compression = EXRCompression::ZIP;
+    bool   tiled     = false; // Square tiles instead of scanline blocks
+    size_t tile_size = 64;
+    bool   half      = true;  // Store half floats instead of floats
+    size_t threads   = 0;     // Threads compressing blocks, 0 for one per core
+};
+
+/// @brief Interleaved RGB plane written as the R, G and B channels of a layer
+struct EXRLayer
+{
+    std::string name; // Prefix of the channel names, empty for the beauty
+    const float* rgb;
+};
+
+/// @brief Write RGB layers of the same size into one EXR. Blocks are packed straight from the interleaved planes and
+/// compressed in parallel, then written in order as they complete.
+/// @param layers
+/// @param width
+/// @param height
+/// @param filename
+/// @param settings
+/// @throws std::runtime_error If the file cannot be written
+void WriteEXR(const std::vector<EXRLayer>& layers, size_t width, size_t height, const std::filesystem::path& filename, const EXRSettings& settings = {});
+}
@@ -0,0 +1,95 @@
+#include "mappedfile.hpp"
+
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace CT
+{
+MappedFile::MappedFile(const std::filesystem::path& filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat status {};
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            _data = data;
+            _size = static_cast<size_t>(status.st_size);
+        }
+    }
+    close(fd); // The mapping keeps the file open
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data)
+        munmap(_data, _size);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    _data(std::exchange(other._data, nullptr)),
+    _size(std::exchange(other._size, 0))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (_data)
+            munmap(_data, _size);
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+    }
+    return *this;
+}
+
+uint64_t HashBytes(std::string_view bytes, uint64_t hash)
+{
+    for (const char c : bytes)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool WriteFileAtomically(const std::filesystem::path& filename, const std::function<void(std::ostream&)>& write)
+{
+    std::error_code error;
+    std::filesystem::create_directories(filename.parent_path(), error);
+
+    const std::filesystem::path partial = filename.string() + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream out(partial, std::ios::binary);
+        write(out);
+
+        // Buffered data is only written by the close, which is where a full disk shows up
+        out.close();
+        if (out.fail())
+        {
+            std::filesystem::remove(partial, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(partial, filename, error);
+    if (error)
+    {
+        std::filesystem::remove(partial, error);
+        return false;
+    }
+    return true;
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <string_view>
+
+namespace CT
+{
+/// @brief Read only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    /// @brief Map a file, the mapping is empty if the file cannot be opened or mapped
+    /// @param filename
+    explicit MappedFile(const std::filesystem::path& filename);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* GetData() const { return static_cast<const uint8_t*>(_data); }
+    size_t GetSize() const { return _size; }
+
+    explicit operator bool() const { return _data != nullptr; }
+
+private:
+    void* _data  = nullptr;
+    size_t _size = 0;
+};
+
+constexpr uint64_t kHashSeed = 14695981039346656037ULL;
+
+/// @brief FNV-1a, stable across runs and builds unlike std::hash
+/// @param bytes
+/// @param hash Hash to continue from, to hash several values together
+/// @return
+uint64_t HashBytes(std::string_view bytes, uint64_t hash = kHashSeed);
+
+/// @brief Write a file under a temporary name of this process and rename it into place, so other processes reading
+/// the same path only ever see complete files
+/// @param filename
+/// @param write Writes the contents
+/// @return False if the file could not be written, nothing is left behind
+bool WriteFileAtomically(const std::filesystem::path& filename, const std::function<void(std::ostream&)>& write);
+}
@@ -0,0 +1,43 @@
+#include "pathstatistics.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace CT
+{
+void PathStatistics::Record(size_t depth, bool survived)
+{
+    const size_t d = std::min(depth, kMaxDepth - 1);
+    _tested[d]++;
+    _survived[d] += static_cast<uint64_t>(survived);
+}
+
+void PathStatistics::Merge(const PathStatistics& other)
+{
+    for (size_t d = 0; d < kMaxDepth; d++)
+    {
+        _tested[d]   += other._tested[d];
+        _survived[d] += other._survived[d];
+    }
+}
+
+void PathStatistics::Print(std::ostream& os) const
+{
+    const std::ios_base::fmtflags flags = os.flags();
+    const std::streamsize precision     = os.precision();
+
+    os << "Path survival by depth" << std::endl;
+    for (size_t d = 0; d < kMaxDepth; d++)
+    {
+        if (_tested[d] == 0)
+            continue;
+
+        const double rate = static_cast<double>(_survived[d]) / static_cast<double>(_tested[d]);
+        os << "  depth " << std::setw(2) << d << (d == kMaxDepth - 1 ? "+" : " ") << ": " << _survived[d] << " / " << _tested[d]
+           << " survived (" << std::fixed << std::setprecision(1) << rate * 100.0 << "%)" << std::endl;
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace CT
+{
+/// @brief Per-depth counts of the paths that reached a bounce and of those that survived russian roulette.
+/// Counters are plain integers, each render task records into its own instance and merges it once done.
+class PathStatistics
+{
+public:
+    static constexpr size_t kMaxDepth = 16;
+
+    /// @brief Record the outcome of a roulette test, depths past kMaxDepth share the last bucket
+    /// @param depth
+    /// @param survived
+    void Record(size_t depth, bool survived);
+
+    /// @brief Add the counts of another instance
+    /// @param other
+    void Merge(const PathStatistics& other);
+
+    /// @brief Print the survival rate of every depth a path reached
+    /// @param os
+    void Print(std::ostream& os) const;
+
+private:
+    std::array<uint64_t, kMaxDepth> _tested{};
+    std::array<uint64_t, kMaxDepth> _survived{};
+};
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace CT
+{
+/// @brief Finalise a 64 bit value into a well mixed hash (splitmix64)
+/// @param v
+/// @return
+inline uint64_t MixBits(uint64_t v)
+{
+    v ^= v >> 31;
+    v *= 0x7FB5D329728EA185ULL;
+    v ^= v >> 27;
+    v *= 0x81DADEF4BC2DD44DULL;
+    v ^= v >> 33;
+    return v;
+}
+
+/// @brief PCG32 random number generator. Small enough to live on the stack of each render thread,
+/// so sampling code never shares generator state between threads.
+class RNG
+{
+public:
+    /// @brief Create a generator for one independent stream of a seeded render
+    /// @param seed Render seed, the same seed reproduces the same image
+    /// @param stream Stream selector, e.g. the film pixel index
+    RNG(uint64_t seed, uint64_t stream = 0)
+    {
+        _inc = (MixBits(stream) << 1U) | 1U;
+        NextUInt();
+        _state += MixBits(seed);
+        NextUInt();
+    }
+
+    /// @brief Uniformly distributed 32 bit integer
+    uint32_t NextUInt()
+    {
+        const uint64_t old = _state;
+        _state = old * 0x5851F42D4C957F2DULL + _inc;
+        const auto xorshifted = static_cast<uint32_t>(((old >> 18U) ^ old) >> 27U);
+        const auto rot        = static_cast<uint32_t>(old >> 59U);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1U) & 31U));
+    }
+
+    /// @brief Uniformly distributed float in [0, 1)
+    float Uniform()
+    {
+        return std::min(static_cast<float>(NextUInt()) * 0x1p-32F, 0x1.fffffep-1F);
+    }
+
+    /// @brief Uniformly distributed float in [min, max)
+    float Range(float min, float max)
+    {
+        return min + (max - min) * Uniform();
+    }
+
+    /// @brief Vector with components uniformly distributed in [-1, 1)
+    Eigen::Vector3f Vector()
+    {
+        const float x = Range(-1.0F, 1.0F);
+        const float y = Range(-1.0F, 1.0F);
+        const float z = Range(-1.0F, 1.0F);
+        return { x, y, z };
+    }
+
+private:
+    uint64_t _state = 0;
+    uint64_t _inc   = 1;
+};
+}
@@ -0,0 +1,63 @@
+#include "raystats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace CT
+{
+using RayCounters = std::array<std::atomic<uint64_t>, static_cast<size_t>(RayType::Count)>;
+
+// Counters of every live thread, plus the totals of threads that have exited
+static std::mutex registry_mutex;
+static std::vector<const RayCounters*> registry;
+static RayCounters retired{};
+
+/// @brief Counters of one thread, registered for its lifetime
+struct ThreadRayCounters
+{
+    alignas(64) RayCounters counters{};
+
+    ThreadRayCounters()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(&counters);
+    }
+
+    ~ThreadRayCounters()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (size_t i = 0; i < counters.size(); i++)
+            retired[i].fetch_add(counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        registry.erase(std::find(registry.begin(), registry.end(), &counters));
+    }
+};
+
+void CountRays(RayType type, uint64_t n)
+{
+    thread_local ThreadRayCounters thread_counters;
+    std::atomic<uint64_t>& counter = thread_counters.counters[static_cast<size_t>(type)];
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); // Only this thread writes it
+}
+
+uint64_t GetRayCount(RayType type)
+{
+    const auto i = static_cast<size_t>(type);
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    uint64_t total = retired[i].load(std::memory_order_relaxed);
+    for (const RayCounters* counters : registry)
+        total += (*counters)[i].load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t GetTotalRayCount()
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < static_cast<size_t>(RayType::Count); i++)
+        total += GetRayCount(static_cast<RayType>(i));
+    return total;
+}
+}
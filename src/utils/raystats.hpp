@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace CT
+{
+/// @brief Categories of rays counted by the ray statistics
+enum class RayType : size_t
+{
+    Primary,
+    Hemisphere, // Sampling the hemisphere above a hit
+    Reflection, // Continuing a path along a reflection, into the next recursion
+    Shadow,
+    Count
+};
+
+/// @brief Count rays traced by the calling thread. Each thread increments its own counters,
+/// so counting adds no contention to the render loops.
+/// @param type
+/// @param n
+void CountRays(RayType type, uint64_t n = 1);
+
+/// @brief Rays of a category traced by all threads, including threads that have exited
+/// @param type
+/// @return
+uint64_t GetRayCount(RayType type);
+
+/// @brief Rays of every category traced by all threads
+/// @return
+uint64_t GetTotalRayCount();
+}
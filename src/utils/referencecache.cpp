@@ -0,0 +1,109 @@
+#include "referencecache.hpp"
+#include "mappedfile.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace CT
+{
+constexpr std::array<char, 8> kCacheMagic = { 'C', 'T', 'R', 'E', 'F', '0', '0', '1' };
+
+/// @brief Start of a cache file. The pixels follow at the end of the header, which keeps them 64 byte aligned in the mapping.
+struct alignas(64) CacheHeader
+{
+    std::array<char, 8> magic;
+    uint64_t width;
+    uint64_t height;
+    int64_t  mtime;  // Modification time of the EXR the pixels were decoded from
+    uint64_t size;   // Size of that EXR in bytes
+};
+static_assert(sizeof(CacheHeader) == 64);
+
+ReferenceImage::ReferenceImage(const std::filesystem::path& filename, const std::filesystem::path& cache_directory)
+{
+    std::error_code error;
+    const std::filesystem::path source = std::filesystem::canonical(filename, error);
+    if (error)
+        throw std::runtime_error("Reference " + filename.string() + " does not exist");
+
+    const int64_t mtime = std::filesystem::last_write_time(source).time_since_epoch().count();
+    const uint64_t size = std::filesystem::file_size(source);
+
+    std::filesystem::path cache;
+    if (!cache_directory.empty())
+    {
+        std::ostringstream name;
+        name << source.stem().string() << "-" << std::hex << std::setw(16) << std::setfill('0') << HashBytes(source.string()) << ".ref";
+        cache = cache_directory / name.str();
+
+        if (Map(cache, mtime, size))
+        {
+            std::cout << "Mapped reference " << filename << " from " << cache << std::endl;
+            return;
+        }
+    }
+
+    int width  = 0;
+    int height = 0;
+    _decoded = LoadEXRFromFile(source.c_str(), width, height);
+    _pixels  = _decoded;
+    _width   = static_cast<size_t>(width);
+    _height  = static_cast<size_t>(height);
+
+    if (cache.empty())
+        return;
+
+    const bool written = WriteFileAtomically(cache, [&](std::ostream& out)
+    {
+        CacheHeader header {};
+        header.magic  = kCacheMagic;
+        header.width  = _width;
+        header.height = _height;
+        header.mtime  = mtime;
+        header.size   = size;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(_decoded), static_cast<std::streamsize>(_width * _height * 4 * sizeof(float)));
+    });
+
+    if (!written || !Map(cache, mtime, size))
+    {
+        std::cerr << "Could not write the reference cache " << cache << ", using the decoded reference" << std::endl;
+        return;
+    }
+
+    std::cout << "Cached reference " << filename << " in " << cache << std::endl;
+    free(_decoded); // Allocated by tinyexr
+    _decoded = nullptr;
+}
+
+ReferenceImage::~ReferenceImage()
+{
+    free(_decoded);
+}
+
+bool ReferenceImage::Map(const std::filesystem::path& cache, int64_t mtime, uint64_t size)
+{
+    MappedFile mapping(cache);
+    if (!mapping || mapping.GetSize() < sizeof(CacheHeader))
+        return false;
+
+    const auto* header = reinterpret_cast<const CacheHeader*>(mapping.GetData());
+    const bool valid = header->magic == kCacheMagic && header->mtime == mtime && header->size == size &&
+                       mapping.GetSize() == sizeof(CacheHeader) + header->width * header->height * 4 * sizeof(float);
+    if (!valid)
+        return false;
+
+    _pixels  = reinterpret_cast<const float*>(header + 1);
+    _width   = header->width;
+    _height  = header->height;
+    _mapping = std::move(mapping);
+    return true;
+}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include "mappedfile.hpp"
+
+namespace CT
+{
+/// @brief Reference image for comparing renders, decoded from its EXR once and then memory mapped.
+/// The decoded RGBA floats are kept in a cache file named after the path of the EXR and validated against its
+/// modification time and size, so later runs map the pixels instead of decoding them. Cache files are written under a
+/// temporary name and renamed into place, so processes sharing a cache directory never see a partial file.
+class ReferenceImage
+{
+public:
+    /// @brief Map the cached pixels of an EXR, decoding it into the cache first if needed
+    /// @param filename EXR file
+    /// @param cache_directory Where decoded references are kept, decoding every time if empty
+    /// @throws std::runtime_error If the EXR cannot be read
+    ReferenceImage(const std::filesystem::path& filename, const std::filesystem::path& cache_directory);
+    ~ReferenceImage();
+
+    ReferenceImage(const ReferenceImage&) = delete;
+    ReferenceImage& operator=(const ReferenceImage&) = delete;
+
+    /// @brief RGBA pixels, row by row
+    const float* GetPixels() const { return _pixels; }
+    size_t GetWidth() const { return _width; }
+    size_t GetHeight() const { return _height; }
+
+private:
+    /// @brief Map a cache file if it was decoded from the current version of the EXR
+    /// @return False if the cache file is missing or stale
+    bool Map(const std::filesystem::path& cache, int64_t mtime, uint64_t size);
+
+    const float* _pixels = nullptr;
+    size_t _width  = 0;
+    size_t _height = 0;
+
+    MappedFile _mapping; // Whole cache file, header included
+    float* _decoded = nullptr; // Allocated by tinyexr when no cache file could be written
+};
+}
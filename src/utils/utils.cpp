@@ -16,14 +16,6 @@ uint64_t GetGUID()
     return guid++;
 }
 
-float RandomRange(float min, float max)
-{
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> dis(min, max);
-    return dis(gen);    
-}
-
 // float RandomNormalDistribution()
 // {
 //     std::random_device rd{};
@@ -59,6 +51,7 @@ void ToUnitDisk(double seedx, double seedy, double *x, double *y)
         }
         else
         {
+            r = b;
             phi = (M_PI / 4.0F) * (2.0F - (a / b));
         }
     }
@@ -102,60 +95,4 @@ float* LoadEXRFromFile(const char* filename, int& width, int& height)
     return rgba;
 }
 
-float L1Difference(const float* a, const float* b, size_t height, size_t width)
-{
-    float L1_sum_a = 0.0F;
-    float L1_sum_b = 0.0F;
-
-    for (size_t y = 0; y < static_cast<size_t>(height); y++)
-    {
-        for (size_t x = 0; x < static_cast<size_t>(width); x++)
-        {
-            float Ra = a[4 * (y * width + x) + 0];
-            float Ga = a[4 * (y * width + x) + 1];
-            float Ba = a[4 * (y * width + x) + 2];
-            L1_sum_a += (Ra + Ga + Ba) / 3.0F;
-
-            float Rb = b[3 * (y * width + x) + 0];
-            float Gb = b[3 * (y * width + x) + 1];
-            float Bb = b[3 * (y * width + x) + 2];
-            L1_sum_b += (Rb + Gb + Bb) / 3.0F;
-        }
-    }
-
-    L1_sum_a /= static_cast<float>(width * height);
-    L1_sum_b /= static_cast<float>(width * height);
-    float L1_diff = std::abs(L1_sum_a - L1_sum_b);
-
-    return L1_diff;
-}
-
-float L2Difference(const float* a, const float* b, size_t height, size_t width)
-{
-    float L2_sum = 0.0F;
-
-    for (size_t y = 0; y < static_cast<size_t>(height); y++)
-    {
-        for (size_t x = 0; x < static_cast<size_t>(width); x++)
-        {
-            float Ra = a[4 * (y * width + x) + 0];
-            float Ga = a[4 * (y * width + x) + 1];
-            float Ba = a[4 * (y * width + x) + 2];
-
-            float Rb = b[3 * (y * width + x) + 0];
-            float Gb = b[3 * (y * width + x) + 1];
-            float Bb = b[3 * (y * width + x) + 2];
-
-            float L2_R = std::pow(Ra - Rb, 2.0F);
-            float L2_G = std::pow(Ga - Gb, 2.0F);
-            float L2_B = std::pow(Ba - Bb, 2.0F);
-            L2_sum += (L2_R + L2_G + L2_B) / 3.0F;
-        }
-    }
-
-    L2_sum /= static_cast<float>(width * height);
-
-    return L2_sum;
-}
-
 }